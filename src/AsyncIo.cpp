@@ -0,0 +1,194 @@
+#include "AsyncIo.h"
+#include "Trace.h"
+#include "Utils.h"
+
+namespace jxr {
+
+// Completion key that tells a worker thread to exit
+static constexpr ULONG_PTR kQuitKey = 1;
+
+struct AsyncIo::Op {
+  OVERLAPPED ov = {}; // must stay first: completions hand back &ov
+  CommitChain chain;
+  HANDLE file = INVALID_HANDLE_VALUE;
+};
+
+// ============================================================================
+// Chain steps shared by the async and sync paths
+// ============================================================================
+static HANDLE CreateTempFile(const std::wstring &path, DWORD flags) {
+  HANDLE file = ::CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | flags,
+                              nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    LogMsg(L"Failed to write temp output file: %s, error %u", path.c_str(),
+           ::GetLastError());
+  }
+  return file;
+}
+
+// Flush (so the rename can't land before the data) and close the temp file
+static bool FlushAndClose(HANDLE file, bool written, const CommitChain &c) {
+  if (written && !::FlushFileBuffers(file)) {
+    LogMsg(L"Failed to flush %s, error %u", c.tempPath.c_str(),
+           ::GetLastError());
+    written = false;
+  }
+  ::CloseHandle(file);
+  return written;
+}
+
+// Rename over the final name, then drop the source
+static void FinishChain(CommitChain &c, bool written) {
+  bool ok = false;
+  bool sourceKept = true;
+  if (written) {
+    if (c.onStep)
+      c.onStep(CommitStep::TempWritten);
+    if (::MoveFileExW(c.tempPath.c_str(), c.finalPath.c_str(),
+                      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+      ok = true;
+      if (c.onStep)
+        c.onStep(CommitStep::Renamed);
+      if (::DeleteFileW(c.sourcePath.c_str())) {
+        sourceKept = false;
+        if (c.onStep)
+          c.onStep(CommitStep::SourceRemoved);
+      } else {
+        LogMsg(L"Could not delete original JXR (locked?), error %u — keeping "
+               L"both files",
+               ::GetLastError());
+      }
+    } else {
+      LogMsg(L"Failed to rename temp file to final, error %u",
+             ::GetLastError());
+    }
+  }
+  if (c.onDone)
+    c.onDone(ok, sourceKept);
+}
+
+void AsyncIo::CommitSync(CommitChain chain) {
+  bool written = false;
+  HANDLE file = CreateTempFile(chain.tempPath, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD got = 0;
+    written = ::WriteFile(file, chain.data.data(),
+                          static_cast<DWORD>(chain.data.size()), &got,
+                          nullptr) &&
+              got == chain.data.size();
+    written = FlushAndClose(file, written, chain);
+  }
+  FinishChain(chain, written);
+}
+
+// ============================================================================
+// Completion port
+// ============================================================================
+AsyncIo::AsyncIo(unsigned threads, size_t maxInFlight)
+    : maxInFlight_(maxInFlight ? maxInFlight : 1) {
+  port_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, threads);
+  if (!port_) {
+    LogMsg(L"AsyncIo: no completion port (error %u), committing synchronously",
+           ::GetLastError());
+    return;
+  }
+  for (unsigned i = 0; i < threads; ++i)
+    threads_.emplace_back(&AsyncIo::WorkerLoop, this);
+}
+
+AsyncIo::~AsyncIo() {
+  Drain();
+  for (size_t i = 0; i < threads_.size(); ++i)
+    ::PostQueuedCompletionStatus(port_, 0, kQuitKey, nullptr);
+  for (auto &t : threads_) {
+    if (t.joinable())
+      t.join();
+  }
+  if (port_)
+    ::CloseHandle(port_);
+}
+
+void AsyncIo::Commit(CommitChain chain) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return inFlight_ < maxInFlight_; });
+    ++inFlight_;
+  }
+
+  auto *op = new Op;
+  op->chain = std::move(chain);
+
+  if (!port_) {
+    CommitSync(std::move(op->chain));
+    delete op;
+    std::lock_guard<std::mutex> lock(mutex_);
+    --inFlight_;
+    changed_.notify_all();
+    return;
+  }
+
+  op->file = CreateTempFile(op->chain.tempPath, FILE_FLAG_OVERLAPPED);
+  if (op->file == INVALID_HANDLE_VALUE) {
+    Complete(op, false);
+    return;
+  }
+  if (!::CreateIoCompletionPort(op->file, port_, 0, 0)) {
+    LogMsg(L"AsyncIo: cannot attach %s to the port, error %u",
+           op->chain.tempPath.c_str(), ::GetLastError());
+    ::CloseHandle(op->file);
+    Complete(op, false);
+    return;
+  }
+
+  // The completion (even for an immediate success) arrives on the port
+  if (!::WriteFile(op->file, op->chain.data.data(),
+                   static_cast<DWORD>(op->chain.data.size()), nullptr,
+                   &op->ov) &&
+      ::GetLastError() != ERROR_IO_PENDING) {
+    LogMsg(L"Failed to write temp output file: %s, error %u",
+           op->chain.tempPath.c_str(), ::GetLastError());
+    ::CloseHandle(op->file);
+    Complete(op, false);
+  }
+}
+
+void AsyncIo::WorkerLoop() {
+  TraceThreadName("io");
+  while (true) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED *ov = nullptr;
+    BOOL ok = ::GetQueuedCompletionStatus(port_, &bytes, &key, &ov, INFINITE);
+    if (!ov) {
+      if (key == kQuitKey)
+        break;
+      continue; // port error without a packet
+    }
+
+    Op *op = CONTAINING_RECORD(ov, Op, ov);
+    TraceSpan span("flush, rename, delete");
+    bool written = ok && bytes == op->chain.data.size();
+    if (!written) {
+      LogMsg(L"Failed to write temp output file: %s, error %u",
+             op->chain.tempPath.c_str(), ok ? 0u : ::GetLastError());
+    }
+    Complete(op, FlushAndClose(op->file, written, op->chain));
+  }
+}
+
+void AsyncIo::Complete(Op *op, bool written) {
+  FinishChain(op->chain, written);
+  delete op;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  --inFlight_;
+  changed_.notify_all();
+}
+
+void AsyncIo::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return inFlight_ == 0; });
+}
+
+} // namespace jxr
@@ -0,0 +1,75 @@
+#pragma once
+#include "EncodedJpeg.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <windows.h>
+
+namespace jxr {
+
+/// Steps of a commit chain, reported as each one completes.
+enum class CommitStep {
+  TempWritten,  // temp file written and flushed to disk
+  Renamed,      // temp renamed over the final name (write-through)
+  SourceRemoved // source deleted
+};
+
+/// One output commit: write `data` to `tempPath`, flush, rename it to
+/// `finalPath`, then delete `sourcePath`. The final file exists before the
+/// source goes away, so no crash point leaves neither of them on disk.
+struct CommitChain {
+  std::wstring sourcePath;
+  std::wstring tempPath;
+  std::wstring finalPath;
+  EncodedJpeg data;
+
+  /// Called after each step, on the thread that ran it (e.g. to journal it).
+  std::function<void(CommitStep)> onStep;
+  /// Called once at the end. `ok`: the final file is in place.
+  /// `sourceKept`: the source could not be deleted (locked) or ok is false.
+  std::function<void(bool ok, bool sourceKept)> onDone;
+};
+
+/// Asynchronous output commits on an I/O completion port. The temp write is
+/// overlapped; flush, rename and delete have no overlapped form, so they run
+/// as the write's continuation on the port's worker threads. Commits for
+/// many files thus overlap instead of serializing on the caller. If the
+/// port cannot be created, chains run synchronously on the caller.
+class AsyncIo {
+public:
+  explicit AsyncIo(unsigned threads = 2, size_t maxInFlight = 8);
+  /// Waits for outstanding chains, then stops the worker threads.
+  ~AsyncIo();
+  AsyncIo(const AsyncIo &) = delete;
+  AsyncIo &operator=(const AsyncIo &) = delete;
+
+  /// Starts a chain. Blocks while `maxInFlight` chains are outstanding, which
+  /// bounds the encoded buffers held for slow disks.
+  void Commit(CommitChain chain);
+
+  /// Waits until every chain started so far has called onDone.
+  void Drain();
+
+  /// Runs a chain to completion on the calling thread.
+  static void CommitSync(CommitChain chain);
+
+private:
+  struct Op;
+
+  void WorkerLoop();
+  void Complete(Op *op, bool written);
+
+  HANDLE port_ = nullptr;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  size_t inFlight_ = 0;
+  size_t maxInFlight_;
+};
+
+} // namespace jxr
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace jxr {
+
+class CancelToken;
+
+/// Cancels, in one step, every conversion started before the call (e.g. all
+/// in-flight work when a game goes fullscreen). Conversions started
+/// afterwards get fresh tokens and are unaffected, so nothing needs to be
+/// reset once the reason has passed.
+class CancelSource {
+public:
+  void Cancel() { generation_.fetch_add(1, std::memory_order_release); }
+
+  /// A token that trips on the next Cancel().
+  CancelToken Token() const;
+
+private:
+  friend class CancelToken;
+  std::atomic<uint64_t> generation_{0};
+};
+
+/// Checked by the conversion at stage boundaries and between row chunks.
+/// Default-constructed tokens are never cancelled. Cheap to copy and to
+/// poll (one atomic load).
+class CancelToken {
+public:
+  CancelToken() = default;
+
+  bool IsCancelled() const {
+    return source_ &&
+           source_->generation_.load(std::memory_order_acquire) != generation_;
+  }
+
+private:
+  friend class CancelSource;
+  CancelToken(const CancelSource *source, uint64_t generation)
+      : source_(source), generation_(generation) {}
+
+  const CancelSource *source_ = nullptr;
+  uint64_t generation_ = 0;
+};
+
+inline CancelToken CancelSource::Token() const {
+  return CancelToken(this, generation_.load(std::memory_order_acquire));
+}
+
+} // namespace jxr
@@ -1,10 +1,26 @@
 #include "Converter.h"
+#include "AsyncIo.h"
+#include "ContentHash.h"
+#include "HalfFloat.h"
+#include "Journal.h"
+#include "JpegEncoder.h"
+#include "JxrHeader.h"
+#include "Preview.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include "Utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <wincodec.h>
@@ -16,76 +32,13 @@
 using Microsoft::WRL::ComPtr;
 namespace fs = std::filesystem;
 
-// ============================================================================
-// IEEE 754 half-float ↔ float conversion helpers
-// ============================================================================
-static inline float HalfToFloat(uint16_t h) {
-  uint32_t sign = (h & 0x8000u) << 16;
-  uint32_t exponent = (h >> 10) & 0x1F;
-  uint32_t mantissa = h & 0x03FF;
+namespace jxr {
 
-  if (exponent == 0) {
-    if (mantissa == 0) {
-      // ±0
-      uint32_t bits = sign;
-      float f;
-      std::memcpy(&f, &bits, 4);
-      return f;
-    }
-    // Subnormal: convert to normalized float
-    while (!(mantissa & 0x0400)) {
-      mantissa <<= 1;
-      exponent--;
-    }
-    exponent++;
-    mantissa &= ~0x0400u;
-    exponent += (127 - 15);
-    uint32_t bits = sign | (exponent << 23) | (mantissa << 13);
-    float f;
-    std::memcpy(&f, &bits, 4);
-    return f;
-  } else if (exponent == 31) {
-    // Inf / NaN
-    uint32_t bits = sign | 0x7F800000u | (mantissa << 13);
-    float f;
-    std::memcpy(&f, &bits, 4);
-    return f;
-  }
-
-  exponent += (127 - 15);
-  uint32_t bits = sign | (exponent << 23) | (mantissa << 13);
-  float f;
-  std::memcpy(&f, &bits, 4);
-  return f;
-}
-
-static inline uint16_t FloatToHalf(float value) {
-  uint32_t bits;
-  std::memcpy(&bits, &value, 4);
-
-  uint32_t sign = (bits >> 16) & 0x8000;
-  int32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
-  uint32_t mantissa = bits & 0x007FFFFFu;
-
-  if (exponent <= 0) {
-    if (exponent < -10)
-      return static_cast<uint16_t>(sign); // Too small, flush to ±0
-    // Subnormal
-    mantissa |= 0x00800000u;
-    uint32_t shift = static_cast<uint32_t>(1 - exponent);
-    mantissa >>= shift;
-    return static_cast<uint16_t>(sign | (mantissa >> 13));
-  } else if (exponent >= 31) {
-    // Overflow → Inf, or NaN passthrough
-    if (exponent == 31 && mantissa != 0)
-      return static_cast<uint16_t>(sign | 0x7C00 | (mantissa >> 13)); // NaN
-    return static_cast<uint16_t>(sign | 0x7C00);                      // ±Inf
-  }
-
-  return static_cast<uint16_t>(sign | (exponent << 10) | (mantissa >> 13));
-}
+static constexpr int kBenchQuality = 95;
 
-namespace jxr {
+// Bump when the encode path changes what a given set of options produces,
+// so outputs cached by older builds stop matching
+static constexpr int32_t kCacheFormatVersion = 1;
 
 // ============================================================================
 // Helper: Check if a WIC pixel format is HDR (high bit depth / float)
@@ -99,46 +52,35 @@ static bool IsHdrPixelFormat(const WICPixelFormatGUID &fmt) {
 }
 
 // ============================================================================
-// Helper: Simple SDR-only JPEG transcode via WIC (no libultrahdr needed)
+// Helper: write a byte buffer to disk
 // ============================================================================
-static bool TranscodeSdrJxrToJpeg(ComPtr<IWICImagingFactory> &factory,
-                                  ComPtr<IWICBitmapFrameDecode> &frame,
-                                  const std::wstring &outputPath, int quality) {
-  // Convert to 24bpp BGR for JPEG
-  ComPtr<IWICFormatConverter> converter;
-  HRESULT hr = factory->CreateFormatConverter(&converter);
-  if (FAILED(hr)) {
-    LogMsg(L"Failed to create format converter: 0x%08X", hr);
-    return false;
-  }
-
-  hr = converter->Initialize(frame.Get(), GUID_WICPixelFormat24bppBGR,
-                             WICBitmapDitherTypeNone, nullptr, 0.0,
-                             WICBitmapPaletteTypeCustom);
-  if (FAILED(hr)) {
-    LogMsg(L"Format conversion failed: 0x%08X", hr);
-    return false;
-  }
-
-  // Create output stream
-  ComPtr<IWICStream> stream;
-  hr = factory->CreateStream(&stream);
-  if (FAILED(hr))
-    return false;
-
-  hr = stream->InitializeFromFilename(outputPath.c_str(), GENERIC_WRITE);
-  if (FAILED(hr)) {
-    LogMsg(L"Failed to create output stream: 0x%08X", hr);
+static bool WriteBytesToFile(const fs::path &path, const uint8_t *data,
+                             size_t size) {
+  std::ofstream outFile(path, std::ios::binary);
+  if (!outFile.is_open()) {
+    LogMsg(L"Failed to write temp output file: %s", path.wstring().c_str());
     return false;
   }
+  outFile.write(reinterpret_cast<const char *>(data),
+                static_cast<std::streamsize>(size));
+  outFile.close();
+  return !outFile.fail();
+}
 
+// ============================================================================
+// Helper: SDR JPEG encode via WIC's built-in JPEG encoder
+// ============================================================================
+static bool EncodeSdrJpegWic(ComPtr<IWICImagingFactory> &factory,
+                             IWICBitmapSource *source, IStream *target,
+                             int quality) {
   // Create JPEG encoder
   ComPtr<IWICBitmapEncoder> encoder;
-  hr = factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder);
+  HRESULT hr =
+      factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder);
   if (FAILED(hr))
     return false;
 
-  hr = encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache);
+  hr = encoder->Initialize(target, WICBitmapEncoderNoCache);
   if (FAILED(hr))
     return false;
 
@@ -162,13 +104,13 @@ static bool TranscodeSdrJxrToJpeg(ComPtr<IWICImagingFactory> &factory,
     return false;
 
   UINT w, h;
-  converter->GetSize(&w, &h);
+  source->GetSize(&w, &h);
   encFrame->SetSize(w, h);
 
   WICPixelFormatGUID outFmt = GUID_WICPixelFormat24bppBGR;
   encFrame->SetPixelFormat(&outFmt);
 
-  hr = encFrame->WriteSource(converter.Get(), nullptr);
+  hr = encFrame->WriteSource(source, nullptr);
   if (FAILED(hr)) {
     LogMsg(L"WriteSource failed: 0x%08X", hr);
     return false;
@@ -186,19 +128,82 @@ static bool TranscodeSdrJxrToJpeg(ComPtr<IWICImagingFactory> &factory,
 }
 
 // ============================================================================
-// Main conversion function
+// Helper: SDR JPEG encode of a WIC source via libjpeg-turbo
+// Pulls BGR24 rows from WIC in MCU-sized strips and hands them straight to
+// libjpeg-turbo, so the full frame is never materialized.
 // ============================================================================
-bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
-  LogMsg(L"Converting: %s", jxrPath.c_str());
+static bool EncodeSdrJpegTurbo(IWICBitmapSource *source, int quality,
+                               bool optimizeHuffman,
+                               std::vector<uint8_t> &out) {
+  UINT width, height;
+  source->GetSize(&width, &height);
 
-  // Build output path: same directory, same name, .jpg extension
-  fs::path inputPath(jxrPath);
-  fs::path tempPath = inputPath;
-  tempPath.replace_extension(L".tmp.jpg");
-  fs::path finalPath = inputPath;
-  finalPath.replace_extension(L".jpg");
+  const UINT stride = width * 3;
+  constexpr UINT kStripRows = 16; // one 4:2:0 MCU row
+  std::vector<uint8_t> strip(static_cast<size_t>(stride) * kStripRows);
+
+  JpegEncoder encoder;
+  if (!encoder.Begin(width, height, JpegInputFormat::BGR24, quality,
+                     optimizeHuffman))
+    return false;
+
+  for (UINT y = 0; y < height; y += kStripRows) {
+    UINT rows = (height - y < kStripRows) ? height - y : kStripRows;
+    WICRect rect = {0, static_cast<INT>(y), static_cast<INT>(width),
+                    static_cast<INT>(rows)};
+    HRESULT hr = source->CopyPixels(&rect, stride,
+                                    static_cast<UINT>(stride * rows),
+                                    strip.data());
+    if (FAILED(hr)) {
+      LogMsg(L"CopyPixels failed: 0x%08X", hr);
+      return false;
+    }
+    if (!encoder.WriteRows(strip.data(), stride, rows))
+      return false;
+  }
+
+  return encoder.Finish(out);
+}
+
+// ============================================================================
+// Helpers: optional downscaled previews built from the decoded rows
+// Written next to the output as "<name>.thumb<size>.jpg".
+// ============================================================================
+static std::vector<PreviewBuilder>
+MakePreviewBuilders(UINT width, UINT height, const ConvertOptions &options) {
+  std::vector<PreviewBuilder> previews;
+  previews.reserve(options.previewSizes.size());
+  for (uint32_t size : options.previewSizes) {
+    if (size > 0)
+      previews.emplace_back(width, height, size);
+  }
+  return previews;
+}
+
+static void WritePreviews(const std::vector<PreviewBuilder> &previews,
+                          const fs::path &finalPath, int quality) {
+  for (const auto &preview : previews) {
+    std::vector<uint8_t> jpeg;
+    if (!preview.Encode(quality, jpeg)) {
+      LogMsg(L"Preview %u px: encode failed", preview.longEdge());
+      continue;
+    }
+    fs::path previewPath = finalPath;
+    previewPath.replace_extension(L".thumb" +
+                                  std::to_wstring(preview.longEdge()) +
+                                  L".jpg");
+    if (WriteBytesToFile(previewPath, jpeg.data(), jpeg.size())) {
+      LogMsg(L"Preview written: %s (%ux%u)", previewPath.wstring().c_str(),
+             preview.width(), preview.height());
+    }
+  }
+}
 
-  // --- WIC Decode ---
+// ============================================================================
+// Helper: WIC JPEG encode of a BGR24 frame held in memory
+// ============================================================================
+static bool EncodeBgrFrameWic(const uint8_t *pixels, UINT width, UINT height,
+                              int quality, std::vector<uint8_t> &out) {
   ComPtr<IWICImagingFactory> factory;
   HRESULT hr = ::CoCreateInstance(CLSID_WICImagingFactory, nullptr,
                                   CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
@@ -207,107 +212,260 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
     return false;
   }
 
-  ComPtr<IWICBitmapDecoder> decoder;
-  hr = factory->CreateDecoderFromFilename(
-      jxrPath.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand,
-      &decoder);
+  const UINT stride = width * 3;
+  ComPtr<IWICBitmap> bitmap;
+  hr = factory->CreateBitmapFromMemory(
+      width, height, GUID_WICPixelFormat24bppBGR, stride, stride * height,
+      const_cast<BYTE *>(pixels), &bitmap);
   if (FAILED(hr)) {
-    LogMsg(L"Failed to decode JXR file: 0x%08X", hr);
+    LogMsg(L"CreateBitmapFromMemory failed: 0x%08X", hr);
     return false;
   }
 
-  ComPtr<IWICBitmapFrameDecode> frame;
-  hr = decoder->GetFrame(0, &frame);
-  if (FAILED(hr)) {
-    LogMsg(L"Failed to get frame: 0x%08X", hr);
+  ComPtr<IStream> memStream;
+  hr = ::CreateStreamOnHGlobal(nullptr, TRUE, &memStream);
+  if (FAILED(hr))
+    return false;
+  if (!EncodeSdrJpegWic(factory, bitmap.Get(), memStream.Get(), quality))
     return false;
+
+  HGLOBAL hg = nullptr;
+  STATSTG stat = {};
+  if (FAILED(::GetHGlobalFromStream(memStream.Get(), &hg)) ||
+      FAILED(memStream->Stat(&stat, STATFLAG_NONAME)))
+    return false;
+  const auto *bytes = static_cast<const uint8_t *>(::GlobalLock(hg));
+  if (!bytes)
+    return false;
+  out.assign(bytes, bytes + stat.cbSize.QuadPart);
+  ::GlobalUnlock(hg);
+  return true;
+}
+
+// ============================================================================
+// Luminance statistics gathered during the scRGB rescale
+// Histogram bins are half-octaves of luminance in nits, starting at 2^-2.
+// ============================================================================
+static constexpr float kSdrWhiteNits = 203.0f; // BT.2408 reference white
+static constexpr float kMinHdrHeadroom = 1.1f; // below this → SDR-only route
+static constexpr float kHighlightPercentile = 0.999f;
+static constexpr float kPeakPercentile = 0.9999f;
+static constexpr float kDefaultTargetPeakNits = 4000.0f;
+static constexpr float kMinTargetPeakNits = kSdrWhiteNits * kMinHdrHeadroom;
+static constexpr float kMaxTargetPeakNits = 10000.0f;
+static constexpr int kHistMinExp = -2;
+static constexpr int kHistBins = 32; // 2^-2 .. 2^14 nits
+
+struct LuminanceStats {
+  uint64_t histogram[kHistBins] = {};
+  uint64_t count = 0;
+  float maxNits = 0.0f;
+
+  static int BinOf(float nits) {
+    uint32_t bits;
+    std::memcpy(&bits, &nits, 4);
+    int exp = static_cast<int>((bits >> 23) & 0xFF) - 127;
+    int half = static_cast<int>((bits >> 22) & 1);
+    int bin = (exp - kHistMinExp) * 2 + half;
+    return bin < 0 ? 0 : (bin >= kHistBins ? kHistBins - 1 : bin);
   }
 
-  // Check pixel format
-  WICPixelFormatGUID pixFmt;
-  frame->GetPixelFormat(&pixFmt);
+  static float BinUpperNits(int bin) {
+    int exp = kHistMinExp + bin / 2;
+    float base = std::ldexp(1.0f, exp);
+    return (bin & 1) ? base * 2.0f : base * 1.5f;
+  }
 
-  // If SDR (8-bit), do a simple transcode without libultrahdr
-  if (!IsHdrPixelFormat(pixFmt)) {
-    LogMsg(L"SDR pixel format detected, performing simple JPEG transcode");
-    bool ok =
-        TranscodeSdrJxrToJpeg(factory, frame, tempPath.wstring(), jpegQuality);
-    // Release all WIC COM objects to unlock the source file
-    frame.Reset();
-    decoder.Reset();
-    factory.Reset();
-    if (ok) {
-      std::error_code ec;
-      fs::remove(inputPath, ec);
-      if (ec) {
-        LogMsg(L"Could not delete original JXR (locked?): %hs — keeping both "
-               L"files",
-               ec.message().c_str());
-      }
-      fs::rename(tempPath, finalPath, ec);
-      if (ec) {
-        LogMsg(L"File replace failed: %hs", ec.message().c_str());
-        return false;
+  void Add(float nits) {
+    ++histogram[BinOf(nits)];
+    ++count;
+    if (nits > maxNits)
+      maxNits = nits;
+  }
+
+  void Merge(const LuminanceStats &other) {
+    for (int i = 0; i < kHistBins; ++i)
+      histogram[i] += other.histogram[i];
+    count += other.count;
+    if (other.maxNits > maxNits)
+      maxNits = other.maxNits;
+  }
+
+  // Upper edge of the bin holding the given percentile, capped at the max.
+  float PercentileNits(float p) const {
+    if (count == 0)
+      return 0.0f;
+    uint64_t target = static_cast<uint64_t>(static_cast<double>(count) * p);
+    uint64_t seen = 0;
+    for (int i = 0; i < kHistBins; ++i) {
+      seen += histogram[i];
+      if (seen > target) {
+        float upper = BinUpperNits(i);
+        return upper < maxNits ? upper : maxNits;
       }
-      LogMsg(L"SDR conversion complete: %s", finalPath.wstring().c_str());
     }
-    return ok;
+    return maxNits;
   }
+};
 
-  // --- HDR path: convert to half-float RGBA ---
-  LogMsg(L"HDR pixel format detected, using Ultra HDR JPEG encoding");
+// ============================================================================
+// scRGB → libultrahdr rescale, fused with luminance measurement
+// scRGB: SDR white = 1.0 (~80 nits, per sRGB/IEC 61966-2-1).
+// libultrahdr's 64bppRGBAHalfFloat expects 1.0 = 203 nits (BT.2408).
+// Scale factor: 80.0 / 203.0 maps scRGB 1.0 → 0.3941 (which the library
+// correctly interprets as 80 nits, since 0.3941 × 203 ≈ 80).
+// ============================================================================
+// Returns false, with the frame partly rescaled, once `cancel` trips
+static bool RescaleAndMeasure(uint16_t *pixels, size_t pixelCount,
+                              const CancelToken &cancel,
+                              LuminanceStats &stats) {
+  constexpr float kScRGBToUhdr = 80.0f / 203.0f;
+  // Row-chunk tasks on the shared pool, each with its own histogram
+  constexpr size_t kChunkPixels = 256 * 1024;
+  std::vector<LuminanceStats> partial((pixelCount + kChunkPixels - 1) /
+                                      kChunkPixels);
 
-  // Convert to 64bpp RGBA Half Float
-  ComPtr<IWICFormatConverter> converter;
-  hr = factory->CreateFormatConverter(&converter);
-  if (FAILED(hr)) {
-    LogMsg(L"Failed to create format converter: 0x%08X", hr);
-    return false;
-  }
+  ThreadPool::Shared().ParallelFor(
+      pixelCount, kChunkPixels, [&](size_t begin, size_t end) {
+        if (cancel.IsCancelled())
+          return;
+        LuminanceStats &local = partial[begin / kChunkPixels];
+        for (size_t p = begin; p < end; ++p) {
+          uint16_t *px = pixels + p * 4;
+          float rgb[3];
+          for (int c = 0; c < 3; ++c) {
+            float val = HalfToFloat(px[c]) * kScRGBToUhdr;
+            // Clamp negatives (out-of-gamut; invalid for Ultra HDR)
+            if (val < 0.0f)
+              val = 0.0f;
+            rgb[c] = val;
+            px[c] = FloatToHalf(val);
+          }
+          // Alpha is passed through untouched (always 1.0 in captures)
+          float luma = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+          local.Add(luma * kSdrWhiteNits);
+        }
+      });
 
-  hr = converter->Initialize(frame.Get(), GUID_WICPixelFormat64bppRGBAHalf,
-                             WICBitmapDitherTypeNone, nullptr, 0.0,
-                             WICBitmapPaletteTypeCustom);
-  if (FAILED(hr)) {
-    LogMsg(L"HDR format conversion failed: 0x%08X", hr);
+  if (cancel.IsCancelled())
     return false;
-  }
+  for (const auto &local : partial)
+    stats.Merge(local);
+  return true;
+}
 
-  UINT width, height;
-  converter->GetSize(&width, &height);
+// ============================================================================
+// Helper: encode an already-rescaled HDR frame as a plain sRGB JPEG
+// Used when the frame has no HDR headroom; 1.0 (203 nits) maps to white.
+// ============================================================================
+static const uint8_t *HalfToSrgb8Lut() {
+  static const std::vector<uint8_t> lut = [] {
+    std::vector<uint8_t> t(65536);
+    for (uint32_t h = 0; h < 65536; ++h) {
+      float v = HalfToFloat(static_cast<uint16_t>(h));
+      if (!(v > 0.0f))
+        v = 0.0f; // negatives and NaN
+      if (v > 1.0f)
+        v = 1.0f;
+      float e = (v <= 0.0031308f) ? v * 12.92f
+                                  : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+      t[h] = static_cast<uint8_t>(e * 255.0f + 0.5f);
+    }
+    return t;
+  }();
+  return lut.data();
+}
 
-  // 64bpp = 8 bytes per pixel (4 channels × 16-bit half float)
-  const UINT bytesPerPixel = 8;
-  const UINT stride = width * bytesPerPixel;
-  const size_t bufferSize = static_cast<size_t>(stride) * height;
+static bool EncodeHdrFrameAsSdr(const uint8_t *hdrPixels, UINT width,
+                                UINT height, int quality, bool optimizeHuffman,
+                                const CancelToken &cancel,
+                                std::vector<uint8_t> &out) {
+  const uint8_t *lut = HalfToSrgb8Lut();
+  // Strips are converted in parallel (16-row tasks), then fed to the
+  // encoder in order
+  constexpr UINT kStripRows = 256;
+  constexpr size_t kTaskRows = 16;
+  const size_t outStride = static_cast<size_t>(width) * 3;
+  std::vector<uint8_t> strip(outStride * kStripRows);
 
-  std::vector<uint8_t> hdrPixels(bufferSize);
-  hr = converter->CopyPixels(nullptr, stride, static_cast<UINT>(bufferSize),
-                             hdrPixels.data());
-  if (FAILED(hr)) {
-    LogMsg(L"CopyPixels failed: 0x%08X", hr);
+  JpegEncoder encoder;
+  if (!encoder.Begin(width, height, JpegInputFormat::BGR24, quality,
+                     optimizeHuffman))
     return false;
-  }
 
-  // --- Rescale scRGB to libultrahdr's expected luminance range ---
-  // scRGB: SDR white = 1.0 (~80 nits, per sRGB/IEC 61966-2-1).
-  // libultrahdr's 64bppRGBAHalfFloat expects 1.0 = 203 nits (BT.2408).
-  // Scale factor: 80.0 / 203.0 maps scRGB 1.0 → 0.3941 (which the library
-  // correctly interprets as 80 nits, since 0.3941 × 203 ≈ 80).
-  {
-    constexpr float kScRGBToUhdr = 80.0f / 203.0f;
-    auto *pixels = reinterpret_cast<uint16_t *>(hdrPixels.data());
-    const size_t totalComponents = static_cast<size_t>(width) * height * 4;
-    for (size_t i = 0; i < totalComponents; ++i) {
-      float val = HalfToFloat(pixels[i]);
-      val *= kScRGBToUhdr;
-      if (val < 0.0f)
-        val = 0.0f; // Clamp negatives (out-of-gamut; invalid for Ultra HDR)
-      pixels[i] = FloatToHalf(val);
-    }
+  const auto *src = reinterpret_cast<const uint16_t *>(hdrPixels);
+  for (UINT y = 0; y < height; y += kStripRows) {
+    if (cancel.IsCancelled())
+      return false;
+    UINT rows = (height - y < kStripRows) ? height - y : kStripRows;
+    ThreadPool::Shared().ParallelFor(
+        rows, kTaskRows, [&](size_t rowBegin, size_t rowEnd) {
+          for (size_t r = rowBegin; r < rowEnd; ++r) {
+            const uint16_t *in = src + (y + r) * static_cast<size_t>(width) * 4;
+            uint8_t *o = strip.data() + r * outStride;
+            for (UINT x = 0; x < width; ++x, in += 4, o += 3) {
+              o[0] = lut[in[2]];
+              o[1] = lut[in[1]];
+              o[2] = lut[in[0]];
+            }
+          }
+        });
+    if (!encoder.WriteRows(strip.data(), outStride, rows))
+      return false;
   }
+  return encoder.Finish(out);
+}
+
+// ============================================================================
+// Helper: SDR rendition of a rescaled HDR frame, as RGBX for the base image
+// Max-RGB extended Reinhard with the target peak mapped to white, modelled
+// on libultrahdr's own global tone map but not checked to match it.
+// ============================================================================
+static bool ToneMapToSdr(const uint8_t *hdrPixels, UINT width, UINT height,
+                         float targetPeakNits, const CancelToken &cancel,
+                         std::vector<uint8_t> &sdr) {
+  const uint8_t *lut = HalfToSrgb8Lut();
+  const float headroom = targetPeakNits / kSdrWhiteNits;
+  const float invHeadroomSq = 1.0f / (headroom * headroom);
+  constexpr size_t kTaskRows = 16;
+  sdr.resize(static_cast<size_t>(width) * height * 4);
 
-  // --- libultrahdr encode (HDR-only mode) ---
+  const auto *src = reinterpret_cast<const uint16_t *>(hdrPixels);
+  ThreadPool::Shared().ParallelFor(
+      height, kTaskRows, [&](size_t rowBegin, size_t rowEnd) {
+        if (cancel.IsCancelled())
+          return;
+        const size_t rowElems = static_cast<size_t>(width) * 4;
+        const uint16_t *in = src + rowBegin * rowElems;
+        uint8_t *o = sdr.data() + rowBegin * rowElems;
+        for (size_t p = 0; p < (rowEnd - rowBegin) * width;
+             ++p, in += 4, o += 4) {
+          const float r = HalfToFloat(in[0]);
+          const float g = HalfToFloat(in[1]);
+          const float b = HalfToFloat(in[2]);
+          // Negatives were clamped by the rescale
+          const float m = std::max(r, std::max(g, b));
+          // Reinhard(m) / m, applied to all three channels to keep the hue
+          const float scale = (1.0f + m * invHeadroomSq) / (1.0f + m);
+          o[0] = lut[FloatToHalf(r * scale)];
+          o[1] = lut[FloatToHalf(g * scale)];
+          o[2] = lut[FloatToHalf(b * scale)];
+          o[3] = 255;
+        }
+      });
+  return !cancel.IsCancelled();
+}
+
+// ============================================================================
+// Helper: libultrahdr encode of a rescaled frame. With only the HDR image
+// libultrahdr tone-maps and encodes the base itself; with `sdrPixels` (RGBX,
+// the tone-mapped frame) and `sdrJpeg` (its encoding) it only computes the
+// gain map against them and wraps `sdrJpeg` as the base.
+// ============================================================================
+static bool EncodeUltraHdr(uint8_t *hdrPixels, UINT width, UINT height,
+                           int jpegQuality, const UltraHdrTuning &tuning,
+                           float targetPeakNits, uint8_t *sdrPixels,
+                           std::vector<uint8_t> *sdrJpeg, EncodedJpeg &out) {
   uhdr_codec_private_t *enc = uhdr_create_encoder();
   if (!enc) {
     LogMsg(L"Failed to create uhdr encoder");
@@ -322,14 +480,13 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
   hdrImg.range = UHDR_CR_FULL_RANGE;
   hdrImg.w = width;
   hdrImg.h = height;
-  hdrImg.planes[0] = hdrPixels.data();
+  hdrImg.planes[0] = hdrPixels;
   hdrImg.stride[0] = width; // stride in pixels, not bytes
   hdrImg.planes[1] = nullptr;
   hdrImg.planes[2] = nullptr;
   hdrImg.stride[1] = 0;
   hdrImg.stride[2] = 0;
 
-  // Register only the HDR image — libultrahdr will tone-map internally
   uhdr_error_info_t err = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
   if (err.error_code != UHDR_CODEC_OK) {
     LogMsg(L"uhdr_enc_set_raw_image failed: %hs", err.detail);
@@ -337,12 +494,46 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
     return false;
   }
 
+  if (sdrPixels && sdrJpeg) {
+    // Tone-mapped SDR intent (for the gain map) and its JPEG (the base)
+    uhdr_raw_image_t sdrImg = {};
+    sdrImg.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+    sdrImg.cg = UHDR_CG_BT_709;
+    sdrImg.ct = UHDR_CT_SRGB;
+    sdrImg.range = UHDR_CR_FULL_RANGE;
+    sdrImg.w = width;
+    sdrImg.h = height;
+    sdrImg.planes[0] = sdrPixels;
+    sdrImg.stride[0] = width;
+    err = uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG);
+    if (err.error_code != UHDR_CODEC_OK) {
+      LogMsg(L"uhdr_enc_set_raw_image (SDR) failed: %hs", err.detail);
+      uhdr_release_encoder(enc);
+      return false;
+    }
+
+    uhdr_compressed_image_t baseImg = {};
+    baseImg.data = sdrJpeg->data();
+    baseImg.data_sz = sdrJpeg->size();
+    baseImg.capacity = sdrJpeg->size();
+    baseImg.cg = UHDR_CG_BT_709;
+    baseImg.ct = UHDR_CT_SRGB;
+    baseImg.range = UHDR_CR_FULL_RANGE;
+    err = uhdr_enc_set_compressed_image(enc, &baseImg, UHDR_SDR_IMG);
+    if (err.error_code != UHDR_CODEC_OK) {
+      LogMsg(L"uhdr_enc_set_compressed_image failed: %hs", err.detail);
+      uhdr_release_encoder(enc);
+      return false;
+    }
+  }
+  // Otherwise only the HDR image: libultrahdr tone-maps internally
+
   // --- Encoder tuning for high-quality HDR output ---
 
   // Target display peak brightness (nits). Default for CT_LINEAR is 10000,
-  // which wastes gain map precision. 4000 nits covers current gaming displays
-  // with generous headroom for highlights.
-  err = uhdr_enc_set_target_display_peak_brightness(enc, 4000.0f);
+  // which wastes gain map precision. The caller derives this from the
+  // measured frame peak so dim frames get a finer gain map.
+  err = uhdr_enc_set_target_display_peak_brightness(enc, targetPeakNits);
   if (err.error_code != UHDR_CODEC_OK) {
     LogMsg(L"uhdr_enc_set_target_display_peak_brightness failed: %hs",
            err.detail);
@@ -350,17 +541,27 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
   }
 
   // Multi-channel gain map preserves per-channel color accuracy in highlights
-  err = uhdr_enc_set_using_multi_channel_gainmap(enc, 1);
+  err = uhdr_enc_set_using_multi_channel_gainmap(
+      enc, tuning.multiChannelGainMap ? 1 : 0);
   if (err.error_code != UHDR_CODEC_OK) {
     LogMsg(L"uhdr_enc_set_using_multi_channel_gainmap failed: %hs", err.detail);
   }
 
   // Best quality preset for encoder tuning
-  err = uhdr_enc_set_preset(enc, UHDR_USAGE_BEST_QUALITY);
+  err = uhdr_enc_set_preset(enc, tuning.bestQualityPreset
+                                     ? UHDR_USAGE_BEST_QUALITY
+                                     : UHDR_USAGE_REALTIME);
   if (err.error_code != UHDR_CODEC_OK) {
     LogMsg(L"uhdr_enc_set_preset failed: %hs", err.detail);
   }
 
+  if (tuning.gainMapScaleFactor > 0) {
+    err = uhdr_enc_set_gainmap_scale_factor(enc, tuning.gainMapScaleFactor);
+    if (err.error_code != UHDR_CODEC_OK) {
+      LogMsg(L"uhdr_enc_set_gainmap_scale_factor failed: %hs", err.detail);
+    }
+  }
+
   // Set quality for SDR base image
   err = uhdr_enc_set_quality(enc, jpegQuality, UHDR_BASE_IMG);
   if (err.error_code != UHDR_CODEC_OK) {
@@ -370,7 +571,7 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
   }
 
   // Set quality for gain map image (95 for better HDR reconstruction)
-  err = uhdr_enc_set_quality(enc, 95, UHDR_GAIN_MAP_IMG);
+  err = uhdr_enc_set_quality(enc, tuning.gainMapQuality, UHDR_GAIN_MAP_IMG);
   if (err.error_code != UHDR_CODEC_OK) {
     LogMsg(L"uhdr_enc_set_quality (gain map) failed: %hs", err.detail);
     uhdr_release_encoder(enc);
@@ -393,54 +594,914 @@ bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
     return false;
   }
 
-  // Write to temp file
+  // The stream lives in the encoder: keep the encoder instead of copying
+  std::shared_ptr<void> owner(enc, [](void *e) {
+    uhdr_release_encoder(static_cast<uhdr_codec_private_t *>(e));
+  });
+  out = EncodedJpeg(std::move(owner),
+                    static_cast<const uint8_t *>(output->data),
+                    output->data_sz);
+  return true;
+}
+
+// Libultrahdr encodes the base image on one thread, which dominates large
+// frames; here it is tone-mapped and encoded in restart-marker slices
+// across the pool and handed over already compressed
+static bool EncodeUltraHdrSlicedBase(uint8_t *hdrPixels, UINT width,
+                                     UINT height, int jpegQuality,
+                                     const UltraHdrTuning &tuning,
+                                     float targetPeakNits,
+                                     const CancelToken &cancel,
+                                     EncodedJpeg &out) {
+  std::vector<uint8_t> sdr;
   {
-    std::ofstream outFile(tempPath, std::ios::binary);
-    if (!outFile.is_open()) {
-      LogMsg(L"Failed to write temp output file: %s",
-             tempPath.wstring().c_str());
-      uhdr_release_encoder(enc);
+    TraceSpan span("tone map");
+    if (!ToneMapToSdr(hdrPixels, width, height, targetPeakNits, cancel, sdr))
       return false;
-    }
-    outFile.write(reinterpret_cast<const char *>(output->data),
-                  output->data_sz);
-    outFile.close();
-  }
-
-  uhdr_release_encoder(enc);
-
-  // Release all WIC COM objects to unlock the source file
-  converter.Reset();
-  frame.Reset();
-  decoder.Reset();
-  factory.Reset();
-
-  // --- Atomic replace ---
-  std::error_code ec;
-  fs::remove(inputPath, ec);
-  if (ec) {
-    LogMsg(L"Could not delete original JXR (locked?): %hs — keeping both files",
-           ec.message().c_str());
-    // Still rename the temp to final so the conversion output is usable
-    fs::rename(tempPath, finalPath, ec);
-    if (ec) {
-      LogMsg(L"Failed to rename temp file to final: %hs", ec.message().c_str());
+  }
+  std::vector<uint8_t> base;
+  {
+    TraceSpan span("base encode");
+    if (!EncodeJpegSliced(sdr.data(), width, height,
+                          static_cast<size_t>(width) * 4,
+                          JpegInputFormat::RGBX32, jpegQuality, base, cancel))
+      return false;
+  }
+  return EncodeUltraHdr(hdrPixels, width, height, jpegQuality, tuning,
+                        targetPeakNits, sdr.data(), &base, out);
+}
+
+// ============================================================================
+// WIC decode chain over bytes in memory: stream → decoder → frame 0 →
+// format converter
+// ============================================================================
+struct WicFrame {
+  ComPtr<IWICStream> stream;
+  ComPtr<IWICBitmapDecoder> decoder;
+  ComPtr<IWICBitmapFrameDecode> frame;
+  ComPtr<IWICFormatConverter> converter; // set by ConvertWicFrame
+};
+
+static bool OpenWicFrame(IWICImagingFactory *factory, const uint8_t *data,
+                         size_t size, WicFrame &wic) {
+  HRESULT hr = factory->CreateStream(&wic.stream);
+  if (SUCCEEDED(hr)) {
+    hr = wic.stream->InitializeFromMemory(const_cast<BYTE *>(data),
+                                          static_cast<DWORD>(size));
+  }
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to create input stream: 0x%08X", hr);
+    return false;
+  }
+
+  hr = factory->CreateDecoderFromStream(wic.stream.Get(), nullptr,
+                                        WICDecodeMetadataCacheOnDemand,
+                                        &wic.decoder);
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to decode JXR file: 0x%08X", hr);
+    return false;
+  }
+
+  hr = wic.decoder->GetFrame(0, &wic.frame);
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to get frame: 0x%08X", hr);
+    return false;
+  }
+  return true;
+}
+
+static bool ConvertWicFrame(IWICImagingFactory *factory,
+                            const WICPixelFormatGUID &target, WicFrame &wic) {
+  HRESULT hr = factory->CreateFormatConverter(&wic.converter);
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to create format converter: 0x%08X", hr);
+    return false;
+  }
+
+  hr = wic.converter->Initialize(wic.frame.Get(), target,
+                                 WICBitmapDitherTypeNone, nullptr, 0.0,
+                                 WICBitmapPaletteTypeCustom);
+  if (FAILED(hr)) {
+    LogMsg(L"Format conversion failed: 0x%08X", hr);
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Helper: copy the converted frame into `pixels` (stride × height bytes)
+// The JXR decoder runs on one thread inside CopyPixels. With `stripes` > 1
+// the frame is cut into horizontal stripes of whole 16-row macroblock rows,
+// each decoded by its own decoder over the same bytes via
+// CopyPixels(WICRect) and written straight to its rows of `pixels`. Stripe
+// 0 uses `wic` on the calling thread, whose apartment created it; the rest
+// run on the pool. 0 = one stripe per pool thread plus the caller.
+// ============================================================================
+static constexpr UINT kDecodeStripeAlign = 16; // JXR macroblock rows
+static constexpr UINT kMinDecodeStripeRows = 256;
+
+// One helper stripe, with COM, the factory and the decoder all owned by the
+// thread that runs it: STA objects must not cross apartments
+static HRESULT DecodeStripe(const uint8_t *data, size_t size,
+                            const WICPixelFormatGUID &target,
+                            const WICRect &rect, UINT stride, uint8_t *dst) {
+  ComInit com;
+  if (!com)
+    return com.hr;
+  ComPtr<IWICImagingFactory> factory;
+  HRESULT hr = ::CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                                  CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+  if (FAILED(hr))
+    return hr;
+  WicFrame own;
+  if (!OpenWicFrame(factory.Get(), data, size, own) ||
+      !ConvertWicFrame(factory.Get(), target, own))
+    return E_FAIL;
+  return own.converter->CopyPixels(&rect, stride, stride * rect.Height, dst);
+}
+
+static bool CopyFramePixels(const uint8_t *data, size_t size,
+                            const WICPixelFormatGUID &target, WicFrame &wic,
+                            UINT stride, int stripes, uint8_t *pixels) {
+  UINT width, height;
+  wic.converter->GetSize(&width, &height);
+  if (stripes <= 0)
+    stripes = static_cast<int>(ThreadPool::Shared().size()) + 1;
+  UINT rows = (height + stripes - 1) / stripes;
+  rows = std::max(rows, kMinDecodeStripeRows);
+  rows = (rows + kDecodeStripeAlign - 1) / kDecodeStripeAlign *
+         kDecodeStripeAlign;
+  const size_t count = (height + rows - 1) / rows;
+
+  if (count <= 1) {
+    HRESULT hr =
+        wic.converter->CopyPixels(nullptr, stride, stride * height, pixels);
+    if (FAILED(hr)) {
+      LogMsg(L"CopyPixels failed: 0x%08X", hr);
       return false;
     }
-    LogMsg(L"HDR conversion complete (original kept): %s (%.1f KB)",
-           finalPath.wstring().c_str(),
-           static_cast<double>(fs::file_size(finalPath)) / 1024.0);
     return true;
   }
 
-  fs::rename(tempPath, finalPath, ec);
-  if (ec) {
-    LogMsg(L"Failed to rename temp file to final: %hs", ec.message().c_str());
+  auto stripeRect = [&](size_t i) {
+    const UINT y = static_cast<UINT>(i) * rows;
+    return WICRect{0, static_cast<INT>(y), static_cast<INT>(width),
+                   static_cast<INT>(std::min(rows, height - y))};
+  };
+  std::atomic<HRESULT> firstError{S_OK};
+  auto record = [&](HRESULT hr) {
+    HRESULT expected = S_OK;
+    if (FAILED(hr))
+      firstError.compare_exchange_strong(expected, hr);
+  };
+
+  // Stripes 1..n on the pool, while this thread decodes stripe 0
+  TaskGroup helpers(ThreadPool::Shared());
+  helpers.Run([&] {
+    ThreadPool::Shared().ParallelFor(
+        count - 1, 1, [&](size_t begin, size_t end) {
+          for (size_t i = begin + 1; i < end + 1; ++i) {
+            TraceSpan span("decode stripe", "stripe", static_cast<int64_t>(i));
+            const WICRect rect = stripeRect(i);
+            record(DecodeStripe(data, size, target, rect, stride,
+                                pixels + static_cast<size_t>(rect.Y) * stride));
+          }
+        });
+  });
+  {
+    TraceSpan span("decode stripe", "stripe", 0);
+    const WICRect rect = stripeRect(0);
+    record(wic.converter->CopyPixels(&rect, stride, stride * rect.Height,
+                                     pixels));
+  }
+  helpers.Wait();
+
+  if (FAILED(firstError.load())) {
+    LogMsg(L"CopyPixels failed on a %zu-stripe decode: 0x%08X", count,
+           firstError.load());
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Automatic stripe count (ConvertOptions::decodeStripes < 0)
+// Whether stripes pay off depends on how the capture was tiled, which WIC
+// does not report, so it is measured on the captures themselves. Decode time
+// per megapixel is averaged for one stripe and for one stripe per core; the
+// first frames tall enough to split alternate between the two, after that
+// the faster one is used and the other retried every kStripeReprobeFrames
+// frames, in case a different game's captures are tiled differently.
+// ============================================================================
+static constexpr int kStripeProbeSamples = 2;
+static constexpr uint64_t kStripeReprobeFrames = 16;
+
+class DecodeStripeTuner {
+public:
+  // Stripe count for the next eligible frame: 1, or 0 for one per core
+  int Choose() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++frames_;
+    if (samples_[0] < kStripeProbeSamples || samples_[1] < kStripeProbeSamples)
+      return samples_[0] <= samples_[1] ? 1 : 0;
+    const bool stripesFaster = msPerMp_[1] < msPerMp_[0];
+    const bool reprobe = frames_ % kStripeReprobeFrames == 0;
+    return stripesFaster != reprobe ? 0 : 1;
+  }
+
+  void Record(int stripes, double ms, double megapixels) {
+    if (megapixels <= 0.0)
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t side = stripes == 1 ? 0 : 1;
+    const double sample = ms / megapixels;
+    // Plain mean while probing, then a moving average
+    msPerMp_[side] = samples_[side] < kStripeProbeSamples
+                         ? (msPerMp_[side] * samples_[side] + sample) /
+                               (samples_[side] + 1)
+                         : 0.75 * msPerMp_[side] + 0.25 * sample;
+    if (samples_[side] < kStripeProbeSamples)
+      ++samples_[side];
+  }
+
+private:
+  std::mutex mutex_;
+  uint64_t frames_ = 0;
+  int samples_[2] = {}; // [one stripe, one per core]
+  double msPerMp_[2] = {};
+};
+
+static DecodeStripeTuner &StripeTuner() {
+  static DecodeStripeTuner tuner;
+  return tuner;
+}
+
+// ============================================================================
+// Result cache: the options that shape the output bytes, and the lookup
+// ============================================================================
+static uint64_t CacheProfileKey(const ConvertOptions &o) {
+  const int32_t fields[] = {
+      kCacheFormatVersion,
+      o.jpegQuality,
+      static_cast<int32_t>(o.sdrEncoder),
+      o.optimizeHuffman,
+      o.adaptiveRouting,
+      o.slicedBaseEncode,
+      o.uhdr.gainMapQuality,
+      o.uhdr.multiChannelGainMap,
+      o.uhdr.bestQualityPreset,
+      static_cast<int32_t>(o.uhdr.targetPeakNits),
+      o.uhdr.gainMapScaleFactor};
+  return HashBytes(fields, sizeof(fields));
+}
+
+// Hashes the source before anything decodes it. On a hit the earlier output
+// the entry names is read back as the job's output, and the source is
+// released for the commit. Entries are stored once a commit has landed.
+static void LookupCachedResult(ConversionJob &job) {
+  ResultCache *cache = job.options.cache;
+  if (!cache)
+    return;
+  {
+    TraceSpan span("hash", "bytes", static_cast<int64_t>(job.input.size()));
+    job.contentHash = HashBytes(job.input.data(), job.input.size());
+    job.sourceBytes = job.input.size();
+  }
+  // Previews are built from the decoded frame, which a hit never has
+  if (!job.options.previewSizes.empty())
+    return;
+
+  std::vector<uint8_t> bytes;
+  if (!cache->Lookup(job.contentHash, job.sourceBytes,
+                     CacheProfileKey(job.options), bytes))
+    return;
+  LogMsg(L"Cache hit (%016llx): %s",
+         static_cast<unsigned long long>(job.contentHash),
+         job.jxrPath.c_str());
+  job.encoded = EncodedJpeg(std::move(bytes));
+  job.cacheHit = true;
+  job.input.Release();
+  job.staged.Reset();
+}
+
+// ============================================================================
+// Journal scope: brackets one conversion in the write-ahead journal.
+// If the conversion bails out before committing, the partial temp file is
+// removed so nothing is left for crash recovery to find.
+// ============================================================================
+class JournalScope {
+public:
+  JournalScope(ConversionJournal *journal, const fs::path &inputPath,
+               const fs::path &tempPath)
+      : journal_(journal), inputPath_(inputPath), tempPath_(tempPath) {
+    Mark(ConversionJournal::State::Begin);
+  }
+
+  ~JournalScope() { Finish(); }
+
+  JournalScope(const JournalScope &) = delete;
+  JournalScope &operator=(const JournalScope &) = delete;
+
+  void Mark(ConversionJournal::State state) {
+    if (journal_)
+      journal_->Record(state, inputPath_.wstring());
+  }
+
+  void Commit() { committed_ = true; }
+
+  // Cleans up after a failed commit and closes the entry; runs once
+  void Finish() {
+    if (finished_)
+      return;
+    finished_ = true;
+    if (!committed_) {
+      std::error_code ec;
+      if (fs::exists(inputPath_, ec))
+        fs::remove(tempPath_, ec);
+    }
+    Mark(ConversionJournal::State::Done);
+  }
+
+private:
+  ConversionJournal *journal_;
+  fs::path inputPath_;
+  fs::path tempPath_;
+  bool committed_ = false;
+  bool finished_ = false;
+};
+
+// ============================================================================
+// Helper: the write → flush → rename → delete chain for a finished job
+// Each step is journaled as it lands; `done` runs after the final log line
+// and preview output. `job` must stay alive until then.
+// ============================================================================
+static CommitChain MakeCommitChain(ConversionJob &job,
+                                   std::function<void(bool)> done) {
+  // Build output path: same directory, same name, .jpg extension
+  fs::path inputPath(job.jxrPath);
+  fs::path tempPath = inputPath;
+  tempPath.replace_extension(L".tmp.jpg");
+  fs::path finalPath = inputPath;
+  finalPath.replace_extension(L".jpg");
+
+  auto journal = std::make_shared<JournalScope>(job.options.journal, inputPath,
+                                                tempPath);
+
+  CommitChain chain;
+  chain.sourcePath = inputPath.wstring();
+  chain.tempPath = tempPath.wstring();
+  chain.finalPath = finalPath.wstring();
+  const size_t bytes = job.encoded.size();
+  chain.data = std::move(job.encoded); // handed over, not copied
+
+  chain.onStep = [journal](CommitStep step) {
+    switch (step) {
+    case CommitStep::TempWritten:
+      journal->Mark(ConversionJournal::State::TempWritten);
+      break;
+    case CommitStep::Renamed:
+      journal->Commit();
+      journal->Mark(ConversionJournal::State::Renamed);
+      break;
+    case CommitStep::SourceRemoved:
+      journal->Mark(ConversionJournal::State::OriginalRemoved);
+      break;
+    }
+  };
+
+  ConversionJob *jobPtr = &job;
+  chain.onDone = [journal, jobPtr, bytes, finalPath,
+                  done = std::move(done)](bool ok, bool sourceKept) {
+    journal->Finish();
+    if (ok) {
+      const ConversionJob &j = *jobPtr;
+      const wchar_t *kind = j.cacheHit                     ? L"Cached"
+                            : (j.hdrSource && !j.sdrOnly) ? L"HDR"
+                                                          : L"SDR";
+      LogMsg(L"%s conversion complete%s: %s (%.1f KB)", kind,
+             sourceKept ? L" (original kept)" : L"",
+             finalPath.wstring().c_str(), static_cast<double>(bytes) / 1024.0);
+      WritePreviews(j.previews, finalPath, j.options.previewQuality);
+      // Later byte-identical sources are written out from this file
+      if (!j.cacheHit && j.options.cache && j.contentHash != 0) {
+        TraceSpan span("cache store");
+        j.options.cache->Store(j.contentHash, j.sourceBytes,
+                               CacheProfileKey(j.options),
+                               finalPath.wstring());
+      }
+    }
+    done(ok);
+  };
+  return chain;
+}
+
+// ============================================================================
+// Preemption point: true once the job's token has tripped. The job is
+// marked (and logged once) so its runner requeues it rather than reporting
+// a failure.
+// ============================================================================
+static bool Preempted(ConversionJob &job, const wchar_t *stage) {
+  if (!job.cancel.IsCancelled())
+    return false;
+  if (!job.cancelled) {
+    job.cancelled = true;
+    LogMsg(L"Preempted during %s: %s", stage, job.jxrPath.c_str());
+    TraceInstant("preempted");
+  }
+  return true;
+}
+
+// ============================================================================
+// Stage 1: Read — map or read the source into memory
+// ============================================================================
+bool ReadStage(ConversionJob &job, BufferPool *pool) {
+  if (Preempted(job, L"read"))
+    return false;
+  job.memory.SampleWorkingSet(); // baseline
+  if (!job.input.valid()) {
+    // Sources on shares are read from a local copy when scratch has room
+    ScratchSpace *scratch = job.options.scratch;
+    const bool staged = scratch && IsRemotePath(job.jxrPath) &&
+                        scratch->StageIn(job.jxrPath, job.staged);
+    job.input = InputFile::Open(staged ? job.staged.path() : job.jxrPath, pool);
+    job.input.Prefault();
+  }
+  if (!job.input.valid())
+    return false;
+
+  // Reject what WIC would only fail on after allocating the frame
+  JxrHeaderInfo header;
+  switch (ProbeJxrHeader(job.input.data(), job.input.size(),
+                         job.input.size(), header)) {
+  case JxrProbe::Invalid:
+    LogMsg(L"Not a JPEG XR file: %s", job.jxrPath.c_str());
+    return false;
+  case JxrProbe::Truncated:
+    LogMsg(L"Incomplete JPEG XR file (%zu of %llu bytes): %s",
+           job.input.size(), static_cast<unsigned long long>(header.endOffset),
+           job.jxrPath.c_str());
+    return false;
+  default: {
+    // Sizes the job before decode; Decode confirms them
+    WICPixelFormatGUID pixFmt;
+    std::memcpy(&pixFmt, header.pixelFormat, sizeof(pixFmt));
+    job.width = header.width;
+    job.height = header.height;
+    job.hdrSource = IsHdrPixelFormat(pixFmt);
+    break;
+  }
+  }
+  LookupCachedResult(job);
+  return true;
+}
+
+// ============================================================================
+// Stage 2: Decode — WIC decode from memory into a packed pixel buffer
+// HDR sources become 64bpp RGBA half-float, SDR sources 24bpp BGR.
+// ============================================================================
+bool DecodeStage(ConversionJob &job) {
+  if (job.cacheHit)
+    return true;
+  if (Preempted(job, L"decode"))
+    return false;
+  LogMsg(L"Converting: %s", job.jxrPath.c_str());
+
+  ComPtr<IWICImagingFactory> factory;
+  HRESULT hr = ::CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                                  CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to create WIC factory: 0x%08X", hr);
+    return false;
+  }
+
+  WicFrame wic;
+  if (!OpenWicFrame(factory.Get(), job.input.data(), job.input.size(), wic))
+    return false;
+
+  // Check pixel format
+  WICPixelFormatGUID pixFmt;
+  wic.frame->GetPixelFormat(&pixFmt);
+  job.hdrSource = IsHdrPixelFormat(pixFmt);
+  if (job.hdrSource) {
+    LogMsg(L"HDR pixel format detected, measuring luminance for routing");
+  } else {
+    LogMsg(L"SDR pixel format detected, performing simple JPEG transcode");
+  }
+
+  // HDR: 64bpp RGBA half float (4 channels × 16-bit). SDR: 24bpp BGR.
+  const WICPixelFormatGUID &target =
+      job.hdrSource ? GUID_WICPixelFormat64bppRGBAHalf
+                    : GUID_WICPixelFormat24bppBGR;
+  const UINT bytesPerPixel = job.hdrSource ? 8 : 3;
+  if (!ConvertWicFrame(factory.Get(), target, wic))
+    return false;
+
+  UINT width, height;
+  wic.converter->GetSize(&width, &height);
+  job.width = width;
+  job.height = height;
+
+  const UINT stride = width * bytesPerPixel;
+  job.pixels.resize(static_cast<size_t>(stride) * height);
+  int stripes = job.options.decodeStripes;
+  const bool tune = stripes < 0 && ThreadPool::Shared().size() > 0 &&
+                    height >= 2 * kMinDecodeStripeRows;
+  if (stripes < 0)
+    stripes = tune ? StripeTuner().Choose() : 1;
+  const auto decodeStart = std::chrono::steady_clock::now();
+  if (!CopyFramePixels(job.input.data(), job.input.size(), target, wic,
+                       stride, stripes, job.pixels.data()))
+    return false;
+  if (tune) {
+    StripeTuner().Record(
+        stripes,
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - decodeStart)
+            .count(),
+        static_cast<double>(width) * height / 1e6);
+  }
+
+  // WIC's buffers, the source and the pixels are all alive here
+  job.memory.SampleWorkingSet();
+
+  // The pixels are ours now; drop WIC and the mapping to unlock the source
+  wic = WicFrame();
+  job.input.Release();
+  job.staged.Reset();
+  return true;
+}
+
+// ============================================================================
+// Stage 3: Rescale — scRGB rescale + luminance stats, routing, previews
+// ============================================================================
+bool RescaleStage(ConversionJob &job) {
+  if (job.cacheHit)
+    return true;
+  if (Preempted(job, L"rescale"))
+    return false;
+  job.previews = MakePreviewBuilders(job.width, job.height, job.options);
+
+  if (!job.hdrSource) {
+    const size_t stride = static_cast<size_t>(job.width) * 3;
+    for (auto &preview : job.previews)
+      preview.AddRowsBgr8(job.pixels.data(), stride, job.height);
+    job.sdrOnly = true;
+    return true;
+  }
+
+  // --- Rescale scRGB and measure luminance in a single pass ---
+  LuminanceStats stats;
+  if (!RescaleAndMeasure(reinterpret_cast<uint16_t *>(job.pixels.data()),
+                         static_cast<size_t>(job.width) * job.height,
+                         job.cancel, stats)) {
+    Preempted(job, L"rescale");
     return false;
   }
 
-  LogMsg(L"HDR conversion complete: %s (%.1f KB)", finalPath.wstring().c_str(),
-         static_cast<double>(fs::file_size(finalPath)) / 1024.0);
+  // --- Optional previews from the rescaled frame (one pass for all sizes) ---
+  if (!job.previews.empty()) {
+    const auto *rows = reinterpret_cast<const uint16_t *>(job.pixels.data());
+    const size_t rowElems = static_cast<size_t>(job.width) * 4;
+    for (UINT y = 0; y < job.height; ++y) {
+      for (auto &preview : job.previews)
+        preview.AddRowsRgbaHalf(rows + y * rowElems, rowElems, 1);
+    }
+  }
+
+  // --- Content-adaptive routing ---
+  const float highlightNits = stats.PercentileNits(kHighlightPercentile);
+  const float peakNits = stats.PercentileNits(kPeakPercentile);
+  const float headroom = highlightNits / kSdrWhiteNits;
+  job.sdrOnly = job.options.adaptiveRouting && headroom < kMinHdrHeadroom;
+
+  if (job.sdrOnly) {
+    LogMsg(L"Routing: SDR-only (max %.0f nits, p99.9 %.0f nits, headroom "
+           L"%.2fx)",
+           stats.maxNits, highlightNits, headroom);
+  } else {
+    job.targetPeakNits = kDefaultTargetPeakNits;
+    if (job.options.uhdr.targetPeakNits > 0.0f) {
+      job.targetPeakNits = job.options.uhdr.targetPeakNits;
+    } else if (job.options.adaptiveRouting) {
+      job.targetPeakNits =
+          std::min(std::max(peakNits, kMinTargetPeakNits), kMaxTargetPeakNits);
+    }
+    LogMsg(L"Routing: Ultra HDR (max %.0f nits, p99.9 %.0f nits, headroom "
+           L"%.2fx, target peak %.0f nits)",
+           stats.maxNits, highlightNits, headroom, job.targetPeakNits);
+  }
+  return true;
+}
+
+// ============================================================================
+// Stage 4: Encode — Ultra HDR, SDR-only from HDR, or plain SDR transcode
+// ============================================================================
+bool EncodeStage(ConversionJob &job) {
+  if (job.cacheHit)
+    return true;
+  if (Preempted(job, L"encode"))
+    return false;
+  const ConvertOptions &o = job.options;
+  bool ok;
+  if (job.hdrSource && !job.sdrOnly) {
+    ok = o.slicedBaseEncode &&
+         EncodeUltraHdrSlicedBase(job.pixels.data(), job.width, job.height,
+                                  o.jpegQuality, o.uhdr, job.targetPeakNits,
+                                  job.cancel, job.encoded);
+    if (!ok && !job.cancel.IsCancelled()) {
+      if (o.slicedBaseEncode)
+        LogMsg(L"Sliced base encode failed, letting libultrahdr encode it");
+      ok = EncodeUltraHdr(job.pixels.data(), job.width, job.height,
+                          o.jpegQuality, o.uhdr, job.targetPeakNits, nullptr,
+                          nullptr, job.encoded);
+    }
+  } else {
+    std::vector<uint8_t> bytes;
+    if (job.sdrOnly && job.hdrSource) {
+      ok = EncodeHdrFrameAsSdr(job.pixels.data(), job.width, job.height,
+                               o.jpegQuality, o.optimizeHuffman, job.cancel,
+                               bytes);
+    } else if (o.sdrEncoder == SdrEncoder::LibjpegTurbo) {
+      ok = EncodeJpeg(job.pixels.data(), job.width, job.height,
+                      static_cast<size_t>(job.width) * 3,
+                      JpegInputFormat::BGR24, o.jpegQuality,
+                      o.optimizeHuffman, bytes, job.cancel);
+    } else {
+      ok = EncodeBgrFrameWic(job.pixels.data(), job.width, job.height,
+                             o.jpegQuality, bytes);
+    }
+    job.encoded = EncodedJpeg(std::move(bytes));
+  }
+
+  job.memory.SampleWorkingSet(); // frame + encoder output (+ gain map)
+
+  // The frame is no longer needed once encoded
+  job.pixels = {};
+  if (!ok)
+    Preempted(job, L"encode"); // the strip loops stop on cancellation
+  return ok;
+}
+
+// ============================================================================
+// Stage 5: Commit — write temp file, flush, rename over the .jpg, delete
+// the original
+// ============================================================================
+bool CommitStage(ConversionJob &job) {
+  bool result = false;
+  AsyncIo::CommitSync(
+      MakeCommitChain(job, [&result](bool ok) { result = ok; }));
+  return result;
+}
+
+void CommitStageAsync(const std::shared_ptr<ConversionJob> &job, AsyncIo &io,
+                      std::function<void(bool)> done) {
+  // The chain's callbacks hold the job until the disk work is over
+  io.Commit(MakeCommitChain(
+      *job, [job, done = std::move(done)](bool ok) { done(ok); }));
+}
+
+// ============================================================================
+// Memory report: one line per conversion, for a per-megapixel memory model
+// ============================================================================
+void LogConversionMemory(const ConversionJob &job) {
+  if (job.cacheHit)
+    return; // nothing was decoded
+  const MemoryCounters &m = job.memory;
+  const double mpix = static_cast<double>(job.width) * job.height / 1e6;
+  const double mb = 1024.0 * 1024.0;
+  const double wsMb = m.WorkingSetGrowth() / mb;
+  const double heapPeakMb = m.peakLiveBytes / mb;
+  LogMsg(L"Memory: %ux%u (%.1f MP) %s: working set +%.1f MB, heap peak "
+         L"%.1f MB, %.1f MB in %llu allocations (%.1f / %.1f MB per MP)",
+         job.width, job.height, mpix,
+         job.hdrSource ? L"64bppRGBAHalf" : L"24bppBGR", wsMb, heapPeakMb,
+         m.bytesAllocated / mb, static_cast<unsigned long long>(m.allocations),
+         mpix > 0 ? wsMb / mpix : 0.0, mpix > 0 ? heapPeakMb / mpix : 0.0);
+}
+
+// ============================================================================
+// Main conversion function: all stages back to back on the calling thread
+// ============================================================================
+bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath, int jpegQuality) {
+  ConvertOptions options;
+  options.jpegQuality = jpegQuality;
+  return ConvertJxrToUltraHdrJpeg(jxrPath, options);
+}
+
+bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath,
+                              const ConvertOptions &options) {
+  return ConvertJxrToUltraHdrJpeg(jxrPath, options, InputFile());
+}
+
+bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath,
+                              const ConvertOptions &options, InputFile input) {
+  ConversionJob job;
+  job.jxrPath = jxrPath;
+  job.options = options;
+  if (options.cancel)
+    job.cancel = options.cancel->Token();
+  job.input = std::move(input);
+  TraceSpan span("convert");
+  MemoryScope scope(&job.memory);
+  bool ok = ReadStage(job) && DecodeStage(job) && RescaleStage(job) &&
+            EncodeStage(job) && CommitStage(job);
+  if (ok)
+    LogConversionMemory(job);
+  return ok;
+}
+
+// ============================================================================
+// In-memory conversion: the same decode/rescale/encode stages, no files
+// ============================================================================
+bool ConvertJxrBuffer(const std::byte *data, size_t size,
+                      const ConvertOptions &options, EncodedJpeg &out) {
+  if (!data || size == 0 || size > MAXDWORD) {
+    LogMsg(L"ConvertJxrBuffer: invalid input (%zu bytes)", size);
+    return false;
+  }
+  ConversionJob job;
+  job.jxrPath = L"(memory)";
+  job.options = options;
+  job.options.previewSizes.clear(); // previews are written next to a file
+  job.options.journal = nullptr;
+  if (options.cancel)
+    job.cancel = options.cancel->Token();
+  job.input = InputFile::Borrow(reinterpret_cast<const uint8_t *>(data), size);
+  MemoryScope scope(&job.memory);
+  job.memory.SampleWorkingSet(); // baseline
+  if (!DecodeStage(job) || !RescaleStage(job) || !EncodeStage(job))
+    return false;
+  LogConversionMemory(job);
+  out = std::move(job.encoded);
+  return true;
+}
+
+// ============================================================================
+// SDR encoder benchmark: WIC vs libjpeg-turbo on the same decoded frame
+// ============================================================================
+bool RunSdrEncoderBenchmark(const std::wstring &jxrPath, int iterations,
+                            SdrEncoderBenchmarkResult &result) {
+  using Clock = std::chrono::steady_clock;
+  if (iterations < 1)
+    iterations = 1;
+
+  ComPtr<IWICImagingFactory> factory;
+  HRESULT hr = ::CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                                  CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to create WIC factory: 0x%08X", hr);
+    return false;
+  }
+
+  ComPtr<IWICBitmapDecoder> decoder;
+  hr = factory->CreateDecoderFromFilename(
+      jxrPath.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand,
+      &decoder);
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to decode JXR file: 0x%08X", hr);
+    return false;
+  }
+
+  ComPtr<IWICBitmapFrameDecode> frame;
+  hr = decoder->GetFrame(0, &frame);
+  if (FAILED(hr))
+    return false;
+
+  ComPtr<IWICFormatConverter> converter;
+  hr = factory->CreateFormatConverter(&converter);
+  if (FAILED(hr))
+    return false;
+  hr = converter->Initialize(frame.Get(), GUID_WICPixelFormat24bppBGR,
+                             WICBitmapDitherTypeNone, nullptr, 0.0,
+                             WICBitmapPaletteTypeCustom);
+  if (FAILED(hr))
+    return false;
+
+  // Decode once into memory so only the encoders are timed
+  ComPtr<IWICBitmap> bitmap;
+  hr = factory->CreateBitmapFromSource(converter.Get(), WICBitmapCacheOnLoad,
+                                       &bitmap);
+  if (FAILED(hr)) {
+    LogMsg(L"CreateBitmapFromSource failed: 0x%08X", hr);
+    return false;
+  }
+
+  UINT width, height;
+  bitmap->GetSize(&width, &height);
+  result = {};
+  result.width = width;
+  result.height = height;
+  result.iterations = iterations;
+
+  auto elapsedMs = [](Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+  };
+
+  for (int i = 0; i < iterations; ++i) {
+    // WIC encoder into an in-memory stream
+    ComPtr<IStream> memStream;
+    hr = ::CreateStreamOnHGlobal(nullptr, TRUE, &memStream);
+    if (FAILED(hr))
+      return false;
+    auto t0 = Clock::now();
+    if (!EncodeSdrJpegWic(factory, bitmap.Get(), memStream.Get(),
+                          kBenchQuality))
+      return false;
+    result.wicMs += elapsedMs(t0);
+    STATSTG stat = {};
+    memStream->Stat(&stat, STATFLAG_NONAME);
+    result.wicBytes = static_cast<size_t>(stat.cbSize.QuadPart);
+
+    // libjpeg-turbo, default Huffman tables
+    std::vector<uint8_t> jpeg;
+    t0 = Clock::now();
+    if (!EncodeSdrJpegTurbo(bitmap.Get(), kBenchQuality, false, jpeg))
+      return false;
+    result.turboMs += elapsedMs(t0);
+    result.turboBytes = jpeg.size();
+
+    // libjpeg-turbo, optimized Huffman tables
+    t0 = Clock::now();
+    if (!EncodeSdrJpegTurbo(bitmap.Get(), kBenchQuality, true, jpeg))
+      return false;
+    result.turboOptimizedMs += elapsedMs(t0);
+    result.turboOptimizedBytes = jpeg.size();
+  }
+
+  result.wicMs /= iterations;
+  result.turboMs /= iterations;
+  result.turboOptimizedMs /= iterations;
+  return true;
+}
+
+// ============================================================================
+// Decode scaling benchmark: the same frame decoded in 1, 2, 4, ... stripes
+// ============================================================================
+bool RunDecodeBenchmark(const std::wstring &jxrPath, int iterations,
+                        DecodeBenchmarkResult &result) {
+  using Clock = std::chrono::steady_clock;
+  if (iterations < 1)
+    iterations = 1;
+
+  ComPtr<IWICImagingFactory> factory;
+  HRESULT hr = ::CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                                  CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+  if (FAILED(hr)) {
+    LogMsg(L"Failed to create WIC factory: 0x%08X", hr);
+    return false;
+  }
+
+  // Mapped once and paged in, so only the decoders are timed
+  InputFile input = InputFile::Open(jxrPath);
+  if (!input.valid())
+    return false;
+  input.Prefault();
+
+  WicFrame probe;
+  if (!OpenWicFrame(factory.Get(), input.data(), input.size(), probe))
+    return false;
+  WICPixelFormatGUID pixFmt;
+  probe.frame->GetPixelFormat(&pixFmt);
+  const bool hdr = IsHdrPixelFormat(pixFmt);
+  const WICPixelFormatGUID &target =
+      hdr ? GUID_WICPixelFormat64bppRGBAHalf : GUID_WICPixelFormat24bppBGR;
+  UINT width, height;
+  probe.frame->GetSize(&width, &height);
+  probe = WicFrame();
+
+  result = {};
+  result.width = width;
+  result.height = height;
+  result.hdr = hdr;
+  result.iterations = iterations;
+  const UINT stride = width * (hdr ? 8 : 3);
+  std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height);
+
+  const int threads = static_cast<int>(ThreadPool::Shared().size()) + 1;
+  std::vector<int> counts;
+  for (int stripes = 1; stripes < threads; stripes *= 2)
+    counts.push_back(stripes);
+  counts.push_back(threads);
+
+  for (int stripes : counts) {
+    DecodeBenchmarkResult::Point point;
+    point.stripes = stripes;
+    for (int i = 0; i < iterations; ++i) {
+      // Opening the decoder is part of what each extra stripe costs
+      auto t0 = Clock::now();
+      WicFrame wic;
+      if (!OpenWicFrame(factory.Get(), input.data(), input.size(), wic) ||
+          !ConvertWicFrame(factory.Get(), target, wic) ||
+          !CopyFramePixels(input.data(), input.size(), target, wic, stride,
+                           stripes, pixels.data()))
+        return false;
+      point.ms += std::chrono::duration<double, std::milli>(Clock::now() - t0)
+                      .count();
+    }
+    point.ms /= iterations;
+    result.points.push_back(point);
+  }
   return true;
 }
 
@@ -1,13 +1,180 @@
 #pragma once
+#include "Cancellation.h"
+#include "EncodedJpeg.h"
+#include "InputFile.h"
+#include "MemoryStats.h"
+#include "Preview.h"
+#include "Scratch.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace jxr {
 
+class AsyncIo;
+class ConversionJournal;
+class ResultCache;
+
+/// Encoder used for the SDR-only (8-bit JXR) transcode path.
+enum class SdrEncoder {
+  LibjpegTurbo, // direct libjpeg-turbo SIMD encode (default)
+  Wic           // WIC's built-in JPEG encoder
+};
+
+/// libultrahdr settings for Ultra HDR output. The defaults are the
+/// service's; --sweep measures what the alternatives cost and buy.
+struct UltraHdrTuning {
+  int gainMapQuality = 95;
+  bool multiChannelGainMap = true;
+  bool bestQualityPreset = true; // false: UHDR_USAGE_REALTIME
+  // Fixed target display peak; 0 = from the measured frame peak
+  // (adaptiveRouting) or 4000 nits
+  float targetPeakNits = 0.0f;
+  int gainMapScaleFactor = 0; // gain map downscale; 0 = libultrahdr default
+};
+
+/// Tunables for a single conversion.
+struct ConvertOptions {
+  int jpegQuality = 95;
+  SdrEncoder sdrEncoder = SdrEncoder::LibjpegTurbo;
+  bool optimizeHuffman = false; // SDR path only; smaller files, slower encode
+  // Route HDR frames without real headroom to the SDR-only encoder and
+  // derive the gain map target peak from the measured frame peak.
+  bool adaptiveRouting = true;
+  // Ultra HDR: tone-map and encode the SDR base image here, in slices on
+  // the thread pool, instead of leaving both to libultrahdr on one thread.
+  // Experimental and opt-in (--sliced-base): the stitched stream is not
+  // yet checked against libultrahdr's own base.
+  bool slicedBaseEncode = false;
+  // Decode in this many horizontal stripes, each by its own WIC decoder on
+  // the thread pool; 0 = one per core. Whether stripes beat one decoder
+  // depends on the file's tiling, so the default (-1) times one stripe
+  // against one per core on the first large frames and keeps the faster.
+  int decodeStripes = -1;
+  UltraHdrTuning uhdr;
+  // Long-edge sizes (px) of SDR previews built from the decoded frame and
+  // written next to the output as "<name>.thumb<size>.jpg". Empty = none.
+  std::vector<uint32_t> previewSizes;
+  int previewQuality = 85;
+  // Write-ahead journal for the temp → rename → delete sequence (optional)
+  ConversionJournal *journal = nullptr;
+  // Finished outputs by source content hash (optional). Jobs that want
+  // previews still store into it but never hit, since a hit skips decoding.
+  ResultCache *cache = nullptr;
+  // Preemption (optional): each job takes a token from it when it starts,
+  // and Cancel() aborts every job started before the call
+  CancelSource *cancel = nullptr;
+  // Sources on network shares are copied here before decoding (optional)
+  ScratchSpace *scratch = nullptr;
+};
+
+/// One conversion moving through the stages below. Each stage consumes the
+/// previous stage's output and frees what later stages no longer need.
+struct ConversionJob {
+  std::wstring jxrPath;
+  ConvertOptions options;
+  CancelToken cancel;          // from options.cancel, taken at submit
+  bool cancelled = false;      // failed because the token tripped
+
+  StagedFile staged;           // Read: local copy of a source on a share
+  InputFile input;             // Read (released before `staged`)
+  uint64_t contentHash = 0;    // Read, when a cache is set
+  uint64_t sourceBytes = 0;    // Read, with contentHash
+  bool cacheHit = false;       // Read: `encoded` came from the cache
+  uint32_t width = 0;          // Read (container header), Decode
+  uint32_t height = 0;
+  bool hdrSource = false;
+  std::vector<uint8_t> pixels; // RGBA half-float (HDR) or BGR24 (SDR)
+  bool sdrOnly = false;        // Rescale: routing decision
+  float targetPeakNits = 0.0f;
+  std::vector<PreviewBuilder> previews;
+  EncodedJpeg encoded;          // Encode: finished JPEG bytes
+  bool failed = false;          // set by whoever runs the stages
+  MemoryCounters memory; // stages sample it; runners attribute allocations
+};
+
+/// Conversion stages, in order. Each returns false on failure (error is
+/// logged). Decode and Encode need COM on the calling thread. After a cache
+/// hit in Read, Decode / Rescale / Encode pass the job through untouched.
+/// Read to Encode are preemption points: once the job's token trips they
+/// fail with `cancelled` set, at their start or between row chunks. Commit
+/// only does I/O and always runs to the end.
+bool ReadStage(ConversionJob &job,     // map / read the source file
+               BufferPool *pool = nullptr);
+bool DecodeStage(ConversionJob &job);  // WIC decode; releases the source
+bool RescaleStage(ConversionJob &job); // scRGB rescale, routing, previews
+bool EncodeStage(ConversionJob &job);  // libultrahdr / libjpeg-turbo / WIC
+bool CommitStage(ConversionJob &job);  // temp write, flush, rename, delete
+
+/// Logs the job's heap and working-set use next to its resolution and
+/// pixel format, also per megapixel.
+void LogConversionMemory(const ConversionJob &job);
+
+/// CommitStage without waiting on the disk: the chain runs on `io` and
+/// `done(ok)` is called from an I/O thread. `job` is kept alive until then.
+void CommitStageAsync(const std::shared_ptr<ConversionJob> &job, AsyncIo &io,
+                      std::function<void(bool)> done);
+
 /// Convert a JXR file to an Ultra HDR JPEG (gain map JPEG).
 /// The output file is written next to the input with .jpg extension.
 /// Returns true on success, false on failure (error is logged).
 /// If the JXR is SDR (8-bit), a simple JPEG transcode is performed.
 bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath,
                               int jpegQuality = 95);
+bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath,
+                              const ConvertOptions &options);
+
+/// Same, decoding from already-loaded bytes.
+/// An invalid `input` makes the converter map/read the file itself.
+bool ConvertJxrToUltraHdrJpeg(const std::wstring &jxrPath,
+                              const ConvertOptions &options, InputFile input);
+
+/// Converts a JXR image already in memory (e.g. received over the network)
+/// without creating, replacing or deleting any file. On success `out` holds
+/// the JPEG; Ultra HDR output is libultrahdr's own encoded stream, moved
+/// out rather than copied. Previews and the journal are not used. Needs COM
+/// on the calling thread; `data` must stay valid until this returns.
+bool ConvertJxrBuffer(const std::byte *data, size_t size,
+                      const ConvertOptions &options, EncodedJpeg &out);
+
+/// Average per-encode timings for one decoded frame (quality 95).
+struct SdrEncoderBenchmarkResult {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int iterations = 0;
+  double wicMs = 0.0;
+  double turboMs = 0.0;
+  double turboOptimizedMs = 0.0;
+  size_t wicBytes = 0;
+  size_t turboBytes = 0;
+  size_t turboOptimizedBytes = 0;
+};
+
+/// Decodes `jxrPath` once as 8-bit BGR, then times the WIC JPEG encoder
+/// against libjpeg-turbo (default and optimized Huffman tables).
+bool RunSdrEncoderBenchmark(const std::wstring &jxrPath, int iterations,
+                            SdrEncoderBenchmarkResult &result);
+
+/// Average decode time (WIC decoder setup + CopyPixels) per stripe count.
+struct DecodeBenchmarkResult {
+  struct Point {
+    int stripes = 1;
+    double ms = 0.0;
+  };
+  uint32_t width = 0;
+  uint32_t height = 0;
+  bool hdr = false;
+  int iterations = 0;
+  std::vector<Point> points; // 1, 2, 4, ... stripes, then one per core
+};
+
+/// Decodes `jxrPath` (mapped and paged in first) into the pixel format the
+/// converter uses, with ConvertOptions::decodeStripes set to 1, 2, 4, ...
+/// up to the pool's thread count, timing each.
+bool RunDecodeBenchmark(const std::wstring &jxrPath, int iterations,
+                        DecodeBenchmarkResult &result);
 
 } // namespace jxr
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace jxr {
+
+/// A finished JPEG, owned either as a byte vector (libjpeg-turbo, WIC) or
+/// as the encoder that produced it (libultrahdr keeps its output stream
+/// inside the encoder). Either way the bytes are handed from stage to stage
+/// and out of the library by move, never copied. Move-only.
+class EncodedJpeg {
+public:
+  EncodedJpeg() = default;
+
+  explicit EncodedJpeg(std::vector<uint8_t> bytes)
+      : bytes_(std::move(bytes)), data_(bytes_.data()), size_(bytes_.size()) {}
+
+  /// Bytes living inside `owner`, which is kept alive (and released through
+  /// its deleter) for as long as this object holds them.
+  EncodedJpeg(std::shared_ptr<void> owner, const uint8_t *data, size_t size)
+      : owner_(std::move(owner)), data_(data), size_(size) {}
+
+  EncodedJpeg(EncodedJpeg &&other) noexcept { *this = std::move(other); }
+
+  EncodedJpeg &operator=(EncodedJpeg &&other) noexcept {
+    if (this != &other) {
+      bytes_ = std::move(other.bytes_); // the heap block (and data_) stays put
+      owner_ = std::move(other.owner_);
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  EncodedJpeg(const EncodedJpeg &) = delete;
+  EncodedJpeg &operator=(const EncodedJpeg &) = delete;
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  std::vector<uint8_t> bytes_;
+  std::shared_ptr<void> owner_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace jxr
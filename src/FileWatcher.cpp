@@ -1,4 +1,6 @@
 #include "FileWatcher.h"
+#include "RootIndex.h"
+#include "Trace.h"
 #include "Utils.h"
 #include <algorithm>
 #include <cctype>
@@ -8,148 +10,299 @@ namespace fs = std::filesystem;
 
 namespace jxr {
 
+// Completion key posted when the shutdown event fires (root keys are indices)
+static constexpr ULONG_PTR kShutdownKey = ~static_cast<ULONG_PTR>(0);
+
+// Per-root notification buffer. 64 KB is also the limit for network shares.
+static constexpr DWORD kBufferBytes = 64 * 1024;
+
+// Dispatch only acts on files being created or renamed into place, so file
+// names are all any root needs. Last-write changes would report every
+// block a recording appends below the Videos folder.
+static constexpr DWORD kNotifyMask = FILE_NOTIFY_CHANGE_FILE_NAME;
+
+struct FileWatcher::Root {
+  std::wstring path;
+  std::wstring key; // lowercase, for nesting checks
+  UniqueHandle dir;
+  OVERLAPPED ov = {};
+  std::vector<DWORD> buffer; // DWORD-aligned, as ReadDirectoryChangesW needs
+  bool active = false;
+  std::unique_ptr<RootIndex> index; // what to look at after an overflow
+  RootStats stats;
+};
+
 // ============================================================================
-// Case-insensitive extension check
+// Root list
 // ============================================================================
-static bool HasJxrExtension(const std::wstring &filename) {
-  if (filename.size() < 4)
+FileWatcher::FileWatcher() = default;
+FileWatcher::~FileWatcher() = default;
+
+bool FileWatcher::AddRoot(const std::wstring &dir) {
+  std::error_code ec;
+  if (dir.empty() || !fs::is_directory(dir, ec)) {
+    LogMsg(L"FileWatcher: skipping missing root '%s'", dir.c_str());
     return false;
-  std::wstring ext = filename.substr(filename.size() - 4);
-  // Convert to lowercase
-  std::transform(ext.begin(), ext.end(), ext.begin(),
-                 [](wchar_t c) { return static_cast<wchar_t>(::towlower(c)); });
-  return ext == L".jxr";
+  }
+  fs::path canonical = fs::weakly_canonical(dir, ec);
+  std::wstring path = ec ? dir : canonical.wstring();
+  if (path.size() > 3 && path.back() == L'\\')
+    path.pop_back();
+  std::wstring key = ToLowerPath(path);
+
+  for (const auto &root : roots_) {
+    if (IsPathWithin(key, root->key)) {
+      LogMsg(L"FileWatcher: '%s' is already covered by '%s'", path.c_str(),
+             root->path.c_str());
+      return false;
+    }
+  }
+  // A wider root supersedes the ones below it
+  roots_.erase(std::remove_if(roots_.begin(), roots_.end(),
+                              [&](const std::unique_ptr<Root> &root) {
+                                return IsPathWithin(root->key, key);
+                              }),
+               roots_.end());
+
+  auto root = std::make_unique<Root>();
+  root->path = std::move(path);
+  root->key = std::move(key);
+  roots_.push_back(std::move(root));
+  return true;
+}
+
+std::vector<std::wstring> FileWatcher::Roots() const {
+  std::vector<std::wstring> paths;
+  for (const auto &root : roots_)
+    paths.push_back(root->path);
+  return paths;
 }
 
 // ============================================================================
-// Main watcher loop
+// Per-root I/O
 // ============================================================================
-void FileWatcher::Run(const std::wstring &watchDir,
-                      ThreadSafeQueue<std::wstring> &queue,
-                      HANDLE shutdownEvent) {
-  LogMsg(L"FileWatcher: watching '%s'", watchDir.c_str());
+bool FileWatcher::Arm(Root &root) {
+  root.ov = {};
+  if (!::ReadDirectoryChangesW(root.dir.get(), root.buffer.data(),
+                               kBufferBytes,
+                               TRUE, // Watch subtree
+                               kNotifyMask, nullptr, &root.ov, nullptr)) {
+    LogMsg(L"FileWatcher: ReadDirectoryChangesW failed on '%s', error %u",
+           root.path.c_str(), ::GetLastError());
+    return false;
+  }
+  return true;
+}
 
-  // Open directory handle for monitoring
-  HANDLE hDir =
-      ::CreateFileW(watchDir.c_str(), FILE_LIST_DIRECTORY,
-                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-                    nullptr, OPEN_EXISTING,
-                    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+// Buffer overflow: events for this root were lost. The index narrows the
+// search to USN records or changed directories instead of the whole tree.
+void FileWatcher::Resync(Root &root, PathQueue &queue) {
+  TraceSpan span("resync");
+  // The index applies the watcher's filter itself
+  RootIndex::ResyncResult r = root.index->Resync(
+      root.dir.get(), [&](const std::wstring &path) { queue.push(path); });
+  root.stats.rescanned += r.found;
+  LogMsg(L"FileWatcher: resync of '%s' via %s queued %zu files (%zu "
+         L"directories checked, %zu listed)",
+         root.path.c_str(), r.usedUsn ? L"USN journal" : L"directory times",
+         r.found, r.dirsChecked, r.dirsListed);
+}
 
-  if (hDir == INVALID_HANDLE_VALUE) {
-    LogMsg(L"FileWatcher: failed to open directory, error %u",
-           ::GetLastError());
+void FileWatcher::Dispatch(Root &root, DWORD bytes, PathQueue &queue) {
+  if (onFirstEvent_) {
+    onFirstEvent_();
+    onFirstEvent_ = nullptr;
+  }
+  if (bytes == 0) {
+    // Buffer overflow — too many changes at once
+    uint64_t n = ++root.stats.overflows;
+    TraceInstant("overflow");
+    LogMsg(L"FileWatcher: buffer overflow #%llu on '%s', resyncing",
+           static_cast<unsigned long long>(n), root.path.c_str());
+    Resync(root, queue);
     return;
   }
 
-  // RAII handle cleanup
-  UniqueHandle dirHandle(hDir);
+  // Parse the notification buffer
+  TraceSpan span("dispatch", "bytes", bytes);
+  const uint8_t *ptr = reinterpret_cast<const uint8_t *>(root.buffer.data());
+  while (true) {
+    const FILE_NOTIFY_INFORMATION *info =
+        reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(ptr);
+    ++root.stats.events;
 
-  // Overlapped event for async ReadDirectoryChangesW
-  HANDLE hEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
-  if (!hEvent) {
-    LogMsg(L"FileWatcher: failed to create event");
-    return;
-  }
-  UniqueHandle eventHandle(hEvent);
+    // Matched in place; only accepted entries become strings
+    const size_t length = info->FileNameLength / sizeof(wchar_t);
+    if ((info->Action == FILE_ACTION_ADDED ||
+         info->Action == FILE_ACTION_RENAMED_NEW_NAME) &&
+        filter_.Matches(info->FileName, length)) {
+      std::wstring fullPath = root.path;
+      fullPath += L'\\';
+      fullPath.append(info->FileName, length);
+      LogMsg(L"FileWatcher: detected JXR: %s", fullPath.c_str());
+      queue.push(std::move(fullPath));
+      ++root.stats.accepted;
+      TraceInstant("queue push");
+    }
 
-  // Buffer for directory change notifications
-  constexpr DWORD BUF_SIZE = 64 * 1024; // 64 KB
-  std::vector<uint8_t> buffer(BUF_SIZE);
+    if (info->NextEntryOffset == 0)
+      break;
+    ptr += info->NextEntryOffset;
+  }
+  // Everything up to here was delivered; a later resync can start from now
+  root.index->Checkpoint();
+}
 
-  while (true) {
-    OVERLAPPED overlapped = {};
-    overlapped.hEvent = hEvent;
-    ::ResetEvent(hEvent);
+// ============================================================================
+// Main watcher loop: one completion port, one pending read per root
+// ============================================================================
+static void CALLBACK OnShutdownSignaled(PVOID port, BOOLEAN) {
+  ::PostQueuedCompletionStatus(static_cast<HANDLE>(port), 0, kShutdownKey,
+                               nullptr);
+}
 
-    BOOL success = ::ReadDirectoryChangesW(hDir, buffer.data(), BUF_SIZE,
-                                           TRUE, // Watch subtree
-                                           FILE_NOTIFY_CHANGE_FILE_NAME |
-                                               FILE_NOTIFY_CHANGE_LAST_WRITE,
-                                           nullptr, &overlapped, nullptr);
+void FileWatcher::Run(PathQueue &queue, HANDLE shutdownEvent) {
+  TraceThreadName("watcher");
+  HANDLE port = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+  if (!port) {
+    LogMsg(L"FileWatcher: failed to create completion port, error %u",
+           ::GetLastError());
+    return;
+  }
+  UniqueHandle portHandle(port);
 
-    if (!success) {
-      DWORD err = ::GetLastError();
-      if (err != ERROR_IO_PENDING) {
-        LogMsg(L"FileWatcher: ReadDirectoryChangesW failed, error %u", err);
-        break;
-      }
+  size_t active = 0;
+  for (size_t i = 0; i < roots_.size(); ++i) {
+    Root &root = *roots_[i];
+    root.dir = MakeUniqueHandle(::CreateFileW(
+        root.path.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+        nullptr));
+    if (!root.dir) {
+      LogMsg(L"FileWatcher: failed to open '%s', error %u", root.path.c_str(),
+             ::GetLastError());
+      continue;
+    }
+    if (!::CreateIoCompletionPort(root.dir.get(), port, i, 0)) {
+      LogMsg(L"FileWatcher: cannot attach '%s' to the port, error %u",
+             root.path.c_str(), ::GetLastError());
+      continue;
     }
+    root.buffer.resize(kBufferBytes / sizeof(DWORD));
+    root.active = Arm(root);
+    if (root.active) {
+      LogMsg(L"FileWatcher: watching '%s'", root.path.c_str());
+      ++active;
+    }
+  }
+  if (active == 0) {
+    LogMsg(L"FileWatcher: no watchable roots");
+    return;
+  }
+  LogMsg(L"FileWatcher: %zu include and %zu exclude patterns",
+         filter_.includeCount(), filter_.excludeCount());
 
-    // Wait for either directory change or shutdown
-    HANDLE waitHandles[2] = {hEvent, shutdownEvent};
-    DWORD waitResult =
-        ::WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE);
+  // Baselines for overflow resync. Only the USN cursor is taken here; a
+  // directory-time baseline would walk the whole tree before the first
+  // dispatch, so it is left to the first resync instead
+  for (auto &root : roots_) {
+    if (!root->active)
+      continue;
+    root->index = std::make_unique<RootIndex>(
+        root->path, RootIndex::Mode::Auto, filter_);
+    root->index->Snapshot();
+  }
+  if (onReady_)
+    onReady_(active);
 
-    if (waitResult == WAIT_OBJECT_0 + 1) {
-      // Shutdown signaled
-      ::CancelIoEx(hDir, &overlapped);
-      LogMsg(L"FileWatcher: shutdown signaled, exiting");
-      break;
-    }
+  // The shutdown event wakes the loop through the port
+  HANDLE wait = nullptr;
+  if (!::RegisterWaitForSingleObject(&wait, shutdownEvent, OnShutdownSignaled,
+                                     port, INFINITE, WT_EXECUTEONLYONCE)) {
+    LogMsg(L"FileWatcher: failed to register shutdown wait, error %u",
+           ::GetLastError());
+    wait = nullptr;
+  }
+
+  while (active > 0) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED *ov = nullptr;
+    BOOL ok = ::GetQueuedCompletionStatus(port, &bytes, &key, &ov, INFINITE);
 
-    if (waitResult == WAIT_OBJECT_0) {
-      // Directory change occurred
-      DWORD bytesReturned = 0;
-      if (!::GetOverlappedResult(hDir, &overlapped, &bytesReturned, FALSE)) {
-        LogMsg(L"FileWatcher: GetOverlappedResult failed, error %u",
+    if (!ov) {
+      if (key == kShutdownKey) {
+        LogMsg(L"FileWatcher: shutdown signaled, exiting");
+      } else {
+        LogMsg(L"FileWatcher: GetQueuedCompletionStatus failed, error %u",
                ::GetLastError());
-        continue;
       }
+      break;
+    }
 
-      if (bytesReturned == 0) {
-        // Buffer overflow — too many changes at once. Scan directory manually.
-        LogMsg(
-            L"FileWatcher: buffer overflow, scanning directory for .jxr files");
-        try {
-          for (const auto &entry : fs::recursive_directory_iterator(watchDir)) {
-            if (entry.is_regular_file() &&
-                HasJxrExtension(entry.path().wstring())) {
-              // Skip if a .jpg already exists (already converted)
-              fs::path jpgPath = entry.path();
-              jpgPath.replace_extension(L".jpg");
-              if (fs::exists(jpgPath))
-                continue;
-              queue.push(entry.path().wstring());
-            }
-          }
-        } catch (const std::exception &e) {
-          LogMsg(L"FileWatcher: scan error: %hs", e.what());
-        }
+    Root &root = *roots_[key];
+    if (!ok) {
+      DWORD err = ::GetLastError();
+      if (err == ERROR_NOTIFY_ENUM_DIR) {
+        bytes = 0; // overflow reported as an error
+      } else {
+        // Root deleted, drive unplugged, share gone...
+        LogMsg(L"FileWatcher: lost '%s', error %u", root.path.c_str(), err);
+        root.active = false;
+        --active;
         continue;
       }
+    }
 
-      // Parse the notification buffer
-      const uint8_t *ptr = buffer.data();
-      while (true) {
-        const FILE_NOTIFY_INFORMATION *info =
-            reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(ptr);
-
-        if (info->Action == FILE_ACTION_ADDED ||
-            info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
-          std::wstring filename(info->FileName,
-                                info->FileNameLength / sizeof(wchar_t));
-
-          if (HasJxrExtension(filename)) {
-            // Build full path
-            std::wstring fullPath = watchDir + L"\\" + filename;
-            LogMsg(L"FileWatcher: detected JXR: %s", fullPath.c_str());
-            queue.push(std::move(fullPath));
-          }
-        }
-
-        if (info->NextEntryOffset == 0)
-          break;
-        ptr += info->NextEntryOffset;
-      }
-    } else {
-      // Unexpected wait result
-      LogMsg(L"FileWatcher: unexpected wait result %u", waitResult);
-      break;
+    Dispatch(root, bytes, queue);
+    if (!Arm(root)) {
+      root.active = false;
+      --active;
     }
   }
 
+  // Cancel the pending reads and let them finish before buffers go away
+  for (auto &root : roots_) {
+    if (!root->active)
+      continue;
+    ::CancelIoEx(root->dir.get(), &root->ov);
+    DWORD bytes = 0;
+    ::GetOverlappedResult(root->dir.get(), &root->ov, &bytes, TRUE);
+    root->active = false;
+  }
+  if (wait)
+    ::UnregisterWaitEx(wait, INVALID_HANDLE_VALUE);
+
+  LogStats();
   LogMsg(L"FileWatcher: exited");
 }
 
+void FileWatcher::Run(const std::wstring &watchDir, PathQueue &queue,
+                      HANDLE shutdownEvent) {
+  AddRoot(watchDir);
+  Run(queue, shutdownEvent);
+}
+
+void FileWatcher::LogStats() const {
+  for (const auto &root : roots_) {
+    const RootStats &s = root->stats;
+    LogMsg(L"FileWatcher: '%s': %llu events seen, %llu accepted, %llu "
+           L"overflows (%llu files found by resync)",
+           root->path.c_str(), static_cast<unsigned long long>(s.events),
+           static_cast<unsigned long long>(s.accepted),
+           static_cast<unsigned long long>(s.overflows),
+           static_cast<unsigned long long>(s.rescanned));
+  }
+}
+
+FileWatcher::EventCounts FileWatcher::GetEventCounts() const {
+  EventCounts counts;
+  for (const auto &root : roots_) {
+    counts.seen += root->stats.events;
+    counts.accepted += root->stats.accepted;
+  }
+  return counts;
+}
+
 } // namespace jxr
@@ -1,19 +1,91 @@
 #pragma once
-#include "ThreadSafeQueue.h"
+#include "PathArena.h"
+#include "WatchFilter.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 #include <windows.h>
 
 namespace jxr {
 
-/// Watches a directory recursively for new .jxr files.
-/// Runs in its own thread; call Run() from the thread entry point.
+/// Watches any number of directories recursively for new .jxr files, all
+/// multiplexed on one I/O completion port: the thread count does not grow
+/// with the number of roots. Only file-name changes are subscribed to, so
+/// a video being recorded below a root does not wake the watcher for every
+/// block it writes. Call Run() from the thread entry point.
 class FileWatcher {
 public:
-  /// watchDir: directory to watch recursively
+  /// Per-root counters, logged at overflow and on exit.
+  struct RootStats {
+    std::atomic<uint64_t> events{0};    // notification entries seen
+    std::atomic<uint64_t> accepted{0};  // passed the filter and queued
+    std::atomic<uint64_t> overflows{0}; // buffer overflows (events lost)
+    std::atomic<uint64_t> rescanned{0}; // files queued by overflow resyncs
+  };
+
+  /// Seen and accepted notification entries, summed over the roots.
+  struct EventCounts {
+    uint64_t seen = 0;
+    uint64_t accepted = 0;
+  };
+
+  FileWatcher();
+  ~FileWatcher();
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  /// Adds a root to watch. Must be called before Run(). Roots that do not
+  /// exist, or that lie inside a root already added, are skipped; a root
+  /// containing earlier ones replaces them. Returns true if it was added.
+  bool AddRoot(const std::wstring &dir);
+
+  /// The roots that will be (or are being) watched.
+  std::vector<std::wstring> Roots() const;
+
+  /// Which created or renamed files are queued, by root-relative path
+  /// (default: "*.jxr"). Also applied to overflow resyncs. Set before Run().
+  void SetFilter(WatchFilter filter) { filter_ = std::move(filter); }
+  const WatchFilter &Filter() const { return filter_; }
+
+  /// Called on the watcher thread once every root's first read is armed,
+  /// i.e. from when no new file can be missed. Set before Run().
+  void SetReadyCallback(std::function<void(size_t activeRoots)> onReady) {
+    onReady_ = std::move(onReady);
+  }
+
+  /// Called on the watcher thread when the first notification (or overflow)
+  /// is dispatched. Set before Run().
+  void SetFirstEventCallback(std::function<void()> onFirstEvent) {
+    onFirstEvent_ = std::move(onFirstEvent);
+  }
+
+  /// Watches every root until shutdownEvent is signaled.
   /// queue: thread-safe queue to push discovered .jxr paths into
-  /// shutdownEvent: when signaled, the watcher exits its loop
-  void Run(const std::wstring &watchDir, ThreadSafeQueue<std::wstring> &queue,
+  void Run(PathQueue &queue, HANDLE shutdownEvent);
+
+  /// Single-root convenience form.
+  void Run(const std::wstring &watchDir, PathQueue &queue,
            HANDLE shutdownEvent);
+
+  /// Logs every root's counters.
+  void LogStats() const;
+
+  EventCounts GetEventCounts() const;
+
+private:
+  struct Root;
+
+  bool Arm(Root &root);
+  void Resync(Root &root, PathQueue &queue);
+  void Dispatch(Root &root, DWORD bytes, PathQueue &queue);
+
+  std::vector<std::unique_ptr<Root>> roots_;
+  WatchFilter filter_;
+  std::function<void(size_t)> onReady_;
+  std::function<void()> onFirstEvent_;
 };
 
 } // namespace jxr
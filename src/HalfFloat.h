@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace jxr {
+
+// ============================================================================
+// IEEE 754 half-float ↔ float conversion helpers
+// ============================================================================
+inline float HalfToFloat(uint16_t h) {
+  uint32_t sign = (h & 0x8000u) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x03FF;
+
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      // ±0
+      uint32_t bits = sign;
+      float f;
+      std::memcpy(&f, &bits, 4);
+      return f;
+    }
+    // Subnormal: convert to normalized float
+    while (!(mantissa & 0x0400)) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    exponent++;
+    mantissa &= ~0x0400u;
+    exponent += (127 - 15);
+    uint32_t bits = sign | (exponent << 23) | (mantissa << 13);
+    float f;
+    std::memcpy(&f, &bits, 4);
+    return f;
+  } else if (exponent == 31) {
+    // Inf / NaN
+    uint32_t bits = sign | 0x7F800000u | (mantissa << 13);
+    float f;
+    std::memcpy(&f, &bits, 4);
+    return f;
+  }
+
+  exponent += (127 - 15);
+  uint32_t bits = sign | (exponent << 23) | (mantissa << 13);
+  float f;
+  std::memcpy(&f, &bits, 4);
+  return f;
+}
+
+inline uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, 4);
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x007FFFFFu;
+
+  if (exponent <= 0) {
+    if (exponent < -10)
+      return static_cast<uint16_t>(sign); // Too small, flush to ±0
+    // Subnormal
+    mantissa |= 0x00800000u;
+    uint32_t shift = static_cast<uint32_t>(1 - exponent);
+    mantissa >>= shift;
+    return static_cast<uint16_t>(sign | (mantissa >> 13));
+  } else if (exponent >= 31) {
+    // Overflow → Inf, or NaN passthrough
+    if (exponent == 31 && mantissa != 0)
+      return static_cast<uint16_t>(sign | 0x7C00 | (mantissa >> 13)); // NaN
+    return static_cast<uint16_t>(sign | 0x7C00);                      // ±Inf
+  }
+
+  return static_cast<uint16_t>(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+} // namespace jxr
@@ -0,0 +1,221 @@
+#include "InputFile.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace jxr {
+
+// ============================================================================
+// BufferPool
+// ============================================================================
+std::vector<uint8_t> BufferPool::Acquire(size_t size) {
+  std::vector<uint8_t> buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Prefer a buffer that is already big enough
+    auto it = std::find_if(free_.begin(), free_.end(), [size](const auto &b) {
+      return b.capacity() >= size;
+    });
+    if (it == free_.end() && !free_.empty())
+      it = free_.begin();
+    if (it != free_.end()) {
+      buffer = std::move(*it);
+      free_.erase(it);
+    }
+  }
+  buffer.resize(size);
+  return buffer;
+}
+
+void BufferPool::Release(std::vector<uint8_t> &&buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_.size() < maxBuffers_)
+    free_.push_back(std::move(buffer));
+}
+
+// ============================================================================
+// InputFile
+// ============================================================================
+bool IsRemotePath(const std::wstring &path) {
+  if (path.rfind(L"\\\\", 0) == 0)
+    return true; // UNC path
+  wchar_t root[MAX_PATH];
+  if (!::GetVolumePathNameW(path.c_str(), root, MAX_PATH))
+    return false;
+  return ::GetDriveTypeW(root) == DRIVE_REMOTE;
+}
+
+// Reads [0, size) with several chunk reads in flight, so a network share
+// can pipeline them instead of paying one round trip per chunk. Works on
+// overlapped and plain handles alike (the latter just complete inline).
+static bool ReadChunksOverlapped(HANDLE file, uint8_t *dst, size_t size) {
+  constexpr DWORD kChunk = 8 * 1024 * 1024;
+  constexpr int kDepth = 4;
+  struct Slot {
+    OVERLAPPED ov;
+    UniqueHandle event;
+    DWORD want;
+    bool busy;
+  };
+  Slot slots[kDepth] = {};
+  for (auto &slot : slots) {
+    slot.event.reset(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+    if (!slot.event)
+      return false;
+  }
+
+  size_t next = 0, done = 0;
+  auto issue = [&](Slot &slot) {
+    slot.want = static_cast<DWORD>(std::min<size_t>(kChunk, size - next));
+    slot.ov = {};
+    slot.ov.Offset = static_cast<DWORD>(next);
+    slot.ov.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(next) >> 32);
+    slot.ov.hEvent = slot.event.get();
+    if (!::ReadFile(file, dst + next, slot.want, nullptr, &slot.ov) &&
+        ::GetLastError() != ERROR_IO_PENDING)
+      return false;
+    next += slot.want;
+    slot.busy = true;
+    return true;
+  };
+
+  bool ok = true;
+  for (auto &slot : slots) {
+    if (next < size && !issue(slot)) {
+      ok = false;
+      break;
+    }
+  }
+  // Slots complete in the order their chunks were issued
+  for (int i = 0; ok && done < size; i = (i + 1) % kDepth) {
+    Slot &slot = slots[i];
+    if (!slot.busy)
+      continue;
+    DWORD got = 0;
+    BOOL finished = ::GetOverlappedResult(file, &slot.ov, &got, TRUE);
+    slot.busy = false;
+    if (!finished || got != slot.want) {
+      ok = false;
+      break;
+    }
+    done += got;
+    if (next < size && !issue(slot))
+      ok = false;
+  }
+
+  if (!ok) {
+    // Nothing may still be writing into dst once we return
+    ::CancelIo(file);
+    for (auto &slot : slots) {
+      DWORD got = 0;
+      if (slot.busy)
+        ::GetOverlappedResult(file, &slot.ov, &got, TRUE);
+    }
+  }
+  return ok;
+}
+
+InputFile InputFile::Open(const std::wstring &path, BufferPool *pool) {
+  InputFile file;
+  file.path_ = path;
+
+  const bool remote = IsRemotePath(path);
+  HANDLE hFile = ::CreateFileW(
+      path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN | (remote ? FILE_FLAG_OVERLAPPED : 0), nullptr);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    LogMsg(L"InputFile: cannot open %s, error %u", path.c_str(),
+           ::GetLastError());
+    return file;
+  }
+  UniqueHandle fileHandle(hFile);
+
+  LARGE_INTEGER size = {};
+  if (!::GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+    LogMsg(L"InputFile: empty or unreadable file: %s", path.c_str());
+    return file;
+  }
+  file.size_ = static_cast<size_t>(size.QuadPart);
+
+  if (!remote) {
+    // Local disk: map the file; pages come in on demand or via Prefault()
+    file.mapping_ =
+        ::CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (file.mapping_) {
+      file.view_ = static_cast<const uint8_t *>(
+          ::MapViewOfFile(file.mapping_, FILE_MAP_READ, 0, 0, 0));
+      if (file.view_) {
+        file.data_ = file.view_;
+        return file;
+      }
+      ::CloseHandle(file.mapping_);
+      file.mapping_ = nullptr;
+    }
+    // Fall through to a plain read if mapping fails
+  }
+
+  // Network share (or mapping failed): read into a buffer with the chunk
+  // reads pipelined
+  file.pool_ = pool;
+  file.buffer_ = pool ? pool->Acquire(file.size_)
+                      : std::vector<uint8_t>(file.size_);
+  if (!ReadChunksOverlapped(hFile, file.buffer_.data(), file.size_)) {
+    LogMsg(L"InputFile: read failed for %s, error %u", path.c_str(),
+           ::GetLastError());
+    file.Release();
+    return file;
+  }
+  file.data_ = file.buffer_.data();
+  return file;
+}
+
+InputFile InputFile::Borrow(const uint8_t *data, size_t size) {
+  InputFile file;
+  file.data_ = data;
+  file.size_ = size;
+  return file;
+}
+
+InputFile::~InputFile() { Release(); }
+
+InputFile::InputFile(InputFile &&other) noexcept { *this = std::move(other); }
+
+InputFile &InputFile::operator=(InputFile &&other) noexcept {
+  if (this != &other) {
+    Release();
+    path_ = std::move(other.path_);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+    view_ = std::exchange(other.view_, nullptr);
+    buffer_ = std::move(other.buffer_);
+    pool_ = std::exchange(other.pool_, nullptr);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void InputFile::Prefault() const {
+  if (!view_)
+    return;
+  WIN32_MEMORY_RANGE_ENTRY range = {const_cast<uint8_t *>(view_), size_};
+  ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+}
+
+void InputFile::Release() {
+  if (view_) {
+    ::UnmapViewOfFile(view_);
+    view_ = nullptr;
+  }
+  if (mapping_) {
+    ::CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+  if (pool_ && !buffer_.empty())
+    pool_->Release(std::move(buffer_));
+  buffer_ = {};
+  data_ = nullptr;
+  size_ = 0;
+}
+
+} // namespace jxr
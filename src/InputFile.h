@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <windows.h>
+
+namespace jxr {
+
+/// Small free-list of large byte buffers so back-to-back reads of 10–50 MB
+/// captures don't hit the heap every time.
+class BufferPool {
+public:
+  explicit BufferPool(size_t maxBuffers = 2) : maxBuffers_(maxBuffers) {}
+  std::vector<uint8_t> Acquire(size_t size);
+  void Release(std::vector<uint8_t> &&buffer);
+
+private:
+  std::mutex mutex_;
+  size_t maxBuffers_;
+  std::vector<std::vector<uint8_t>> free_;
+};
+
+/// The raw bytes of a source file, either memory-mapped (local disks) or
+/// read into a pooled buffer with several overlapped chunk reads in flight
+/// (network shares, where page-faulting a mapping turns into many small
+/// remote reads).
+class InputFile {
+public:
+  /// Opens `path` for reading. Returns an invalid InputFile on failure
+  /// (error is logged).
+  static InputFile Open(const std::wstring &path, BufferPool *pool = nullptr);
+
+  /// Wraps bytes owned by the caller (no copy). They must outlive the
+  /// InputFile; Release() only forgets them.
+  static InputFile Borrow(const uint8_t *data, size_t size);
+
+  InputFile() = default;
+  ~InputFile();
+  InputFile(InputFile &&other) noexcept;
+  InputFile &operator=(InputFile &&other) noexcept;
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+
+  bool valid() const { return data_ != nullptr; }
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool mapped() const { return view_ != nullptr; }
+  const std::wstring &path() const { return path_; }
+
+  /// Asks the OS to page a mapped view in ahead of use.
+  void Prefault() const;
+
+  /// Unmaps / returns the buffer. Must happen before the source is deleted.
+  void Release();
+
+private:
+  std::wstring path_;
+  HANDLE mapping_ = nullptr;
+  const uint8_t *view_ = nullptr;
+  std::vector<uint8_t> buffer_;
+  BufferPool *pool_ = nullptr;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+/// True for UNC paths and paths on mapped network drives.
+bool IsRemotePath(const std::wstring &path);
+
+} // namespace jxr
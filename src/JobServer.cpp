@@ -0,0 +1,356 @@
+#include "JobServer.h"
+#include "Trace.h"
+
+#include <sddl.h>
+
+namespace jxr {
+
+static constexpr DWORD kPipeBufferBytes = 64 * 1024;
+static constexpr size_t kMaxClients = 8;
+static constexpr size_t kMaxLineBytes = 64 * 1024;
+// A client that stops reading must not stall the thread reporting to it
+static constexpr DWORD kWriteTimeoutMs = 5000;
+
+struct JobServer::Client {
+  uint64_t id = 0;
+  UniqueHandle pipe;
+  std::mutex writeMutex; // one reply or event on the wire at a time
+  UniqueHandle writeEvent;
+  bool broken = false; // under writeMutex
+};
+
+// ============================================================================
+// Pipe setup
+// ============================================================================
+
+// DACL granting the current user and SYSTEM full access and nobody else
+// (the default pipe DACL lets Everyone read)
+static PSECURITY_DESCRIPTOR MakeUserOnlyDescriptor() {
+  HANDLE token = nullptr;
+  if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &token))
+    return nullptr;
+  UniqueHandle tokenHandle(token);
+
+  DWORD size = 0;
+  ::GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+  std::vector<uint8_t> info(size);
+  LPWSTR sid = nullptr;
+  if (size == 0 ||
+      !::GetTokenInformation(token, TokenUser, info.data(), size, &size) ||
+      !::ConvertSidToStringSidW(
+          reinterpret_cast<TOKEN_USER *>(info.data())->User.Sid, &sid))
+    return nullptr;
+
+  std::wstring sddl = L"D:P(A;;GA;;;SY)(A;;GA;;;" + std::wstring(sid) + L")";
+  ::LocalFree(sid);
+  PSECURITY_DESCRIPTOR sd = nullptr;
+  if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(
+          sddl.c_str(), SDDL_REVISION_1, &sd, nullptr))
+    return nullptr;
+  return sd;
+}
+
+static UniqueHandle CreatePipeInstance(const std::wstring &name,
+                                       PSECURITY_DESCRIPTOR sd, bool first) {
+  SECURITY_ATTRIBUTES sa = {sizeof(sa), sd, FALSE};
+  return MakeUniqueHandle(::CreateNamedPipeW(
+      name.c_str(),
+      PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+          (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT |
+          PIPE_REJECT_REMOTE_CLIENTS,
+      PIPE_UNLIMITED_INSTANCES, kPipeBufferBytes, kPipeBufferBytes, 0, &sa));
+}
+
+JobServer::JobServer() = default;
+
+JobServer::~JobServer() { Stop(); }
+
+bool JobServer::Start(const std::wstring &pipeName, SubmitFn onSubmit,
+                      StatsFn onStats) {
+  pipeName_ = pipeName;
+  onSubmit_ = std::move(onSubmit);
+  onStats_ = std::move(onStats);
+
+  security_ = MakeUserOnlyDescriptor();
+  if (!security_) {
+    LogMsg(L"JobServer: cannot build the pipe security descriptor, error %u",
+           ::GetLastError());
+    return false;
+  }
+  // FIRST_PIPE_INSTANCE: fail rather than share a name someone else owns
+  UniqueHandle pipe = CreatePipeInstance(pipeName_, security_, true);
+  if (!pipe) {
+    LogMsg(L"JobServer: cannot create '%s', error %u", pipeName_.c_str(),
+           ::GetLastError());
+    ::LocalFree(security_);
+    security_ = nullptr;
+    return false;
+  }
+  stop_ = MakeUniqueHandle(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+  if (!stop_) {
+    ::LocalFree(security_);
+    security_ = nullptr;
+    return false;
+  }
+
+  listener_ = std::thread(&JobServer::ListenLoop, this, std::move(pipe));
+  LogMsg(L"JobServer: listening on %s", pipeName_.c_str());
+  return true;
+}
+
+void JobServer::Stop() {
+  if (!stop_)
+    return;
+  ::SetEvent(stop_.get());
+  if (listener_.joinable())
+    listener_.join();
+
+  // Client threads see the event too; they take mutex_ on the way out
+  std::unordered_map<uint64_t, std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads.swap(threads_);
+  }
+  for (auto &entry : threads) {
+    if (entry.second.joinable())
+      entry.second.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clients_.clear();
+    finished_.clear();
+  }
+
+  ::LocalFree(security_);
+  security_ = nullptr;
+  stop_.reset();
+  LogMsg(L"JobServer: stopped");
+}
+
+// ============================================================================
+// Connections
+// ============================================================================
+void JobServer::ListenLoop(UniqueHandle pipe) {
+  TraceThreadName("ipc listener");
+  UniqueHandle connected =
+      MakeUniqueHandle(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+  if (!connected)
+    return;
+
+  while (pipe) {
+    ReapClients();
+
+    OVERLAPPED ov = {};
+    ov.hEvent = connected.get();
+    bool ok = ::ConnectNamedPipe(pipe.get(), &ov) != FALSE;
+    if (!ok) {
+      DWORD err = ::GetLastError();
+      if (err == ERROR_PIPE_CONNECTED) {
+        ok = true; // client arrived between create and connect
+      } else if (err == ERROR_IO_PENDING) {
+        HANDLE waits[2] = {connected.get(), stop_.get()};
+        if (::WaitForMultipleObjects(2, waits, FALSE, INFINITE) !=
+            WAIT_OBJECT_0) {
+          ::CancelIoEx(pipe.get(), &ov);
+          DWORD bytes = 0;
+          ::GetOverlappedResult(pipe.get(), &ov, &bytes, TRUE);
+          break;
+        }
+        DWORD bytes = 0;
+        ok = ::GetOverlappedResult(pipe.get(), &ov, &bytes, FALSE) != FALSE;
+      } else {
+        LogMsg(L"JobServer: ConnectNamedPipe failed, error %u", err);
+      }
+    }
+
+    if (ok) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (clients_.size() >= kMaxClients) {
+        LogMsg(L"JobServer: %zu clients connected, refusing another",
+               clients_.size());
+        ::DisconnectNamedPipe(pipe.get());
+      } else {
+        auto client = std::make_shared<Client>();
+        client->id = nextClientId_++;
+        client->pipe = std::move(pipe);
+        client->writeEvent =
+            MakeUniqueHandle(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+        clients_[client->id] = client;
+        threads_[client->id] =
+            std::thread(&JobServer::ClientLoop, this, client);
+        LogMsg(L"JobServer: client %llu connected",
+               static_cast<unsigned long long>(client->id));
+      }
+    }
+
+    pipe = CreatePipeInstance(pipeName_, security_, false);
+    if (!pipe) {
+      LogMsg(L"JobServer: cannot create another pipe instance, error %u",
+             ::GetLastError());
+    }
+  }
+}
+
+void JobServer::ClientLoop(std::shared_ptr<Client> client) {
+  TraceThreadName("ipc client");
+  UniqueHandle readEvent =
+      MakeUniqueHandle(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+  std::string pending;
+  char buffer[4096];
+
+  while (readEvent && client->writeEvent) {
+    OVERLAPPED ov = {};
+    ov.hEvent = readEvent.get();
+    DWORD got = 0;
+    if (!::ReadFile(client->pipe.get(), buffer, sizeof(buffer), nullptr,
+                    &ov) &&
+        ::GetLastError() != ERROR_IO_PENDING)
+      break; // client closed its end
+    HANDLE waits[2] = {readEvent.get(), stop_.get()};
+    if (::WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+      ::CancelIoEx(client->pipe.get(), &ov);
+      ::GetOverlappedResult(client->pipe.get(), &ov, &got, TRUE);
+      break;
+    }
+    if (!::GetOverlappedResult(client->pipe.get(), &ov, &got, FALSE))
+      break;
+
+    pending.append(buffer, got);
+    // Everything complete in this read is one batch: handle every line,
+    // then answer with a single write
+    std::string replies;
+    size_t start = 0;
+    size_t end;
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      std::string line = pending.substr(start, end - start);
+      start = end + 1;
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (!line.empty())
+        replies += HandleLine(*client, line);
+    }
+    pending.erase(0, start);
+    if (pending.size() > kMaxLineBytes) {
+      LogMsg(L"JobServer: client %llu sent an overlong line, disconnecting",
+             static_cast<unsigned long long>(client->id));
+      break;
+    }
+    if (!replies.empty() && !Send(*client, replies))
+      break;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(client->writeMutex);
+    client->broken = true;
+    ::DisconnectNamedPipe(client->pipe.get());
+  }
+  LogMsg(L"JobServer: client %llu disconnected",
+         static_cast<unsigned long long>(client->id));
+  std::lock_guard<std::mutex> lock(mutex_);
+  clients_.erase(client->id);
+  finished_.push_back(client->id);
+}
+
+// Joins the threads of clients that have gone
+void JobServer::ReapClients() {
+  std::vector<std::thread> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint64_t id : finished_) {
+      auto it = threads_.find(id);
+      if (it != threads_.end()) {
+        done.push_back(std::move(it->second));
+        threads_.erase(it);
+      }
+    }
+    finished_.clear();
+  }
+  for (auto &t : done)
+    t.join();
+}
+
+// ============================================================================
+// Protocol
+// ============================================================================
+std::string JobServer::HandleLine(Client &client, const std::string &line) {
+  if (line == "PING")
+    return "PONG\n";
+  if (line == "STATS")
+    return "STATS " + (onStats_ ? onStats_() : std::string()) + "\n";
+  if (line.rfind("SUBMIT ", 0) != 0)
+    return "ERROR unknown-command\n";
+
+  // SUBMIT <priority> <profile> <path>; the path may contain spaces
+  size_t priorityEnd = line.find(' ', 7);
+  size_t profileEnd = priorityEnd == std::string::npos
+                          ? std::string::npos
+                          : line.find(' ', priorityEnd + 1);
+  if (profileEnd == std::string::npos || profileEnd + 1 >= line.size())
+    return "ERROR syntax\n";
+
+  std::string priority = line.substr(7, priorityEnd - 7);
+  if (priority != "high" && priority != "normal")
+    return "ERROR priority\n";
+
+  Request request;
+  request.clientId = client.id;
+  request.highPriority = priority == "high";
+  request.profile = line.substr(priorityEnd + 1, profileEnd - priorityEnd - 1);
+  std::string path = line.substr(profileEnd + 1);
+  request.path = FromUtf8(path.data(), static_cast<int>(path.size()));
+
+  std::string error;
+  uint64_t id = onSubmit_ ? onSubmit_(request, error) : 0;
+  if (id == 0)
+    return "REJECTED " + (error.empty() ? "unavailable" : error) + " " +
+           path + "\n";
+  return "QUEUED " + std::to_string(id) + " " + path + "\n";
+}
+
+bool JobServer::Send(Client &client, const std::string &text) {
+  std::lock_guard<std::mutex> lock(client.writeMutex);
+  if (client.broken)
+    return false;
+
+  OVERLAPPED ov = {};
+  ov.hEvent = client.writeEvent.get();
+  DWORD written = 0;
+  if (!::WriteFile(client.pipe.get(), text.data(),
+                   static_cast<DWORD>(text.size()), nullptr, &ov) &&
+      ::GetLastError() != ERROR_IO_PENDING) {
+    client.broken = true;
+    return false;
+  }
+  if (::WaitForSingleObject(ov.hEvent, kWriteTimeoutMs) != WAIT_OBJECT_0) {
+    LogMsg(L"JobServer: client %llu is not reading, dropping it",
+           static_cast<unsigned long long>(client.id));
+    // Cancels the client thread's pending read too, so it disconnects
+    ::CancelIoEx(client.pipe.get(), nullptr);
+    ::GetOverlappedResult(client.pipe.get(), &ov, &written, TRUE);
+    client.broken = true;
+    return false;
+  }
+  if (!::GetOverlappedResult(client.pipe.get(), &ov, &written, FALSE) ||
+      written != text.size()) {
+    client.broken = true;
+    return false;
+  }
+  return true;
+}
+
+void JobServer::SendDone(uint64_t clientId, uint64_t jobId, bool ok,
+                         const std::wstring &path) {
+  std::shared_ptr<Client> client;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = clients_.find(clientId);
+    if (it == clients_.end())
+      return;
+    client = it->second;
+  }
+  Send(*client, "DONE " + std::to_string(jobId) +
+                    (ok ? " ok " : " failed ") + ToUtf8(path) + "\n");
+}
+
+} // namespace jxr
@@ -0,0 +1,93 @@
+#pragma once
+#include "Utils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+
+namespace jxr {
+
+/// Local job-submission endpoint: a named pipe (\\.\pipe\JxrAutoCleaner)
+/// that capture tools and scripts use to queue conversions without waiting
+/// for the watcher, and to learn when each one finishes.
+///
+/// The protocol is UTF-8 text, one command per '\n'-terminated line. A
+/// client may write any number of lines at once (a batch); the replies to a
+/// batch come back in one write.
+///
+///   SUBMIT <high|normal> <profile> <path>  →  QUEUED <id> <path>
+///                                           or REJECTED <reason> <path>
+///   PING                                   →  PONG
+///   STATS                                  →  STATS <key>=<value> ...
+///   anything else                          →  ERROR <reason>
+///
+/// and later, for every queued job, on the same connection:
+///
+///   DONE <id> <ok|failed> <path>
+///
+/// The pipe only accepts local clients running as the current user.
+class JobServer {
+public:
+  struct Request {
+    uint64_t clientId = 0;
+    bool highPriority = false;
+    std::string profile;
+    std::wstring path;
+  };
+
+  /// Queues a request. Returns its job id, or 0 with `error` set (one word,
+  /// sent back in the REJECTED line).
+  using SubmitFn = std::function<uint64_t(const Request &, std::string &error)>;
+
+  /// Current service counters as space-separated key=value pairs.
+  using StatsFn = std::function<std::string()>;
+
+  JobServer();
+  ~JobServer();
+  JobServer(const JobServer &) = delete;
+  JobServer &operator=(const JobServer &) = delete;
+
+  /// Creates the pipe and starts listening on a background thread. Fails if
+  /// another process already owns the name.
+  bool Start(const std::wstring &pipeName, SubmitFn onSubmit,
+             StatsFn onStats = nullptr);
+
+  /// Disconnects every client and joins the threads. Idempotent.
+  void Stop();
+
+  /// Reports a finished job to the client that submitted it. Safe from any
+  /// thread; dropped if the client has gone.
+  void SendDone(uint64_t clientId, uint64_t jobId, bool ok,
+                const std::wstring &path);
+
+private:
+  struct Client;
+
+  void ListenLoop(UniqueHandle pipe);
+  void ClientLoop(std::shared_ptr<Client> client);
+  std::string HandleLine(Client &client, const std::string &line);
+  bool Send(Client &client, const std::string &text);
+  void ReapClients();
+
+  std::wstring pipeName_;
+  SubmitFn onSubmit_;
+  StatsFn onStats_;
+  PSECURITY_DESCRIPTOR security_ = nullptr; // current user + SYSTEM only
+  UniqueHandle stop_; // manual-reset; wakes every pipe thread
+  std::thread listener_;
+  std::atomic<uint64_t> nextClientId_{1};
+
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, std::shared_ptr<Client>> clients_;
+  std::unordered_map<uint64_t, std::thread> threads_; // one per client
+  std::vector<uint64_t> finished_; // client threads ready to join
+};
+
+} // namespace jxr
@@ -0,0 +1,206 @@
+#include "Journal.h"
+#include "Utils.h"
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace jxr {
+
+// Truncate the journal once nothing is in flight and it has grown past this
+static constexpr LONGLONG kCompactThresholdBytes = 64 * 1024;
+
+// ============================================================================
+// Open / close
+// ============================================================================
+ConversionJournal::~ConversionJournal() {
+  if (file_ != INVALID_HANDLE_VALUE)
+    ::CloseHandle(file_);
+}
+
+bool ConversionJournal::Open(const std::wstring &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  // Write access rather than append-only, so the journal can be truncated
+  // in place; records still go at the end, as this is the only writer
+  file_ = ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                        FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LogMsg(L"Journal: failed to open %s, error %u", path.c_str(),
+           ::GetLastError());
+    return false;
+  }
+  LARGE_INTEGER zero = {};
+  ::SetFilePointerEx(file_, zero, nullptr, FILE_END);
+  return true;
+}
+
+// Drops every record but keeps the handle, so a failure leaves the journal
+// as it was rather than closed (mutex_ held)
+bool ConversionJournal::Truncate() {
+  LARGE_INTEGER zero = {};
+  if (!::SetFilePointerEx(file_, zero, nullptr, FILE_BEGIN) ||
+      !::SetEndOfFile(file_)) {
+    LogMsg(L"Journal: truncating %s failed, error %u", path_.c_str(),
+           ::GetLastError());
+    ::SetFilePointerEx(file_, zero, nullptr, FILE_END);
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Appending records
+// ============================================================================
+void ConversionJournal::Record(State state, const std::wstring &jxrPath) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == INVALID_HANDLE_VALUE)
+    return;
+
+  std::string line;
+  line += static_cast<char>(state);
+  line += ' ';
+  line += ToUtf8(jxrPath);
+  line += '\n';
+
+  DWORD written = 0;
+  if (!::WriteFile(file_, line.data(), static_cast<DWORD>(line.size()),
+                   &written, nullptr)) {
+    LogMsg(L"Journal: write failed, error %u", ::GetLastError());
+    return;
+  }
+  // Only Begin must reach the disk before the step it guards (creating the
+  // temp file): without it Recover could not find a partial temp. A later
+  // record lost in a crash only sends Recover back to an earlier state, and
+  // every state's handling stays safe (at worst the source is converted
+  // again), so those are not flushed.
+  if (state == State::Begin)
+    ::FlushFileBuffers(file_);
+
+  if (state == State::Begin) {
+    ++inFlight_;
+  } else if (state == State::Done) {
+    --inFlight_;
+    CompactIfIdle();
+  }
+}
+
+void ConversionJournal::CompactIfIdle() {
+  if (inFlight_ != 0)
+    return;
+  LARGE_INTEGER size = {};
+  if (!::GetFileSizeEx(file_, &size) ||
+      size.QuadPart < kCompactThresholdBytes)
+    return;
+  // Every entry is finished, so the whole history can go
+  Truncate();
+}
+
+// ============================================================================
+// Crash recovery
+// ============================================================================
+void ConversionJournal::Recover(
+    const std::function<void(const std::wstring &)> &requeue) {
+  std::unordered_map<std::wstring, State> last;
+  std::vector<std::wstring> order; // preserve first-seen order for requeue
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (file_ == INVALID_HANDLE_VALUE)
+      return;
+
+    LARGE_INTEGER size = {};
+    ::GetFileSizeEx(file_, &size);
+    if (size.QuadPart == 0)
+      return;
+
+    std::vector<char> data(static_cast<size_t>(size.QuadPart));
+    LARGE_INTEGER zero = {};
+    ::SetFilePointerEx(file_, zero, nullptr, FILE_BEGIN);
+    DWORD read = 0;
+    if (!::ReadFile(file_, data.data(), static_cast<DWORD>(data.size()), &read,
+                    nullptr)) {
+      LogMsg(L"Journal: read failed, error %u", ::GetLastError());
+      return;
+    }
+
+    size_t pos = 0;
+    while (pos < read) {
+      size_t end = pos;
+      while (end < read && data[end] != '\n')
+        ++end;
+      // A torn final line (crash mid-append) has no newline; ignore it
+      if (end < read && end - pos > 2 && data[pos + 1] == ' ') {
+        std::wstring path = FromUtf8(data.data() + pos + 2,
+                                     static_cast<int>(end - pos - 2));
+        auto it = last.find(path);
+        if (it == last.end())
+          order.push_back(path);
+        last[path] = static_cast<State>(data[pos]);
+      }
+      pos = end + 1;
+    }
+  }
+
+  int resumed = 0, rolledBack = 0;
+  for (const auto &source : order) {
+    State state = last[source];
+    if (state == State::Done)
+      continue;
+
+    fs::path inputPath(source);
+    fs::path tempPath = inputPath;
+    tempPath.replace_extension(L".tmp.jpg");
+    fs::path finalPath = inputPath;
+    finalPath.replace_extension(L".jpg");
+
+    std::error_code ec;
+    bool haveOriginal = fs::exists(inputPath, ec);
+    bool haveTemp = fs::exists(tempPath, ec);
+
+    bool pastWrite = state == State::TempWritten || state == State::Renamed ||
+                     state == State::OriginalRemoved;
+
+    if (pastWrite && !haveTemp && haveOriginal && fs::exists(finalPath, ec)) {
+      // Renamed but the source delete never happened: finish it
+      fs::remove(inputPath, ec);
+      if (ec) {
+        LogMsg(L"Journal: could not remove converted source %s: %hs",
+               source.c_str(), ec.message().c_str());
+      } else {
+        LogMsg(L"Journal: resumed interrupted conversion: %s",
+               finalPath.wstring().c_str());
+        ++resumed;
+      }
+      continue;
+    }
+
+    // Otherwise discard the (possibly partial) temp and convert the
+    // original again from scratch
+    if (haveTemp) {
+      fs::remove(tempPath, ec);
+      LogMsg(L"Journal: removed partial temp file: %s",
+             tempPath.wstring().c_str());
+    }
+    if (haveOriginal) {
+      requeue(source);
+      ++rolledBack;
+    }
+  }
+
+  if (resumed || rolledBack) {
+    LogMsg(L"Journal: recovery resumed %d, rolled back %d conversion(s)",
+           resumed, rolledBack);
+  }
+
+  // Everything is settled; start a fresh journal
+  std::lock_guard<std::mutex> lock(mutex_);
+  Truncate();
+  inFlight_ = 0;
+}
+
+} // namespace jxr
@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <string>
+#include <windows.h>
+
+namespace jxr {
+
+/// Append-only write-ahead journal for the temp-write → rename → delete
+/// sequence of each conversion. After a crash, Recover() only touches the
+/// files named by unfinished entries instead of sweeping the whole tree.
+///
+/// One line per record: "<state> <full .jxr path>" (UTF-8).
+class ConversionJournal {
+public:
+  enum class State : char {
+    Begin = 'B',           // conversion started, temp may be partial
+    TempWritten = 'T',     // "<name>.tmp.jpg" fully written and flushed
+    Renamed = 'N',         // temp renamed to "<name>.jpg", source still there
+    OriginalRemoved = 'R', // source .jxr deleted
+    Done = 'D'             // finished (or abandoned cleanly)
+  };
+
+  ConversionJournal() = default;
+  ~ConversionJournal();
+  ConversionJournal(const ConversionJournal &) = delete;
+  ConversionJournal &operator=(const ConversionJournal &) = delete;
+
+  /// Opens (creating if needed) the journal file for appending.
+  bool Open(const std::wstring &path);
+
+  /// Replays unfinished entries from a previous run: rolls the source delete
+  /// forward when the output was already renamed into place, otherwise
+  /// rolls back by deleting the temp file and calling `requeue` with the
+  /// source path.
+  /// The journal is truncated afterwards.
+  void Recover(const std::function<void(const std::wstring &)> &requeue);
+
+  /// Appends a record, flushing it for Begin. No-op if the journal is not
+  /// open.
+  void Record(State state, const std::wstring &jxrPath);
+
+private:
+  bool Truncate();
+  void CompactIfIdle();
+
+  std::mutex mutex_;
+  std::wstring path_;
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  int inFlight_ = 0;
+};
+
+} // namespace jxr
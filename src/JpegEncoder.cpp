@@ -0,0 +1,323 @@
+#include "JpegEncoder.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstdio>
+
+// libjpeg-turbo (built by libultrahdr's deps)
+#include <jerror.h>
+#include <jpeglib.h>
+
+namespace jxr {
+
+// ============================================================================
+// libjpeg plumbing: longjmp error manager + std::vector destination manager
+// ============================================================================
+namespace {
+
+struct ErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+void OnJpegError(j_common_ptr cinfo) {
+  auto *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+  std::longjmp(err->jump, 1);
+}
+
+void OnJpegMessage(j_common_ptr) {
+  // Suppress libjpeg warnings on stderr (we have no console)
+}
+
+constexpr size_t kDestChunk = 256 * 1024;
+
+struct VectorDestination {
+  jpeg_destination_mgr pub;
+  std::vector<uint8_t> *buffer;
+};
+
+void InitDestination(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<VectorDestination *>(cinfo->dest);
+  dest->buffer->resize(kDestChunk);
+  dest->pub.next_output_byte = dest->buffer->data();
+  dest->pub.free_in_buffer = dest->buffer->size();
+}
+
+boolean EmptyOutputBuffer(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<VectorDestination *>(cinfo->dest);
+  size_t used = dest->buffer->size();
+  dest->buffer->resize(used * 2);
+  dest->pub.next_output_byte = dest->buffer->data() + used;
+  dest->pub.free_in_buffer = dest->buffer->size() - used;
+  return TRUE;
+}
+
+void TermDestination(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<VectorDestination *>(cinfo->dest);
+  dest->buffer->resize(dest->buffer->size() - dest->pub.free_in_buffer);
+}
+
+} // namespace
+
+struct JpegEncoder::State {
+  jpeg_compress_struct cinfo = {};
+  ErrorManager err = {};
+  VectorDestination dest = {};
+  std::vector<uint8_t> output;
+  bool created = false;
+  bool started = false;
+};
+
+JpegEncoder::JpegEncoder() : state_(new State) {}
+
+JpegEncoder::~JpegEncoder() {
+  if (state_->created)
+    jpeg_destroy_compress(&state_->cinfo);
+  delete state_;
+}
+
+// ============================================================================
+// Encoder lifecycle
+// ============================================================================
+bool JpegEncoder::Begin(uint32_t width, uint32_t height, JpegInputFormat format,
+                        int quality, bool optimizeHuffman) {
+  State &s = *state_;
+  s.cinfo.err = jpeg_std_error(&s.err.pub);
+  s.err.pub.error_exit = OnJpegError;
+  s.err.pub.output_message = OnJpegMessage;
+
+  if (setjmp(s.err.jump)) {
+    char msg[JMSG_LENGTH_MAX];
+    s.err.pub.format_message(reinterpret_cast<j_common_ptr>(&s.cinfo), msg);
+    LogMsg(L"libjpeg-turbo: encoder setup failed: %hs", msg);
+    return false;
+  }
+
+  jpeg_create_compress(&s.cinfo);
+  s.created = true;
+
+  s.dest.pub.init_destination = InitDestination;
+  s.dest.pub.empty_output_buffer = EmptyOutputBuffer;
+  s.dest.pub.term_destination = TermDestination;
+  s.dest.buffer = &s.output;
+  s.cinfo.dest = &s.dest.pub;
+
+  s.cinfo.image_width = width;
+  s.cinfo.image_height = height;
+  if (format == JpegInputFormat::BGRX32) {
+    s.cinfo.input_components = 4;
+    s.cinfo.in_color_space = JCS_EXT_BGRX;
+  } else if (format == JpegInputFormat::RGBX32) {
+    s.cinfo.input_components = 4;
+    s.cinfo.in_color_space = JCS_EXT_RGBX;
+  } else {
+    s.cinfo.input_components = 3;
+    s.cinfo.in_color_space = JCS_EXT_BGR;
+  }
+
+  jpeg_set_defaults(&s.cinfo);
+  jpeg_set_quality(&s.cinfo, quality, TRUE);
+  s.cinfo.optimize_coding = optimizeHuffman ? TRUE : FALSE;
+  // Integer slow DCT matches WIC's output closely; fast DCT costs quality.
+  s.cinfo.dct_method = JDCT_ISLOW;
+
+  jpeg_start_compress(&s.cinfo, TRUE);
+  s.started = true;
+  return true;
+}
+
+bool JpegEncoder::WriteRows(const uint8_t *rows, size_t stride,
+                            uint32_t rowCount) {
+  State &s = *state_;
+  if (!s.started)
+    return false;
+
+  if (setjmp(s.err.jump)) {
+    char msg[JMSG_LENGTH_MAX];
+    s.err.pub.format_message(reinterpret_cast<j_common_ptr>(&s.cinfo), msg);
+    LogMsg(L"libjpeg-turbo: write failed: %hs", msg);
+    jpeg_abort_compress(&s.cinfo);
+    s.started = false;
+    return false;
+  }
+
+  // libjpeg wants an array of row pointers; feed in small batches so the
+  // pointer array stays on the stack.
+  constexpr uint32_t kBatch = 16;
+  JSAMPROW rowPtrs[kBatch];
+  uint32_t done = 0;
+  while (done < rowCount) {
+    uint32_t n = rowCount - done < kBatch ? rowCount - done : kBatch;
+    for (uint32_t i = 0; i < n; ++i)
+      rowPtrs[i] = const_cast<JSAMPROW>(rows + (done + i) * stride);
+    done += jpeg_write_scanlines(&s.cinfo, rowPtrs, n);
+  }
+  return true;
+}
+
+bool JpegEncoder::Finish(std::vector<uint8_t> &out) {
+  State &s = *state_;
+  if (!s.started)
+    return false;
+
+  if (setjmp(s.err.jump)) {
+    char msg[JMSG_LENGTH_MAX];
+    s.err.pub.format_message(reinterpret_cast<j_common_ptr>(&s.cinfo), msg);
+    LogMsg(L"libjpeg-turbo: finish failed: %hs", msg);
+    jpeg_abort_compress(&s.cinfo);
+    s.started = false;
+    return false;
+  }
+
+  jpeg_finish_compress(&s.cinfo);
+  s.started = false;
+  out = std::move(s.output);
+  s.output.clear();
+  return true;
+}
+
+// ============================================================================
+// One-shot helper
+// ============================================================================
+bool EncodeJpeg(const uint8_t *pixels, uint32_t width, uint32_t height,
+                size_t stride, JpegInputFormat format, int quality,
+                bool optimizeHuffman, std::vector<uint8_t> &out,
+                const CancelToken &cancel) {
+  constexpr uint32_t kStripRows = 256;
+  JpegEncoder encoder;
+  if (!encoder.Begin(width, height, format, quality, optimizeHuffman))
+    return false;
+  for (uint32_t y = 0; y < height; y += kStripRows) {
+    if (cancel.IsCancelled())
+      return false;
+    uint32_t rows = height - y < kStripRows ? height - y : kStripRows;
+    if (!encoder.WriteRows(pixels + y * stride, stride, rows))
+      return false;
+  }
+  return encoder.Finish(out);
+}
+
+// ============================================================================
+// Sliced encode: independent slices joined with restart markers
+// ============================================================================
+namespace {
+
+constexpr uint32_t kMcuRows = 16;           // 4:2:0 from jpeg_set_defaults
+constexpr uint32_t kMinSliceRows = 128;     // less is not worth a task
+constexpr uint32_t kMaxRestartMcus = 65535; // DRI holds 16 bits
+
+struct SliceLayout {
+  size_t sofHeight = 0; // offset of the 16-bit frame height in SOF
+  size_t scanStart = 0; // offset of the SOS marker
+  size_t dataStart = 0; // first byte after the SOS segment
+  size_t dataEnd = 0;   // offset of the closing EOI
+};
+
+// Walks the marker segments up to SOS. libjpeg writes exactly one frame
+// and one scan, and ends the stream with EOI.
+bool ParseSlice(const std::vector<uint8_t> &jpeg, SliceLayout &layout) {
+  const size_t n = jpeg.size();
+  if (n < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8 || jpeg[n - 2] != 0xFF ||
+      jpeg[n - 1] != 0xD9)
+    return false;
+  size_t pos = 2;
+  while (pos + 4 <= n && jpeg[pos] == 0xFF) {
+    const uint8_t marker = jpeg[pos + 1];
+    const size_t length = (static_cast<size_t>(jpeg[pos + 2]) << 8) |
+                          jpeg[pos + 3];
+    if (length < 2 || pos + 2 + length > n)
+      return false;
+    if (marker == 0xC0 || marker == 0xC1)
+      layout.sofHeight = pos + 5;
+    if (marker == 0xDA) {
+      layout.scanStart = pos;
+      layout.dataStart = pos + 2 + length;
+      layout.dataEnd = n - 2;
+      return layout.sofHeight != 0;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+} // namespace
+
+bool EncodeJpegSliced(const uint8_t *pixels, uint32_t width, uint32_t height,
+                      size_t stride, JpegInputFormat format, int quality,
+                      std::vector<uint8_t> &out, const CancelToken &cancel,
+                      uint32_t slices) {
+  // One slice per thread (the caller included) by default, in whole MCU
+  // rows, and no more MCUs per slice than a restart interval can count
+  const uint32_t mcusPerRow = (width + kMcuRows - 1) / kMcuRows;
+  const uint32_t mcuRows = (height + kMcuRows - 1) / kMcuRows;
+  if (slices == 0)
+    slices = ThreadPool::Shared().size() + 1;
+  uint32_t sliceMcuRows = std::max((mcuRows + slices - 1) / slices,
+                                   kMinSliceRows / kMcuRows);
+  sliceMcuRows = std::min(sliceMcuRows, kMaxRestartMcus / mcusPerRow);
+  if (sliceMcuRows == 0 || sliceMcuRows >= mcuRows)
+    return EncodeJpeg(pixels, width, height, stride, format, quality, false,
+                      out, cancel);
+
+  const uint32_t sliceRows = sliceMcuRows * kMcuRows;
+  const size_t sliceCount = (height + sliceRows - 1) / sliceRows;
+  std::vector<std::vector<uint8_t>> parts(sliceCount);
+  std::atomic<bool> failed{false};
+  ThreadPool::Shared().ParallelFor(
+      sliceCount, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end && !failed; ++i) {
+          const uint32_t y = static_cast<uint32_t>(i) * sliceRows;
+          const uint32_t rows = std::min(sliceRows, height - y);
+          if (!EncodeJpeg(pixels + y * stride, width, rows, stride, format,
+                          quality, false, parts[i], cancel))
+            failed = true;
+        }
+      });
+  if (failed)
+    return false;
+
+  // Slice 0's header with the full height and a DRI before SOS, then every
+  // slice's entropy-coded data, RST0..RST7 in turn between them
+  std::vector<SliceLayout> layouts(sliceCount);
+  size_t total = 6 + 2; // DRI + EOI
+  for (size_t i = 0; i < sliceCount; ++i) {
+    if (!ParseSlice(parts[i], layouts[i])) {
+      LogMsg(L"libjpeg-turbo: unexpected slice layout");
+      return false;
+    }
+    total += 2 + layouts[i].dataEnd - layouts[i].dataStart;
+  }
+  const std::vector<uint8_t> &first = parts[0];
+  const SliceLayout &head = layouts[0];
+  total += head.dataStart;
+
+  out.clear();
+  out.reserve(total);
+  out.insert(out.end(), first.begin(), first.begin() + head.scanStart);
+  out[head.sofHeight] = static_cast<uint8_t>(height >> 8);
+  out[head.sofHeight + 1] = static_cast<uint8_t>(height);
+  const uint32_t interval = sliceMcuRows * mcusPerRow;
+  const uint8_t dri[6] = {0xFF, 0xDD, 0x00, 0x04,
+                          static_cast<uint8_t>(interval >> 8),
+                          static_cast<uint8_t>(interval)};
+  out.insert(out.end(), dri, dri + 6);
+  out.insert(out.end(), first.begin() + head.scanStart,
+             first.begin() + head.dataStart);
+  for (size_t i = 0; i < sliceCount; ++i) {
+    if (i > 0) {
+      out.push_back(0xFF);
+      out.push_back(static_cast<uint8_t>(0xD0 + (i - 1) % 8));
+    }
+    out.insert(out.end(), parts[i].begin() + layouts[i].dataStart,
+               parts[i].begin() + layouts[i].dataEnd);
+    parts[i] = {};
+  }
+  out.push_back(0xFF);
+  out.push_back(0xD9);
+  return true;
+}
+
+} // namespace jxr
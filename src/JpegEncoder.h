@@ -0,0 +1,64 @@
+#pragma once
+#include "Cancellation.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace jxr {
+
+/// Layout of the rows fed to the JPEG encoder.
+enum class JpegInputFormat {
+  BGR24,  // 3 bytes per pixel, B,G,R
+  BGRX32, // 4 bytes per pixel, B,G,R,(ignored)
+  RGBX32  // 4 bytes per pixel, R,G,B,(ignored)
+};
+
+/// Streaming baseline JPEG encoder on top of libjpeg-turbo's SIMD path.
+/// Rows are handed to libjpeg-turbo as-is (it accepts BGR/BGRX natively),
+/// so no intermediate colour conversion or full-frame buffer is needed.
+///
+/// Usage: Begin() → WriteRows() until all rows are written → Finish().
+class JpegEncoder {
+public:
+  JpegEncoder();
+  ~JpegEncoder();
+  JpegEncoder(const JpegEncoder &) = delete;
+  JpegEncoder &operator=(const JpegEncoder &) = delete;
+
+  /// optimizeHuffman: compute per-image Huffman tables (smaller output,
+  /// ~10% slower). Returns false on failure (error is logged).
+  bool Begin(uint32_t width, uint32_t height, JpegInputFormat format,
+             int quality, bool optimizeHuffman = false);
+
+  /// Feeds `rowCount` rows, each `stride` bytes apart, starting at `rows`.
+  bool WriteRows(const uint8_t *rows, size_t stride, uint32_t rowCount);
+
+  /// Completes the stream and moves the encoded JPEG into `out`.
+  bool Finish(std::vector<uint8_t> &out);
+
+private:
+  struct State;
+  State *state_ = nullptr;
+};
+
+/// One-shot helper: encodes a whole frame already held in memory. Stops
+/// between row strips, returning false, once `cancel` trips.
+bool EncodeJpeg(const uint8_t *pixels, uint32_t width, uint32_t height,
+                size_t stride, JpegInputFormat format, int quality,
+                bool optimizeHuffman, std::vector<uint8_t> &out,
+                const CancelToken &cancel = CancelToken());
+
+/// Same as EncodeJpeg with standard Huffman tables, but the frame is cut
+/// into horizontal slices on MCU-row boundaries that are encoded
+/// concurrently on the shared thread pool. The slices' entropy-coded data
+/// is joined with RSTn markers under one header whose restart interval is
+/// one slice, so any baseline decoder reads the result as a single image.
+/// `slices` = 0 cuts one slice per pool thread plus the caller. Falls back
+/// to EncodeJpeg when the frame is too small to split.
+bool EncodeJpegSliced(const uint8_t *pixels, uint32_t width, uint32_t height,
+                      size_t stride, JpegInputFormat format, int quality,
+                      std::vector<uint8_t> &out,
+                      const CancelToken &cancel = CancelToken(),
+                      uint32_t slices = 0);
+
+} // namespace jxr
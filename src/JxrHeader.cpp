@@ -0,0 +1,147 @@
+#include "JxrHeader.h"
+
+#include <cstring>
+
+namespace jxr {
+
+// IFD tags (T.832 Table A.4)
+static constexpr uint16_t kTagPixelFormat = 0xBC01;
+static constexpr uint16_t kTagImageWidth = 0xBC80;
+static constexpr uint16_t kTagImageHeight = 0xBC81;
+static constexpr uint16_t kTagImageOffset = 0xBCC0;
+static constexpr uint16_t kTagImageByteCount = 0xBCC1;
+static constexpr uint16_t kTagAlphaOffset = 0xBCC2;
+static constexpr uint16_t kTagAlphaByteCount = 0xBCC3;
+
+// IFD entry types
+static constexpr uint16_t kTypeByte = 1;
+static constexpr uint16_t kTypeShort = 3;
+static constexpr uint16_t kTypeLong = 4;
+
+static constexpr size_t kIfdEntryBytes = 12;
+static const uint8_t kImageSignature[8] = {'W', 'M', 'P', 'H',
+                                           'O', 'T', 'O', 0};
+
+static uint16_t Read16(const uint8_t *p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t Read32(const uint8_t *p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Number value of a SHORT or LONG entry holding one value
+static bool EntryValue(const uint8_t *entry, uint32_t &value) {
+  const uint16_t type = Read16(entry + 2);
+  if (Read32(entry + 4) != 1)
+    return false;
+  if (type == kTypeShort)
+    value = Read16(entry + 8);
+  else if (type == kTypeLong)
+    value = Read32(entry + 8);
+  else
+    return false;
+  return true;
+}
+
+JxrProbe ProbeJxrHeader(const uint8_t *data, size_t size, uint64_t fileSize,
+                        JxrHeaderInfo &info) {
+  info = {};
+  // "II", 0xBC, version; a file still being preallocated reads as zeros
+  if (fileSize < 8)
+    return JxrProbe::Truncated;
+  if (size < 8)
+    return JxrProbe::Unknown;
+  if (Read32(data) == 0)
+    return JxrProbe::Truncated;
+  if (data[0] != 'I' || data[1] != 'I' || data[2] != 0xBC)
+    return JxrProbe::Invalid;
+
+  const uint64_t ifd = Read32(data + 4);
+  if (ifd < 8)
+    return ifd == 0 ? JxrProbe::Truncated : JxrProbe::Invalid;
+  if (ifd + 2 > fileSize)
+    return JxrProbe::Truncated;
+  if (ifd + 2 > size)
+    return JxrProbe::Unknown;
+  const uint16_t count = Read16(data + ifd);
+  const uint64_t ifdEnd = ifd + 2 + count * kIfdEntryBytes;
+  if (ifdEnd > fileSize)
+    return JxrProbe::Truncated;
+  if (ifdEnd > size)
+    return JxrProbe::Unknown;
+
+  bool haveFormat = false;
+  bool haveOffset = false;
+  uint64_t formatOffset = 0;
+  for (uint16_t i = 0; i < count; ++i) {
+    const uint8_t *entry = data + ifd + 2 + i * kIfdEntryBytes;
+    const uint16_t tag = Read16(entry);
+    uint32_t value = 0;
+    switch (tag) {
+    case kTagPixelFormat:
+      // 16 bytes: never inline, the value field is their offset
+      if (Read16(entry + 2) != kTypeByte || Read32(entry + 4) != 16)
+        return JxrProbe::Invalid;
+      formatOffset = Read32(entry + 8);
+      haveFormat = true;
+      break;
+    case kTagImageWidth:
+      if (!EntryValue(entry, info.width))
+        return JxrProbe::Invalid;
+      break;
+    case kTagImageHeight:
+      if (!EntryValue(entry, info.height))
+        return JxrProbe::Invalid;
+      break;
+    case kTagImageOffset:
+      if (!EntryValue(entry, value))
+        return JxrProbe::Invalid;
+      info.imageOffset = value;
+      haveOffset = true;
+      break;
+    case kTagImageByteCount:
+      if (!EntryValue(entry, value))
+        return JxrProbe::Invalid;
+      info.imageBytes = value;
+      break;
+    case kTagAlphaOffset:
+      if (!EntryValue(entry, value))
+        return JxrProbe::Invalid;
+      info.alphaOffset = value;
+      break;
+    case kTagAlphaByteCount:
+      if (!EntryValue(entry, value))
+        return JxrProbe::Invalid;
+      info.alphaBytes = value;
+      break;
+    default:
+      break; // metadata, resolution, ...
+    }
+  }
+  if (!haveFormat || !haveOffset || info.width == 0 || info.height == 0)
+    return JxrProbe::Invalid;
+
+  // Encoders patch the byte counts in once the planes are written
+  if (info.imageBytes == 0 || (info.alphaOffset != 0 && info.alphaBytes == 0))
+    return JxrProbe::Truncated;
+  info.endOffset = info.imageOffset + info.imageBytes;
+  if (info.alphaOffset != 0 &&
+      info.alphaOffset + info.alphaBytes > info.endOffset)
+    info.endOffset = info.alphaOffset + info.alphaBytes;
+
+  if (formatOffset + 16 > fileSize || info.imageOffset + 8 > fileSize)
+    return JxrProbe::Truncated;
+  if (formatOffset + 16 > size)
+    return JxrProbe::Unknown;
+  std::memcpy(info.pixelFormat, data + formatOffset, 16);
+  if (info.imageOffset + 8 <= size &&
+      std::memcmp(data + info.imageOffset, kImageSignature, 8) != 0)
+    return JxrProbe::Invalid;
+
+  return info.endOffset > fileSize ? JxrProbe::Truncated : JxrProbe::Complete;
+}
+
+} // namespace jxr
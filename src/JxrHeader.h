@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace jxr {
+
+/// What the JPEG XR container header says about a file.
+struct JxrHeaderInfo {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint8_t pixelFormat[16] = {}; // the WIC pixel format GUID, as stored
+  uint64_t imageOffset = 0;     // coded image plane
+  uint64_t imageBytes = 0;
+  uint64_t alphaOffset = 0;     // separate alpha plane, if any
+  uint64_t alphaBytes = 0;
+  uint64_t endOffset = 0;       // end of the last plane
+};
+
+enum class JxrProbe {
+  Complete,  // header valid and every plane within the file
+  Truncated, // valid so far, but a plane ends past the end of the file,
+             // or the writer has not filled the header in yet
+  Invalid,   // not a JPEG XR container
+  Unknown    // the header points past the bytes given; decode to find out
+};
+
+/// Checks the JPEG XR container (ITU-T T.832 Annex A: a little-endian TIFF
+/// header and the first IFD) without starting a decoder. `data` holds the
+/// first `size` bytes of a file of `fileSize` bytes — all of it, or just a
+/// prefix read from disk. Fills `info` when the result is Complete or
+/// Truncated. Standard C++ only.
+JxrProbe ProbeJxrHeader(const uint8_t *data, size_t size, uint64_t fileSize,
+                        JxrHeaderInfo &info);
+
+} // namespace jxr
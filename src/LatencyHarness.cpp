@@ -0,0 +1,238 @@
+#include "LatencyHarness.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <windows.h>
+
+namespace jxr {
+
+static constexpr int kCaptureChunks = 16; // writes per simulated capture
+static constexpr size_t kVideoChunkBytes = 1024 * 1024;
+static constexpr uint64_t kVideoSegmentBytes = 256ull * 1024 * 1024;
+
+static double MsBetween(std::chrono::steady_clock::time_point from,
+                        std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Nearest-rank percentile of sorted values
+static double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static bool ReadWholeFile(const std::wstring &path, std::string &out) {
+  UniqueHandle file = MakeUniqueHandle(
+      ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+  LARGE_INTEGER size = {};
+  if (!file || !::GetFileSizeEx(file.get(), &size) || size.QuadPart == 0 ||
+      size.QuadPart > MAXDWORD)
+    return false;
+  out.resize(static_cast<size_t>(size.QuadPart));
+  DWORD read = 0;
+  return ::ReadFile(file.get(), &out[0], static_cast<DWORD>(out.size()), &read,
+                    nullptr) &&
+         read == out.size();
+}
+
+// ============================================================================
+// Capture writer: create, chunked writes held open deny-write, close
+// ============================================================================
+bool CaptureSimulator::WriteCapture(const std::wstring &path) {
+  {
+    // Known before it exists, so an early report cannot be missed
+    std::lock_guard<std::mutex> lock(mutex_);
+    captures_[ToLowerPath(path)] = Capture();
+    ++written_;
+  }
+
+  // Only FILE_SHARE_READ: the worker's deny-write probe fails until close,
+  // as it does against ShadowPlay
+  UniqueHandle file = MakeUniqueHandle(
+      ::CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                    CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr));
+  if (!file) {
+    LogMsg(L"Latency: cannot create %s, error %u", path.c_str(),
+           ::GetLastError());
+    return false;
+  }
+  const size_t chunk = (sample_.size() + kCaptureChunks - 1) / kCaptureChunks;
+  const DWORD pauseMs = static_cast<DWORD>(options_.writeMs / kCaptureChunks);
+  for (size_t offset = 0; offset < sample_.size(); offset += chunk) {
+    DWORD n = static_cast<DWORD>(std::min(chunk, sample_.size() - offset));
+    DWORD written = 0;
+    if (!::WriteFile(file.get(), sample_.data() + offset, n, &written,
+                     nullptr) ||
+        written != n) {
+      LogMsg(L"Latency: write failed on %s, error %u", path.c_str(),
+             ::GetLastError());
+      return false;
+    }
+    ::Sleep(pauseMs);
+  }
+  file.reset();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  captures_[ToLowerPath(path)].closed = Clock::now();
+  return true;
+}
+
+// ============================================================================
+// Video storm: a recording appended in 1 MB chunks at a fixed rate, rolled
+// over into a new segment (and the old one deleted) every 256 MB, so the
+// watcher sees the churn of an encoder running next to the captures
+// ============================================================================
+void CaptureSimulator::VideoStorm() {
+  std::vector<char> chunk(kVideoChunkBytes, '\0');
+  const double bytesPerMs = options_.videoMBps * 1024.0 * 1024.0 / 1000.0;
+  const double chunkMs = kVideoChunkBytes / bytesPerMs;
+  int segment = 0;
+  std::wstring previous;
+  while (!stopVideo_) {
+    wchar_t name[32];
+    swprintf_s(name, L"\\video_%03d.mp4", segment++);
+    std::wstring path = options_.dir + name;
+    UniqueHandle file = MakeUniqueHandle(
+        ::CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file) {
+      LogMsg(L"Latency: cannot create %s, error %u", path.c_str(),
+             ::GetLastError());
+      return;
+    }
+    if (!previous.empty())
+      ::DeleteFileW(previous.c_str());
+
+    auto next = Clock::now();
+    for (uint64_t bytes = 0; bytes < kVideoSegmentBytes && !stopVideo_;
+         bytes += kVideoChunkBytes) {
+      DWORD written = 0;
+      if (!::WriteFile(file.get(), chunk.data(),
+                       static_cast<DWORD>(chunk.size()), &written, nullptr))
+        return;
+      videoBytes_ += written;
+      next += std::chrono::microseconds(static_cast<int64_t>(chunkMs * 1000));
+      std::this_thread::sleep_until(next);
+    }
+    file.reset();
+    previous = std::move(path);
+  }
+  if (!previous.empty())
+    ::DeleteFileW(previous.c_str());
+}
+
+// ============================================================================
+// Bursts
+// ============================================================================
+bool CaptureSimulator::Run(const Options &options) {
+  options_ = options;
+  if (!ReadWholeFile(options_.sampleJxr, sample_)) {
+    LogMsg(L"Latency: cannot read sample %s", options_.sampleJxr.c_str());
+    return false;
+  }
+
+  start_ = Clock::now();
+  std::thread video;
+  if (options_.videoMBps > 0)
+    video = std::thread(&CaptureSimulator::VideoStorm, this);
+
+  bool ok = true;
+  for (int burst = 0; burst < options_.bursts && ok; ++burst) {
+    auto burstStart = Clock::now();
+    for (int i = 0; i < options_.filesPerBurst && ok; ++i) {
+      wchar_t name[48];
+      swprintf_s(name, L"\\capture_%03d_%03d.jxr", burst, i);
+      ok = WriteCapture(options_.dir + name);
+    }
+    std::this_thread::sleep_until(
+        burstStart + std::chrono::milliseconds(options_.burstIntervalMs));
+  }
+
+  stopVideo_ = true;
+  if (video.joinable())
+    video.join();
+  return ok;
+}
+
+// ============================================================================
+// Completion reports
+// ============================================================================
+void CaptureSimulator::OnFinished(const std::wstring &path, bool ok) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = captures_.find(ToLowerPath(path));
+  if (it == captures_.end() || it->second.done)
+    return;
+  it->second.done = true;
+  it->second.ok = ok;
+  it->second.finished = Clock::now();
+  if (++reported_ == written_)
+    allDone_.notify_all();
+}
+
+bool CaptureSimulator::WaitForAll(uint32_t timeoutMs) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return allDone_.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                           [this] { return reported_ == written_; });
+}
+
+std::string CaptureSimulator::ReportJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<double> latencies;
+  size_t failed = 0, dropped = 0;
+  Clock::time_point lastFinished = start_;
+  for (const auto &entry : captures_) {
+    const Capture &c = entry.second;
+    if (!c.done) {
+      ++dropped; // never came out of the watcher → queue → worker path
+      continue;
+    }
+    if (!c.ok) {
+      ++failed;
+      continue;
+    }
+    latencies.push_back(std::max(0.0, MsBetween(c.closed, c.finished)));
+    lastFinished = std::max(lastFinished, c.finished);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  double mean = 0.0;
+  for (double ms : latencies)
+    mean += ms;
+  if (!latencies.empty())
+    mean /= latencies.size();
+  const double wallS = MsBetween(start_, lastFinished) / 1000.0;
+
+  char json[1024];
+  snprintf(json, sizeof(json),
+           "{\n"
+           "  \"captures\": %zu,\n"
+           "  \"converted\": %zu,\n"
+           "  \"failed\": %zu,\n"
+           "  \"dropped\": %zu,\n"
+           "  \"latency_ms\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f, "
+           "\"mean\": %.1f},\n"
+           "  \"throughput_files_per_s\": %.2f,\n"
+           "  \"wall_s\": %.2f,\n"
+           "  \"load\": {\"bursts\": %d, \"files_per_burst\": %d, "
+           "\"burst_interval_ms\": %d, \"write_ms\": %d, \"video_mbps\": %d, "
+           "\"video_bytes\": %llu, \"capture_bytes\": %zu}\n"
+           "}\n",
+           captures_.size(), latencies.size(), failed, dropped,
+           Percentile(latencies, 0.50), Percentile(latencies, 0.99),
+           latencies.empty() ? 0.0 : latencies.back(), mean,
+           wallS > 0 ? latencies.size() / wallS : 0.0, wallS, options_.bursts,
+           options_.filesPerBurst, options_.burstIntervalMs, options_.writeMs,
+           options_.videoMBps,
+           static_cast<unsigned long long>(videoBytes_.load()),
+           sample_.size());
+  return json;
+}
+
+} // namespace jxr
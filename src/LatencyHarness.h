@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace jxr {
+
+/// Simulated ShadowPlay load for measuring how long a new capture takes to
+/// become a JPEG (--latency). Captures are written into a watched directory
+/// in bursts, each held open deny-write while it is written in chunks, as
+/// ShadowPlay does; optionally a video recording is written alongside as a
+/// storm of large appends. The service's own watcher → queue → worker path
+/// does the rest and reports every finished file back here.
+class CaptureSimulator {
+public:
+  struct Options {
+    std::wstring sampleJxr; // content of every simulated capture
+    std::wstring dir;       // watched directory the captures go into
+    int bursts = 5;
+    int filesPerBurst = 8;
+    int burstIntervalMs = 3000; // from the start of one burst to the next
+    int writeMs = 250;          // each capture is written over this long
+    int videoMBps = 40;         // video storm write rate; 0 = none
+  };
+
+  /// Writes every burst (blocking); the video storm runs on its own thread
+  /// until the last capture is closed. Returns false if the sample cannot
+  /// be read or a capture cannot be written.
+  bool Run(const Options &options);
+
+  /// Called for every file the worker is done with. Safe from any thread;
+  /// files this simulator did not write are ignored.
+  void OnFinished(const std::wstring &path, bool ok);
+
+  /// Waits until every capture has been reported, up to `timeoutMs`.
+  bool WaitForAll(uint32_t timeoutMs);
+
+  /// Latency percentiles (capture closed → file done), throughput and
+  /// dropped-file counts as a JSON object.
+  std::string ReportJson() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Capture {
+    Clock::time_point closed;
+    Clock::time_point finished;
+    bool done = false;
+    bool ok = false;
+  };
+
+  bool WriteCapture(const std::wstring &path);
+  void VideoStorm();
+
+  Options options_;
+  std::string sample_;
+  std::atomic<bool> stopVideo_{false};
+  std::atomic<uint64_t> videoBytes_{0};
+  Clock::time_point start_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable allDone_;
+  std::unordered_map<std::wstring, Capture> captures_; // lowercase path
+  size_t written_ = 0;
+  size_t reported_ = 0;
+};
+
+} // namespace jxr
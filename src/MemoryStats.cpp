@@ -0,0 +1,233 @@
+#include "MemoryStats.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <windows.h>
+#include <psapi.h>
+
+namespace jxr {
+
+// ============================================================================
+// Owner table: each live MemoryCounters holds a slot. A block records the
+// slot and its generation, so a free after the owner is gone (a string the
+// job left in a static cache, say) matches nothing and is not charged to
+// freed memory. Constant-initialized, as operator new may run before main.
+// ============================================================================
+static constexpr uint32_t kOwnerSlots = 256; // slot 0 = no owner
+
+struct OwnerSlot {
+  MemoryCounters *counters;
+  uint32_t generation;
+};
+
+static OwnerSlot g_owners[kOwnerSlots];
+static SRWLOCK g_ownersLock = SRWLOCK_INIT;
+
+MemoryCounters::MemoryCounters() {
+  ::AcquireSRWLockExclusive(&g_ownersLock);
+  for (uint32_t i = 1; i < kOwnerSlots; ++i) {
+    if (!g_owners[i].counters) {
+      g_owners[i].counters = this;
+      slot = i;
+      generation = ++g_owners[i].generation;
+      break;
+    }
+  }
+  ::ReleaseSRWLockExclusive(&g_ownersLock);
+  // With every slot taken the job's heap use is simply not counted
+}
+
+MemoryCounters::~MemoryCounters() {
+  if (slot == 0)
+    return;
+  ::AcquireSRWLockExclusive(&g_ownersLock);
+  g_owners[slot].counters = nullptr;
+  ++g_owners[slot].generation;
+  ::ReleaseSRWLockExclusive(&g_ownersLock);
+}
+
+uint64_t CurrentWorkingSet() {
+  PROCESS_MEMORY_COUNTERS pmc = {};
+  pmc.cb = sizeof(pmc);
+  if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return pmc.WorkingSetSize;
+}
+
+void MemoryCounters::SampleWorkingSet() {
+  uint64_t ws = CurrentWorkingSet();
+  if (baseWorkingSet == 0)
+    baseWorkingSet = ws;
+  if (ws > peakWorkingSet)
+    peakWorkingSet = ws;
+}
+
+// ============================================================================
+// Allocation hook: every block from the replaced operators starts with this
+// header, owned or not. 16 bytes keeps malloc's alignment for the caller;
+// aligned blocks put it just below the aligned address.
+// ============================================================================
+struct BlockHeader {
+  uint32_t slot;
+  uint32_t generation;
+  uint64_t size; // as requested
+};
+static_assert(sizeof(BlockHeader) == 16, "header must keep 16-byte alignment");
+static constexpr size_t kHeader = sizeof(BlockHeader);
+
+static void *Charge(void *raw, size_t size) {
+  auto *h = static_cast<BlockHeader *>(raw);
+  h->slot = 0;
+  h->generation = 0;
+  h->size = size;
+  MemoryCounters *c = CurrentMemoryCounters();
+  if (c && c->slot != 0) {
+    h->slot = c->slot;
+    h->generation = c->generation;
+    ++c->allocations;
+    c->bytesAllocated += size;
+    const int64_t live = c->liveBytes += static_cast<int64_t>(size);
+    int64_t peak = c->peakLiveBytes.load(std::memory_order_relaxed);
+    while (live > peak && !c->peakLiveBytes.compare_exchange_weak(peak, live)) {
+    }
+  }
+  return static_cast<uint8_t *>(raw) + kHeader;
+}
+
+// Credits the block's owner, if it is still the one that allocated it, and
+// returns the start of the underlying allocation
+static void *Credit(void *p) {
+  auto *h = reinterpret_cast<BlockHeader *>(static_cast<uint8_t *>(p) -
+                                            kHeader);
+  if (h->slot != 0 && h->slot < kOwnerSlots) {
+    ::AcquireSRWLockShared(&g_ownersLock);
+    const OwnerSlot &owner = g_owners[h->slot];
+    if (owner.counters && owner.generation == h->generation)
+      owner.counters->liveBytes -= static_cast<int64_t>(h->size);
+    ::ReleaseSRWLockShared(&g_ownersLock);
+  }
+  return h;
+}
+
+// `alignment` = 0 for plain new
+static void *Allocate(size_t size, size_t alignment = 0) {
+  if (size == 0)
+    size = 1;
+  if (size > SIZE_MAX - kHeader)
+    return nullptr;
+  while (true) {
+    void *raw = alignment ? ::_aligned_offset_malloc(size + kHeader,
+                                                     alignment, kHeader)
+                          : std::malloc(size + kHeader);
+    if (raw)
+      return Charge(raw, size);
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      return nullptr;
+    handler(); // frees memory or throws
+  }
+}
+
+static void Free(void *p, size_t alignment = 0) noexcept {
+  if (!p)
+    return;
+  void *raw = Credit(p);
+  if (alignment)
+    ::_aligned_free(raw);
+  else
+    std::free(raw);
+}
+
+} // namespace jxr
+
+// Replacements for the global allocation functions, plain and aligned
+void *operator new(size_t size) {
+  if (void *p = jxr::Allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+  if (void *p = jxr::Allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return jxr::Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return jxr::Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new(size_t size, std::align_val_t al) {
+  if (void *p = jxr::Allocate(size, static_cast<size_t>(al)))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t al) {
+  if (void *p = jxr::Allocate(size, static_cast<size_t>(al)))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t al,
+                   const std::nothrow_t &) noexcept {
+  try {
+    return jxr::Allocate(size, static_cast<size_t>(al));
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, std::align_val_t al,
+                     const std::nothrow_t &) noexcept {
+  try {
+    return jxr::Allocate(size, static_cast<size_t>(al));
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *p) noexcept { jxr::Free(p); }
+void operator delete[](void *p) noexcept { jxr::Free(p); }
+void operator delete(void *p, size_t) noexcept { jxr::Free(p); }
+void operator delete[](void *p, size_t) noexcept { jxr::Free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  jxr::Free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  jxr::Free(p);
+}
+void operator delete(void *p, std::align_val_t al) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
+void operator delete[](void *p, std::align_val_t al) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
+void operator delete(void *p, size_t, std::align_val_t al) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
+void operator delete[](void *p, size_t, std::align_val_t al) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
+void operator delete(void *p, std::align_val_t al,
+                     const std::nothrow_t &) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
+void operator delete[](void *p, std::align_val_t al,
+                       const std::nothrow_t &) noexcept {
+  jxr::Free(p, static_cast<size_t>(al));
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace jxr {
+
+/// Memory used by one conversion, from two sources:
+///  - heap: the replaced global operator new/delete (plain and aligned).
+///    A block is charged to the job a MemoryScope names on the thread that
+///    allocates it, and its owner is stored in front of the block, so the
+///    free is credited to that job on whatever thread it happens. Pool
+///    tasks inherit the scope of the thread that submitted them. Not seen:
+///    WIC and libjpeg-turbo (they allocate outside operator new) and
+///    threads libultrahdr starts itself, which have no scope;
+///  - working set: the process working set sampled at stage boundaries,
+///    which sees everything but is shared with whatever else is running.
+struct MemoryCounters {
+  /// Registers the counters as an allocation owner; blocks still owned
+  /// when they are destroyed are freed without being charged.
+  MemoryCounters();
+  ~MemoryCounters();
+  MemoryCounters(const MemoryCounters &) = delete;
+  MemoryCounters &operator=(const MemoryCounters &) = delete;
+
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytesAllocated{0}; // total, not net
+  std::atomic<int64_t> liveBytes{0};       // allocated minus freed
+  std::atomic<int64_t> peakLiveBytes{0};
+  uint64_t baseWorkingSet = 0; // first sample
+  uint64_t peakWorkingSet = 0; // highest sample since
+
+  /// Records the current working set (the first call sets the baseline).
+  void SampleWorkingSet();
+
+  /// Highest sampled working set above the baseline, in bytes.
+  uint64_t WorkingSetGrowth() const {
+    return peakWorkingSet > baseWorkingSet ? peakWorkingSet - baseWorkingSet
+                                           : 0;
+  }
+
+  /// Owner slot and generation stamped into each block (see MemoryStats.cpp)
+  uint32_t slot = 0;
+  uint32_t generation = 0;
+};
+
+/// The counters the calling thread's allocations are charged to, or null.
+inline MemoryCounters *&CurrentMemoryCounters() {
+  static thread_local MemoryCounters *counters = nullptr;
+  return counters;
+}
+
+/// Attributes the calling thread's allocations to `counters` until
+/// destroyed, then restores the previous attribution. Header-only, so the
+/// thread pool can carry a scope into its tasks without linking the hook.
+class MemoryScope {
+public:
+  explicit MemoryScope(MemoryCounters *counters)
+      : previous_(CurrentMemoryCounters()) {
+    CurrentMemoryCounters() = counters;
+  }
+  ~MemoryScope() { CurrentMemoryCounters() = previous_; }
+  MemoryScope(const MemoryScope &) = delete;
+  MemoryScope &operator=(const MemoryScope &) = delete;
+
+private:
+  MemoryCounters *previous_;
+};
+
+/// The process working set in bytes (0 if unavailable).
+uint64_t CurrentWorkingSet();
+
+} // namespace jxr
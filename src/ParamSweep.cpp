@@ -0,0 +1,394 @@
+#include "ParamSweep.h"
+#include "HalfFloat.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+// libultrahdr C API
+#include <ultrahdr_api.h>
+
+namespace fs = std::filesystem;
+
+namespace jxr {
+
+static constexpr float kSdrWhiteNits = 203.0f; // 1.0 in the rescaled frame
+static constexpr size_t kMetricTaskRows = 16;
+
+// ============================================================================
+// HDR error metrics on linear BT.709 frames (half float, 1.0 = 203 nits)
+// ============================================================================
+
+// SMPTE ST 2084 inverse EOTF of every half-float value, 1.0 = 203 nits
+static const float *HalfToPqLut() {
+  static const std::vector<float> lut = [] {
+    constexpr double m1 = 0.1593017578125, m2 = 78.84375;
+    constexpr double c1 = 0.8359375, c2 = 18.8515625, c3 = 18.6875;
+    std::vector<float> t(65536);
+    for (uint32_t h = 0; h < 65536; ++h) {
+      double v = HalfToFloat(static_cast<uint16_t>(h));
+      if (!(v > 0.0))
+        v = 0.0; // negatives and NaN
+      double y = std::pow(std::min(v * kSdrWhiteNits / 10000.0, 1.0), m1);
+      t[h] = static_cast<float>(std::pow((c1 + c2 * y) / (1.0 + c3 * y), m2));
+    }
+    return t;
+  }();
+  return lut.data();
+}
+
+// BT.2100 ICtCp of a linear BT.709 pixel. LMS goes through half float so
+// the PQ curve is a table lookup; both sides of a comparison round alike.
+static void ToIctcp(const float *pq, const float rgb[3], float itp[3]) {
+  static constexpr float kBt709To2020[3][3] = {{0.6274f, 0.3293f, 0.0433f},
+                                               {0.0691f, 0.9195f, 0.0114f},
+                                               {0.0164f, 0.0880f, 0.8956f}};
+  static constexpr float kBt2020ToLms[3][3] = {
+      {1688 / 4096.0f, 2146 / 4096.0f, 262 / 4096.0f},
+      {683 / 4096.0f, 2951 / 4096.0f, 462 / 4096.0f},
+      {99 / 4096.0f, 309 / 4096.0f, 3688 / 4096.0f}};
+  float wide[3], lms[3];
+  for (int i = 0; i < 3; ++i)
+    wide[i] = kBt709To2020[i][0] * rgb[0] + kBt709To2020[i][1] * rgb[1] +
+              kBt709To2020[i][2] * rgb[2];
+  for (int i = 0; i < 3; ++i)
+    lms[i] = pq[FloatToHalf(kBt2020ToLms[i][0] * wide[0] +
+                            kBt2020ToLms[i][1] * wide[1] +
+                            kBt2020ToLms[i][2] * wide[2])];
+  itp[0] = 0.5f * lms[0] + 0.5f * lms[1];
+  // T = Ct / 2, as ΔE ITP weighs it
+  itp[1] = 0.5f * (6610 * lms[0] - 13613 * lms[1] + 7003 * lms[2]) / 4096;
+  itp[2] = (17933 * lms[0] - 17390 * lms[1] - 543 * lms[2]) / 4096;
+}
+
+struct FrameError {
+  double squaredPq = 0.0; // summed over pixels and RGB channels
+  double deltaEItp = 0.0; // summed over pixels
+  uint64_t pixels = 0;
+
+  void Merge(const FrameError &other) {
+    squaredPq += other.squaredPq;
+    deltaEItp += other.deltaEItp;
+    pixels += other.pixels;
+  }
+  double PsnrPq() const {
+    const double mse = pixels ? squaredPq / (3.0 * pixels) : 0.0;
+    return mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : 100.0;
+  }
+  double MeanDeltaE() const { return pixels ? deltaEItp / pixels : 0.0; }
+};
+
+// Both frames RGBA half float; strides in pixels
+static FrameError CompareFrames(const uint16_t *reference, size_t refStride,
+                                const uint16_t *test, size_t testStride,
+                                uint32_t width, uint32_t height) {
+  const float *pq = HalfToPqLut();
+  std::vector<FrameError> partial((height + kMetricTaskRows - 1) /
+                                  kMetricTaskRows);
+  ThreadPool::Shared().ParallelFor(
+      height, kMetricTaskRows, [&](size_t rowBegin, size_t rowEnd) {
+        FrameError &local = partial[rowBegin / kMetricTaskRows];
+        for (size_t y = rowBegin; y < rowEnd; ++y) {
+          const uint16_t *a = reference + y * refStride * 4;
+          const uint16_t *b = test + y * testStride * 4;
+          for (uint32_t x = 0; x < width; ++x, a += 4, b += 4) {
+            float rgbA[3], rgbB[3], itpA[3], itpB[3];
+            for (int c = 0; c < 3; ++c) {
+              const double d = pq[a[c]] - pq[b[c]];
+              local.squaredPq += d * d;
+              rgbA[c] = std::max(HalfToFloat(a[c]), 0.0f);
+              rgbB[c] = std::max(HalfToFloat(b[c]), 0.0f);
+            }
+            ToIctcp(pq, rgbA, itpA);
+            ToIctcp(pq, rgbB, itpB);
+            const float di = itpA[0] - itpB[0];
+            const float dt = itpA[1] - itpB[1];
+            const float dp = itpA[2] - itpB[2];
+            local.deltaEItp += 720.0 * std::sqrt(di * di + dt * dt + dp * dp);
+          }
+          local.pixels += width;
+        }
+      });
+  FrameError total;
+  for (const auto &local : partial)
+    total.Merge(local);
+  return total;
+}
+
+// Decodes an Ultra HDR JPEG with libultrahdr (linear, full boost) and
+// compares the result with the frame it was encoded from
+static bool MeasureReconstruction(const EncodedJpeg &jpeg,
+                                  const std::vector<uint8_t> &reference,
+                                  uint32_t width, uint32_t height,
+                                  FrameError &error) {
+  uhdr_codec_private_t *dec = uhdr_create_decoder();
+  if (!dec) {
+    LogMsg(L"Failed to create uhdr decoder");
+    return false;
+  }
+  uhdr_compressed_image_t img = {};
+  img.data = const_cast<uint8_t *>(jpeg.data());
+  img.data_sz = jpeg.size();
+  img.capacity = jpeg.size();
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+
+  uhdr_error_info_t err = uhdr_dec_set_image(dec, &img);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_64bppRGBAHalfFloat);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_dec_set_out_color_transfer(dec, UHDR_CT_LINEAR);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_decode(dec);
+  if (err.error_code != UHDR_CODEC_OK) {
+    LogMsg(L"uhdr_decode failed: %hs", err.detail);
+    uhdr_release_decoder(dec);
+    return false;
+  }
+
+  uhdr_raw_image_t *decoded = uhdr_get_decoded_image(dec);
+  const bool ok = decoded && decoded->w == width && decoded->h == height;
+  if (ok) {
+    error = CompareFrames(
+        reinterpret_cast<const uint16_t *>(reference.data()), width,
+        static_cast<const uint16_t *>(decoded->planes[UHDR_PLANE_PACKED]),
+        decoded->stride[UHDR_PLANE_PACKED], width, height);
+  } else {
+    LogMsg(L"Sweep: decoded image missing or of the wrong size");
+  }
+  uhdr_release_decoder(dec);
+  return ok;
+}
+
+// ============================================================================
+// Grid, corpus and Pareto frontier
+// ============================================================================
+static std::vector<SweepPoint> ExpandGrid(const SweepGrid &grid) {
+  std::vector<SweepPoint> points;
+  for (int quality : grid.jpegQualities)
+    for (int gainMapQuality : grid.gainMapQualities)
+      for (bool multiChannel : grid.multiChannelGainMap)
+        for (bool bestPreset : grid.bestQualityPreset)
+          for (float peak : grid.targetPeakNits)
+            for (int scale : grid.gainMapScaleFactors)
+              for (bool sliced : grid.slicedBaseEncode) {
+                SweepPoint p;
+                p.jpegQuality = quality;
+                p.tuning.gainMapQuality = gainMapQuality;
+                p.tuning.multiChannelGainMap = multiChannel;
+                p.tuning.bestQualityPreset = bestPreset;
+                p.tuning.targetPeakNits = peak;
+                p.tuning.gainMapScaleFactor = scale;
+                p.slicedBase = sliced;
+                points.push_back(p);
+              }
+  return points;
+}
+
+static std::vector<std::wstring>
+CollectJxrFiles(const std::vector<std::wstring> &inputs) {
+  std::vector<std::wstring> files;
+  for (const auto &input : inputs) {
+    std::error_code ec;
+    if (!fs::is_directory(input, ec)) {
+      if (HasJxrExtension(input))
+        files.push_back(input);
+      continue;
+    }
+    for (fs::recursive_directory_iterator
+             it(input, fs::directory_options::skip_permission_denied, ec),
+         end;
+         it != end; it.increment(ec)) {
+      if (it->is_regular_file(ec) && HasJxrExtension(it->path().wstring()))
+        files.push_back(it->path().wstring());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// Better or equal on encode time, size and PSNR, and strictly better on one
+static bool Dominates(const SweepPoint &a, const SweepPoint &b) {
+  const bool noWorse = a.encodeMs <= b.encodeMs && a.bytes <= b.bytes &&
+                       a.psnrPq >= b.psnrPq;
+  const bool better = a.encodeMs < b.encodeMs || a.bytes < b.bytes ||
+                      a.psnrPq > b.psnrPq;
+  return noWorse && better;
+}
+
+static void MarkParetoFrontier(std::vector<SweepPoint> &points) {
+  for (auto &p : points) {
+    p.pareto = p.frames > 0;
+    for (const auto &q : points) {
+      if (p.pareto && q.frames > 0 && Dominates(q, p))
+        p.pareto = false;
+    }
+  }
+}
+
+// ============================================================================
+// Reports
+// ============================================================================
+static std::string PeakLabel(float nits) {
+  return nits > 0.0f ? std::to_string(static_cast<int>(nits)) : "measured";
+}
+
+static bool WriteCsv(const fs::path &path,
+                     const std::vector<SweepPoint> &points) {
+  std::ofstream out(path, std::ios::binary);
+  out << "jpeg_quality,gain_map_quality,multi_channel,preset,"
+         "target_peak_nits,gain_map_scale,sliced_base,frames,encode_ms,"
+         "bytes,psnr_pq_db,delta_e_itp,pareto\n";
+  for (const auto &p : points) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%d,%d,%d,%s,%s,%d,%d,%d,%.1f,%llu,%.2f,%.3f,%d\n",
+             p.jpegQuality, p.tuning.gainMapQuality,
+             p.tuning.multiChannelGainMap ? 1 : 0,
+             p.tuning.bestQualityPreset ? "best" : "realtime",
+             PeakLabel(p.tuning.targetPeakNits).c_str(),
+             p.tuning.gainMapScaleFactor, p.slicedBase ? 1 : 0, p.frames,
+             p.encodeMs,
+             static_cast<unsigned long long>(p.bytes), p.psnrPq, p.deltaEItp,
+             p.pareto ? 1 : 0);
+    out << line;
+  }
+  return !out.fail();
+}
+
+static bool WriteMarkdown(const fs::path &path,
+                          const std::vector<SweepPoint> &points,
+                          size_t files, size_t frames) {
+  std::vector<SweepPoint> frontier;
+  for (const auto &p : points) {
+    if (p.pareto)
+      frontier.push_back(p);
+  }
+  std::sort(frontier.begin(), frontier.end(),
+            [](const SweepPoint &a, const SweepPoint &b) {
+              return a.bytes < b.bytes;
+            });
+
+  std::ofstream out(path, std::ios::binary);
+  char line[512];
+  out << "# Ultra HDR parameter sweep\n\n";
+  snprintf(line, sizeof(line),
+           "%zu HDR frames from %zu files, %zu settings. Encode time is the "
+           "mean per frame, size the total over all frames. PSNR is over RGB "
+           "in the PQ domain and \xCE\x94" "E ITP is the BT.2124 mean, both "
+           "after decoding with libultrahdr at full boost.\n\n",
+           frames, files, points.size());
+  out << line;
+  snprintf(line, sizeof(line),
+           "## Pareto frontier (encode time / size / PSNR): %zu of %zu\n\n",
+           frontier.size(), points.size());
+  out << line;
+  out << "| Base q | Gain map q | Multi-channel | Preset | Target peak "
+         "| Gain map scale | Sliced base | Encode ms | Size MB | PSNR-PQ dB "
+         "| \xCE\x94" "E ITP |\n"
+         "|---:|---:|:---:|:---:|---:|---:|:---:|---:|---:|---:|---:|\n";
+  for (const auto &p : frontier) {
+    snprintf(line, sizeof(line),
+             "| %d | %d | %s | %s | %s | %d | %s | %.1f | %.2f | %.2f "
+             "| %.3f |\n",
+             p.jpegQuality, p.tuning.gainMapQuality,
+             p.tuning.multiChannelGainMap ? "yes" : "no",
+             p.tuning.bestQualityPreset ? "best" : "realtime",
+             PeakLabel(p.tuning.targetPeakNits).c_str(),
+             p.tuning.gainMapScaleFactor, p.slicedBase ? "yes" : "no",
+             p.encodeMs,
+             p.bytes / (1024.0 * 1024.0), p.psnrPq, p.deltaEItp);
+    out << line;
+  }
+  return !out.fail();
+}
+
+// ============================================================================
+// Sweep
+// ============================================================================
+bool RunParameterSweep(const std::vector<std::wstring> &inputs,
+                       const SweepGrid &grid, const std::wstring &outPrefix,
+                       std::vector<SweepPoint> &points) {
+  using Clock = std::chrono::steady_clock;
+  const std::vector<std::wstring> files = CollectJxrFiles(inputs);
+  points = ExpandGrid(grid);
+  if (files.empty() || points.empty()) {
+    LogMsg(L"Sweep: no .jxr files or an empty grid");
+    return false;
+  }
+
+  size_t frames = 0;
+  for (const auto &path : files) {
+    // Decode and rescale once, with the service's options
+    ConversionJob source;
+    source.jxrPath = path;
+    if (!ReadStage(source) || !DecodeStage(source) || !RescaleStage(source)) {
+      LogMsg(L"Sweep: skipping %s (decode failed)", path.c_str());
+      continue;
+    }
+    if (!source.hdrSource || source.sdrOnly) {
+      LogMsg(L"Sweep: skipping %s (no HDR headroom)", path.c_str());
+      continue;
+    }
+    LogMsg(L"Sweep: %s (%ux%u), %zu settings", path.c_str(), source.width,
+           source.height, points.size());
+    const std::vector<uint8_t> reference = std::move(source.pixels);
+    ++frames;
+
+    for (auto &p : points) {
+      ConversionJob job;
+      job.options.jpegQuality = p.jpegQuality;
+      job.options.uhdr = p.tuning;
+      job.options.slicedBaseEncode = p.slicedBase;
+      job.width = source.width;
+      job.height = source.height;
+      job.hdrSource = true;
+      job.targetPeakNits = p.tuning.targetPeakNits > 0.0f
+                               ? p.tuning.targetPeakNits
+                               : source.targetPeakNits;
+      job.pixels = reference;
+
+      const auto t0 = Clock::now();
+      const bool encoded = EncodeStage(job);
+      const double ms =
+          std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+      FrameError error;
+      if (!encoded || !MeasureReconstruction(job.encoded, reference,
+                                             job.width, job.height, error)) {
+        LogMsg(L"Sweep: setting failed on %s", path.c_str());
+        continue;
+      }
+      ++p.frames;
+      p.encodeMs += ms;
+      p.bytes += job.encoded.size();
+      p.psnrPq += error.PsnrPq();
+      p.deltaEItp += error.MeanDeltaE();
+    }
+  }
+
+  for (auto &p : points) {
+    if (p.frames > 0) {
+      p.encodeMs /= p.frames;
+      p.psnrPq /= p.frames;
+      p.deltaEItp /= p.frames;
+    }
+  }
+  MarkParetoFrontier(points);
+
+  const fs::path csvPath = outPrefix + L".csv";
+  const fs::path mdPath = outPrefix + L".md";
+  if (!WriteCsv(csvPath, points) ||
+      !WriteMarkdown(mdPath, points, files.size(), frames)) {
+    LogMsg(L"Sweep: cannot write %s.csv / .md", outPrefix.c_str());
+    return false;
+  }
+  return frames > 0;
+}
+
+} // namespace jxr
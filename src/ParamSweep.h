@@ -0,0 +1,44 @@
+#pragma once
+#include "Converter.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace jxr {
+
+/// Ultra HDR encoder settings tried by --sweep. Every combination is run on
+/// every frame of the corpus.
+struct SweepGrid {
+  std::vector<int> jpegQualities = {85, 90, 95};
+  std::vector<int> gainMapQualities = {85, 95};
+  std::vector<bool> multiChannelGainMap = {false, true};
+  std::vector<bool> bestQualityPreset = {false, true};
+  std::vector<float> targetPeakNits = {0.0f, 4000.0f}; // 0 = measured
+  std::vector<int> gainMapScaleFactors = {1, 2, 4};
+  std::vector<bool> slicedBaseEncode = {false, true};
+};
+
+/// One grid point, aggregated over the corpus.
+struct SweepPoint {
+  int jpegQuality = 95;
+  UltraHdrTuning tuning;
+  bool slicedBase = false; // ConvertOptions::slicedBaseEncode
+  int frames = 0;
+  double encodeMs = 0.0;  // mean per frame
+  uint64_t bytes = 0;     // all frames
+  double psnrPq = 0.0;    // mean, dB, RGB in the PQ domain
+  double deltaEItp = 0.0; // mean ΔE ITP (BT.2124)
+  bool pareto = false;    // not beaten on time, size and PSNR at once
+};
+
+/// Encodes every HDR .jxr in `inputs` (files, or folders searched
+/// recursively) with each grid point. Frames are decoded and rescaled
+/// once; only the Ultra HDR encode is timed. Each output is decoded again
+/// by libultrahdr at full boost and compared with the frame that went in.
+/// Writes every point to "<outPrefix>.csv" and the Pareto frontier to
+/// "<outPrefix>.md". Needs COM on the calling thread.
+bool RunParameterSweep(const std::vector<std::wstring> &inputs,
+                       const SweepGrid &grid, const std::wstring &outPrefix,
+                       std::vector<SweepPoint> &points);
+
+} // namespace jxr
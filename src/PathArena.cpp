@@ -0,0 +1,160 @@
+#include "PathArena.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace jxr {
+
+// Names are appended to fixed chunks, so growing never copies them and
+// at most one partly used chunk is slack
+static constexpr size_t kChunkChars = 32 * 1024;
+
+// A drained arena keeps this much for the next batch instead of the
+// high-water mark of the largest backlog seen
+static constexpr size_t kRetainedEntries = 4096;
+
+// Directories kept across a drain; past this a drain drops them all
+static constexpr size_t kRetainedDirs = 4096;
+
+// The all-ones index is left out so no handle equals PathHandle::kInvalid
+static constexpr size_t kMaxEntries = PathHandle::kIndexMask;
+
+PathHandle PathArena::Intern(const wchar_t *path, size_t length) {
+  // Split after the last separator; the directory keeps it
+  size_t split = length;
+  while (split > 0 && path[split - 1] != L'\\' && path[split - 1] != L'/')
+    --split;
+
+  const std::wstring_view dirView(path, split);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.size() >= kMaxEntries)
+    return PathHandle{};
+  // Backlogs arrive a folder at a time: try the last directory before
+  // hashing
+  uint32_t dir = lastDir_;
+  if (dir >= dirs_.size() || dirs_[dir] != dirView) {
+    auto it = dirIndex_.find(dirView);
+    if (it != dirIndex_.end()) {
+      dir = it->second;
+    } else {
+      dir = static_cast<uint32_t>(dirs_.size());
+      dirs_.emplace_back(dirView);
+      dirIndex_.emplace(dirs_.back(), dir);
+    }
+    lastDir_ = dir;
+  }
+
+  // A name longer than a chunk (no separator in a long path) gets its own;
+  // 15 bits cover the longest Windows path
+  const size_t nameLength = std::min<size_t>(length - split, 0x7FFF);
+  if (chunks_.empty() ||
+      chunks_.back().size() + nameLength > chunks_.back().capacity()) {
+    chunks_.emplace_back();
+    chunks_.back().reserve(std::max(kChunkChars, nameLength));
+  }
+  std::vector<wchar_t> &chunk = chunks_.back();
+  Entry entry;
+  entry.dir = dir;
+  entry.chunk = static_cast<uint32_t>(chunks_.size() - 1);
+  entry.offset = static_cast<uint16_t>(chunk.size());
+  entry.length = static_cast<uint16_t>(nameLength);
+  entry.released = 0;
+  chunk.insert(chunk.end(), path + split, path + split + nameLength);
+  entries_.push_back(entry);
+  ++live_;
+  return PathHandle{static_cast<uint32_t>(entries_.size() - 1) |
+                    uint32_t(generation_) << PathHandle::kIndexBits};
+}
+
+PathArena::Entry *PathArena::Find(PathHandle handle) {
+  return const_cast<Entry *>(std::as_const(*this).Find(handle));
+}
+
+const PathArena::Entry *PathArena::Find(PathHandle handle) const {
+  if (handle.generation() != generation_ ||
+      handle.index() >= entries_.size())
+    return nullptr;
+  const Entry &entry = entries_[handle.index()];
+  return entry.released ? nullptr : &entry;
+}
+
+std::wstring PathArena::Resolve(PathHandle handle) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Entry *entry = Find(handle);
+  if (!entry)
+    return std::wstring();
+  const std::wstring &dir = dirs_[entry->dir];
+  std::wstring path;
+  path.reserve(dir.size() + entry->length);
+  path += dir;
+  path.append(chunks_[entry->chunk].data() + entry->offset, entry->length);
+  return path;
+}
+
+bool PathArena::Release(PathHandle handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry *entry = Find(handle);
+  if (!entry)
+    return false;
+  entry->released = 1;
+  if (--live_ == 0)
+    Drain();
+  return true;
+}
+
+bool PathArena::Take(PathHandle handle, std::wstring &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry *entry = Find(handle);
+  if (!entry)
+    return false;
+  // assign/append keep the caller's capacity
+  path.assign(dirs_[entry->dir]);
+  path.append(chunks_[entry->chunk].data() + entry->offset, entry->length);
+  entry->released = 1;
+  if (--live_ == 0)
+    Drain();
+  return true;
+}
+
+void PathArena::Drain() {
+  // Nothing refers to a file entry any more; keep one chunk. The new
+  // generation turns every outstanding handle stale.
+  ++generation_;
+  entries_.clear();
+  if (entries_.capacity() > kRetainedEntries)
+    std::vector<Entry>().swap(entries_);
+  if (chunks_.size() > 1)
+    chunks_.resize(1);
+  if (!chunks_.empty())
+    chunks_.front().clear();
+  if (dirs_.size() > kRetainedDirs) {
+    dirIndex_ = {};
+    dirs_ = {};
+    lastDir_ = 0;
+  }
+}
+
+size_t PathArena::live() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return live_;
+}
+
+size_t PathArena::directories() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dirs_.size();
+}
+
+size_t PathArena::bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t total = entries_.capacity() * sizeof(Entry) +
+                 chunks_.capacity() * sizeof(chunks_[0]);
+  for (const auto &chunk : chunks_)
+    total += chunk.capacity() * sizeof(wchar_t);
+  for (const auto &dir : dirs_)
+    total += sizeof(dir) + (dir.capacity() + 1) * sizeof(wchar_t);
+  // Index nodes: a view, a value and the bucket's link, roughly
+  total += dirIndex_.size() * (sizeof(std::wstring_view) + 2 * sizeof(void *));
+  return total;
+}
+
+} // namespace jxr
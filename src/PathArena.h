@@ -0,0 +1,152 @@
+#pragma once
+#include "ThreadSafeQueue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jxr {
+
+/// 32-bit handle to a path interned in a PathArena: the entry index in the
+/// low 24 bits and the arena's generation, bumped on every drain, in the
+/// high 8. Indices are reused after a drain; the generation is what tells a
+/// stale handle from the path that now has its index.
+struct PathHandle {
+  static constexpr uint32_t kInvalid = ~0u;
+  static constexpr uint32_t kIndexBits = 24;
+  static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+  uint32_t id = kInvalid;
+  bool valid() const { return id != kInvalid; }
+  uint32_t index() const { return id & kIndexMask; }
+  uint32_t generation() const { return id >> kIndexBits; }
+};
+
+/// Compact storage for many full paths that share a few long directories
+/// (a backlog of captures): each directory is stored once, each file as a
+/// directory index plus its name packed into 64 KB character chunks, 12
+/// bytes of bookkeeping per file and no heap block of its own. Thread-safe.
+///
+/// Files are not freed one by one. Once every handle has been released the
+/// file entries and names are dropped in one go, so a drained queue gives
+/// its memory back. Directories stay for the next batch unless there are
+/// more than a few thousand, so a long run over many folders stays bounded.
+/// Standard C++ only.
+class PathArena {
+public:
+  PathArena() = default;
+  PathArena(const PathArena &) = delete;
+  PathArena &operator=(const PathArena &) = delete;
+
+  /// Invalid once 2^24 - 1 paths are live (the handle's index space).
+  PathHandle Intern(const wchar_t *path, size_t length);
+  PathHandle Intern(const std::wstring &path) {
+    return Intern(path.data(), path.size());
+  }
+
+  /// The full path, or empty if `handle` is released or stale.
+  std::wstring Resolve(PathHandle handle) const;
+
+  /// Ends the handle's life. False, and nothing changes, if it was already
+  /// released or is from before a drain.
+  bool Release(PathHandle handle);
+
+  /// Resolve and Release under one lock, writing into `path` so a caller
+  /// that keeps the string reuses its buffer. False as for Release.
+  bool Take(PathHandle handle, std::wstring &path);
+
+  size_t live() const;
+  size_t directories() const;
+  /// Heap bytes held: directories, file entries and names, with capacity.
+  size_t bytes() const;
+
+private:
+  struct Entry {
+    uint32_t dir;   // index into dirs_; the directory ends in '\'
+    uint32_t chunk; // index into chunks_
+    uint16_t offset;
+    uint16_t length : 15;
+    uint16_t released : 1;
+  };
+
+  // The live entry `handle` names, or null (mutex_ held)
+  Entry *Find(PathHandle handle);
+  const Entry *Find(PathHandle handle) const;
+  void Drain();
+
+  mutable std::mutex mutex_;
+  std::deque<std::wstring> dirs_; // stable addresses for the index's views
+  std::unordered_map<std::wstring_view, uint32_t> dirIndex_;
+  std::vector<Entry> entries_;
+  std::vector<std::vector<wchar_t>> chunks_; // file names, never moved
+  uint32_t lastDir_ = 0;
+  size_t live_ = 0;
+  uint8_t generation_ = 0;
+};
+
+/// Work queue of paths with the interface of ThreadSafeQueue<std::wstring>,
+/// holding 32-bit PathArena handles instead of one string per item. Pops
+/// hand out an ordinary string and release the handle; the overloads that
+/// take a string write into it, so a worker looping on one string does not
+/// allocate per item.
+class PathQueue {
+public:
+  // Paths past the arena's 2^24 - 1 live entries are dropped
+  void push(const std::wstring &path) {
+    if (PathHandle handle = arena_.Intern(path); handle.valid())
+      queue_.push(handle);
+  }
+  void push_front(const std::wstring &path) {
+    if (PathHandle handle = arena_.Intern(path); handle.valid())
+      queue_.push_front(handle);
+  }
+  void push_priority(const std::wstring &path) {
+    if (PathHandle handle = arena_.Intern(path); handle.valid())
+      queue_.push_priority(handle);
+  }
+
+  std::optional<std::wstring> try_pop() {
+    std::wstring path;
+    if (!try_pop(path))
+      return std::nullopt;
+    return path;
+  }
+  bool try_pop(std::wstring &path) { return Take(queue_.try_pop(), path); }
+
+  // Waits up to `timeout` for an item. Returns nullopt on timeout or shutdown.
+  template <typename Rep, typename Period>
+  std::optional<std::wstring>
+  wait_and_pop(std::chrono::duration<Rep, Period> timeout) {
+    std::wstring path;
+    if (!wait_and_pop(path, timeout))
+      return std::nullopt;
+    return path;
+  }
+  template <typename Rep, typename Period>
+  bool wait_and_pop(std::wstring &path,
+                    std::chrono::duration<Rep, Period> timeout) {
+    return Take(queue_.wait_and_pop(timeout), path);
+  }
+
+  bool empty() const { return queue_.empty(); }
+  size_t size() const { return queue_.size(); }
+  void shutdown() { queue_.shutdown(); }
+
+  const PathArena &arena() const { return arena_; }
+
+private:
+  // Every queued handle is popped once, so Take only fails on an empty pop
+  bool Take(std::optional<PathHandle> handle, std::wstring &path) {
+    return handle && arena_.Take(*handle, path);
+  }
+
+  PathArena arena_;
+  ThreadSafeQueue<PathHandle> queue_;
+};
+
+} // namespace jxr
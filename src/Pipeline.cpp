@@ -0,0 +1,238 @@
+#include "Pipeline.h"
+#include "ResultCache.h"
+#include "Trace.h"
+#include "Utils.h"
+
+namespace jxr {
+
+static const wchar_t *const kStageNames[] = {L"read", L"decode", L"rescale",
+                                             L"encode", L"commit"};
+static const char *const kStageTraceNames[] = {"read", "decode", "rescale",
+                                               "encode", "commit"};
+static const char *const kStageThreadNames[] = {
+    "stage: read", "stage: decode", "stage: rescale", "stage: encode",
+    "stage: commit"};
+
+// One job in each hand-off buffer. On its own that would still let a decoded
+// frame sit in each of decode, its buffer, rescale, its buffer and encode:
+// five at once, 1.3 GB at 8K (265 MB per half-float frame).
+static constexpr size_t kHandOffDepth = 1;
+
+// So decode waits for a frame slot, released once encode has dropped the
+// pixels: at most two decoded frames (one encoding while the next decodes
+// or rescales), 530 MB at 8K, plus the encoder's own SDR image and gain map.
+static constexpr size_t kMaxDecodedFrames = 2;
+
+// ============================================================================
+// Setup / teardown
+// ============================================================================
+ConversionPipeline::ConversionPipeline(const ConvertOptions &options,
+                                       CompletionFn onComplete)
+    : options_(options), onComplete_(std::move(onComplete)) {
+  for (auto &queue : queues_)
+    queue = std::make_unique<BoundedQueue<JobPtr>>(kHandOffDepth);
+  windowStart_ = Clock::now();
+  for (int stage = 0; stage < kStageCount; ++stage)
+    threads_.emplace_back(&ConversionPipeline::RunStage, this, stage);
+}
+
+ConversionPipeline::~ConversionPipeline() { Shutdown(false); }
+
+void ConversionPipeline::Shutdown(bool abandon) {
+  if (abandon)
+    abandon_ = true;
+  queues_[kRead]->close();
+  for (auto &t : threads_) {
+    if (t.joinable())
+      t.join();
+  }
+  io_.Drain(); // Finish() of the last commits touches this object
+}
+
+bool ConversionPipeline::Submit(const std::wstring &jxrPath) {
+  return Submit(jxrPath, options_);
+}
+
+bool ConversionPipeline::Submit(const std::wstring &jxrPath,
+                                const ConvertOptions &options) {
+  auto job = std::make_unique<ConversionJob>();
+  job->jxrPath = jxrPath;
+  job->options = options;
+  if (options.cancel)
+    job->cancel = options.cancel->Token();
+
+  if (inFlight_++ == 0) {
+    std::lock_guard<std::mutex> lock(reportMutex_);
+    windowStart_ = Clock::now();
+  }
+  if (!queues_[kRead]->push(std::move(job))) {
+    --inFlight_;
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Decoded-frame budget: every job takes a slot on entering decode and gives
+// it back when it leaves encode, failed, cached or abandoned alike, since
+// every job passes through every stage thread
+// ============================================================================
+void ConversionPipeline::AcquireFrameSlot() {
+  std::unique_lock<std::mutex> lock(frameMutex_);
+  frameFreed_.wait(lock,
+                   [this] { return framesInFlight_ < kMaxDecodedFrames; });
+  ++framesInFlight_;
+}
+
+void ConversionPipeline::ReleaseFrameSlot() {
+  {
+    std::lock_guard<std::mutex> lock(frameMutex_);
+    --framesInFlight_;
+  }
+  frameFreed_.notify_one();
+}
+
+// ============================================================================
+// Stage threads
+// ============================================================================
+bool ConversionPipeline::RunStageFn(int stage, ConversionJob &job) {
+  switch (stage) {
+  case kRead:
+    return ReadStage(job, &pool_);
+  case kDecode:
+    return DecodeStage(job);
+  case kRescale:
+    return RescaleStage(job);
+  case kEncode:
+    return EncodeStage(job);
+  }
+  return false; // kCommit goes through SubmitCommit()
+}
+
+void ConversionPipeline::RunStage(int stage) {
+  // WIC (decode, SDR encode) needs COM on the stage's own thread
+  ComInit com;
+  TraceThreadName(kStageThreadNames[stage]);
+  StageCounters &c = counters_[stage];
+  auto sinceUs = [](Clock::time_point t) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t)
+            .count());
+  };
+
+  while (true) {
+    auto t0 = Clock::now();
+    auto item = queues_[stage]->pop();
+    c.starvedUs += sinceUs(t0);
+    if (!item.has_value())
+      break;
+    JobPtr job = std::move(*item);
+
+    ++c.jobs;
+    if (stage == kDecode) {
+      auto t1 = Clock::now();
+      TraceSpan span("frame budget");
+      AcquireFrameSlot();
+      c.blockedUs += sinceUs(t1);
+    }
+    if (abandon_) {
+      job->failed = true;
+    } else if (!job->failed && stage == kCommit) {
+      // Only blocks while AsyncIo has its maximum of commits in flight
+      auto t1 = Clock::now();
+      TraceSpan span("commit submit");
+      SubmitCommit(std::move(job));
+      c.busyUs += sinceUs(t1);
+      continue;
+    } else if (!job->failed) {
+      auto t1 = Clock::now();
+      TraceSpan span(kStageTraceNames[stage]);
+      MemoryScope scope(&job->memory);
+      if (!com || !RunStageFn(stage, *job))
+        job->failed = true;
+      c.busyUs += sinceUs(t1);
+    }
+    if (stage == kEncode)
+      ReleaseFrameSlot(); // the pixels are gone
+
+    if (stage + 1 < kStageCount) {
+      auto t2 = Clock::now();
+      queues_[stage + 1]->push(std::move(job));
+      c.blockedUs += sinceUs(t2);
+    } else {
+      Finish(*job);
+    }
+  }
+
+  // Input exhausted: let the next stage drain and exit too
+  if (stage + 1 < kStageCount)
+    queues_[stage + 1]->close();
+}
+
+void ConversionPipeline::SubmitCommit(JobPtr job) {
+  std::shared_ptr<ConversionJob> shared(std::move(job));
+  CommitStageAsync(shared, io_, [this, shared](bool ok) {
+    if (!ok)
+      shared->failed = true;
+    Finish(*shared);
+  });
+}
+
+void ConversionPipeline::Finish(ConversionJob &job) {
+  if (job.failed && !abandon_ && !job.cancelled)
+    LogMsg(L"Pipeline: conversion failed for %s", job.jxrPath.c_str());
+  else if (!job.failed)
+    LogConversionMemory(job);
+  if (onComplete_)
+    onComplete_(job);
+
+  {
+    std::lock_guard<std::mutex> lock(reportMutex_);
+    ++windowJobs_;
+  }
+  if (--inFlight_ == 0) {
+    LogOccupancy();
+    if (options_.cache)
+      options_.cache->LogStats();
+  }
+}
+
+// ============================================================================
+// Occupancy report: share of wall time each stage spent working. The stage
+// closest to 100% is the bottleneck.
+// ============================================================================
+void ConversionPipeline::LogOccupancy() {
+  std::lock_guard<std::mutex> lock(reportMutex_);
+  if (windowJobs_ < 2) {
+    windowJobs_ = 0;
+    for (auto &c : counters_)
+      c.busyUs = c.starvedUs = c.blockedUs = c.jobs = 0;
+    return; // a single file tells us nothing about overlap
+  }
+
+  double wallUs = static_cast<double>(
+      std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                            windowStart_)
+          .count());
+  if (wallUs <= 0.0)
+    wallUs = 1.0;
+
+  double pct[kStageCount];
+  int bottleneck = 0;
+  for (int i = 0; i < kStageCount; ++i) {
+    pct[i] = 100.0 * static_cast<double>(counters_[i].busyUs.exchange(0)) /
+             wallUs;
+    if (pct[i] > pct[bottleneck])
+      bottleneck = i;
+    counters_[i].starvedUs = counters_[i].blockedUs = counters_[i].jobs = 0;
+  }
+
+  LogMsg(L"Pipeline: %llu files in %.1f s; busy: read %.0f%%, decode %.0f%%, "
+         L"rescale %.0f%%, encode %.0f%%, commit %.0f%% (bottleneck: %s)",
+         static_cast<unsigned long long>(windowJobs_), wallUs / 1e6,
+         pct[kRead], pct[kDecode], pct[kRescale], pct[kEncode], pct[kCommit],
+         kStageNames[bottleneck]);
+  windowJobs_ = 0;
+}
+
+} // namespace jxr
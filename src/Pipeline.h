@@ -0,0 +1,91 @@
+#pragma once
+#include "AsyncIo.h"
+#include "Converter.h"
+#include "InputFile.h"
+#include "ThreadSafeQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace jxr {
+
+/// Runs conversions as a stage pipeline (read → decode → rescale → encode →
+/// commit), one thread per stage with a bounded hand-off buffer between
+/// stages, so file N+1 decodes while file N encodes and file N−1 commits.
+/// Commits finish asynchronously on AsyncIo. Per-stage occupancy is logged
+/// whenever the pipeline drains.
+class ConversionPipeline {
+public:
+  using CompletionFn = std::function<void(const ConversionJob &)>;
+
+  /// onComplete is called for every job, successful or not (check
+  /// job.failed, and job.cancelled for preempted ones), on the commit
+  /// thread or on an I/O completion thread.
+  explicit ConversionPipeline(const ConvertOptions &options,
+                              CompletionFn onComplete = nullptr);
+  ~ConversionPipeline();
+  ConversionPipeline(const ConversionPipeline &) = delete;
+  ConversionPipeline &operator=(const ConversionPipeline &) = delete;
+
+  /// Queues a file. Blocks while the read stage's buffer is full. Returns
+  /// false once Shutdown() has been called.
+  bool Submit(const std::wstring &jxrPath);
+
+  /// Same, with options for this job only (e.g. an IPC client's profile).
+  bool Submit(const std::wstring &jxrPath, const ConvertOptions &options);
+
+  /// Stops accepting work and joins the stage threads. With `abandon`,
+  /// jobs not yet started in a stage are dropped instead of finished.
+  void Shutdown(bool abandon);
+
+  size_t InFlight() const { return inFlight_.load(); }
+
+private:
+  enum Stage { kRead, kDecode, kRescale, kEncode, kCommit, kStageCount };
+  using JobPtr = std::unique_ptr<ConversionJob>;
+  using Clock = std::chrono::steady_clock;
+
+  struct StageCounters {
+    std::atomic<uint64_t> busyUs{0};    // running the stage function
+    std::atomic<uint64_t> starvedUs{0}; // waiting for input
+    std::atomic<uint64_t> blockedUs{0}; // waiting for the next buffer
+    std::atomic<uint64_t> jobs{0};
+  };
+
+  void AcquireFrameSlot();
+  void ReleaseFrameSlot();
+  void RunStage(int stage);
+  bool RunStageFn(int stage, ConversionJob &job);
+  void SubmitCommit(JobPtr job);
+  void Finish(ConversionJob &job);
+  void LogOccupancy();
+
+  ConvertOptions options_;
+  CompletionFn onComplete_;
+  BufferPool pool_;
+  AsyncIo io_; // commit chains; the commit stage only submits them
+  std::unique_ptr<BoundedQueue<JobPtr>> queues_[kStageCount]; // i feeds i
+  StageCounters counters_[kStageCount];
+  std::atomic<size_t> inFlight_{0};
+  std::atomic<bool> abandon_{false};
+
+  // Jobs between decode and the end of encode (kMaxDecodedFrames at most)
+  std::mutex frameMutex_;
+  std::condition_variable frameFreed_;
+  size_t framesInFlight_ = 0;
+
+  std::mutex reportMutex_;
+  Clock::time_point windowStart_;
+  uint64_t windowJobs_ = 0;
+
+  std::vector<std::thread> threads_;
+};
+
+} // namespace jxr
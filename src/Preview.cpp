@@ -0,0 +1,170 @@
+#include "Preview.h"
+#include "HalfFloat.h"
+#include "JpegEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define JXR_PREVIEW_SSE 1
+#endif
+
+namespace jxr {
+
+// ============================================================================
+// Lookup tables: half-float → float, linear [0..1] → sRGB 8-bit
+// ============================================================================
+static const float *HalfToFloatLut() {
+  static const std::vector<float> lut = [] {
+    std::vector<float> t(65536);
+    for (uint32_t h = 0; h < 65536; ++h) {
+      float v = HalfToFloat(static_cast<uint16_t>(h));
+      t[h] = (v > 0.0f) ? v : 0.0f; // negatives and NaN contribute nothing
+    }
+    return t;
+  }();
+  return lut.data();
+}
+
+static constexpr int kSrgbLutSize = 4096;
+
+static const uint8_t *LinearToSrgb8Lut() {
+  static const std::vector<uint8_t> lut = [] {
+    std::vector<uint8_t> t(kSrgbLutSize);
+    for (int i = 0; i < kSrgbLutSize; ++i) {
+      float v = static_cast<float>(i) / (kSrgbLutSize - 1);
+      float e = (v <= 0.0031308f) ? v * 12.92f
+                                  : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+      t[i] = static_cast<uint8_t>(e * 255.0f + 0.5f);
+    }
+    return t;
+  }();
+  return lut.data();
+}
+
+// ============================================================================
+// Setup
+// ============================================================================
+PreviewBuilder::PreviewBuilder(uint32_t srcWidth, uint32_t srcHeight,
+                               uint32_t longEdge)
+    : srcW_(srcWidth), srcH_(srcHeight), longEdge_(longEdge) {
+  uint32_t srcLong = std::max(srcW_, srcH_);
+  double scale = (longEdge_ < srcLong && srcLong > 0)
+                     ? static_cast<double>(longEdge_) / srcLong
+                     : 1.0;
+  dstW_ = std::max<uint32_t>(1, static_cast<uint32_t>(srcW_ * scale + 0.5));
+  dstH_ = std::max<uint32_t>(1, static_cast<uint32_t>(srcH_ * scale + 0.5));
+
+  xmap_.resize(srcW_);
+  colCount_.assign(dstW_, 0);
+  for (uint32_t x = 0; x < srcW_; ++x) {
+    xmap_[x] = static_cast<uint32_t>(static_cast<uint64_t>(x) * dstW_ / srcW_);
+    ++colCount_[xmap_[x]];
+  }
+  acc_.assign(static_cast<size_t>(dstW_) * 4, 0.0f);
+  pixels_.resize(static_cast<size_t>(dstW_) * dstH_ * 3);
+}
+
+// ============================================================================
+// Row accumulation (area filter: every source pixel lands in exactly one
+// preview pixel, which is the mean of its footprint)
+// ============================================================================
+void PreviewBuilder::BeginRow() {
+  uint32_t dy =
+      static_cast<uint32_t>(static_cast<uint64_t>(srcY_) * dstH_ / srcH_);
+  if (dy != dstY_) {
+    FlushRow();
+    dstY_ = dy;
+  }
+}
+
+void PreviewBuilder::EndRow() {
+  ++rowsInBand_;
+  ++srcY_;
+  if (srcY_ == srcH_)
+    FlushRow();
+}
+
+void PreviewBuilder::AddRowsRgbaHalf(const uint16_t *rows, size_t stride,
+                                     uint32_t count) {
+  linear_ = true;
+  const float *h2f = HalfToFloatLut();
+  for (uint32_t r = 0; r < count && srcY_ < srcH_; ++r) {
+    BeginRow();
+    const uint16_t *px = rows + r * stride;
+    float *acc = acc_.data();
+    for (uint32_t x = 0; x < srcW_; ++x, px += 4) {
+      float *a = acc + static_cast<size_t>(xmap_[x]) * 4;
+#ifdef JXR_PREVIEW_SSE
+      __m128 v = _mm_set_ps(0.0f, h2f[px[0]], h2f[px[1]], h2f[px[2]]);
+      _mm_storeu_ps(a, _mm_add_ps(_mm_loadu_ps(a), v));
+#else
+      a[0] += h2f[px[2]];
+      a[1] += h2f[px[1]];
+      a[2] += h2f[px[0]];
+#endif
+    }
+    EndRow();
+  }
+}
+
+void PreviewBuilder::AddRowsBgr8(const uint8_t *rows, size_t stride,
+                                 uint32_t count) {
+  linear_ = false;
+  for (uint32_t r = 0; r < count && srcY_ < srcH_; ++r) {
+    BeginRow();
+    const uint8_t *px = rows + r * stride;
+    float *acc = acc_.data();
+    for (uint32_t x = 0; x < srcW_; ++x, px += 3) {
+      float *a = acc + static_cast<size_t>(xmap_[x]) * 4;
+#ifdef JXR_PREVIEW_SSE
+      __m128i p = _mm_cvtsi32_si128(px[0] | (px[1] << 8) | (px[2] << 16));
+      p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, _mm_setzero_si128()),
+                             _mm_setzero_si128());
+      _mm_storeu_ps(a, _mm_add_ps(_mm_loadu_ps(a), _mm_cvtepi32_ps(p)));
+#else
+      a[0] += px[0];
+      a[1] += px[1];
+      a[2] += px[2];
+#endif
+    }
+    EndRow();
+  }
+}
+
+void PreviewBuilder::FlushRow() {
+  if (rowsInBand_ == 0)
+    return;
+
+  const uint8_t *srgb = LinearToSrgb8Lut();
+  uint8_t *out = pixels_.data() + static_cast<size_t>(dstY_) * dstW_ * 3;
+  for (uint32_t dx = 0; dx < dstW_; ++dx) {
+    float *a = acc_.data() + static_cast<size_t>(dx) * 4;
+    float inv = 1.0f / (static_cast<float>(colCount_[dx]) * rowsInBand_);
+    for (int c = 0; c < 3; ++c) {
+      float v = a[c] * inv;
+      if (linear_) {
+        v = std::min(v, 1.0f) * (kSrgbLutSize - 1);
+        out[dx * 3 + c] = srgb[static_cast<int>(v + 0.5f)];
+      } else {
+        out[dx * 3 + c] = static_cast<uint8_t>(std::min(v + 0.5f, 255.0f));
+      }
+      a[c] = 0.0f;
+    }
+  }
+  rowsInBand_ = 0;
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+bool PreviewBuilder::Encode(int quality, std::vector<uint8_t> &out) const {
+  if (!complete())
+    return false;
+  return EncodeJpeg(pixels_.data(), dstW_, dstH_,
+                    static_cast<size_t>(dstW_) * 3, JpegInputFormat::BGR24,
+                    quality, true, out);
+}
+
+} // namespace jxr
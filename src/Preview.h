@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace jxr {
+
+/// Streaming area-filter downscaler that builds an 8-bit SDR preview from
+/// rows of a frame that is already being decoded for conversion, so no
+/// second decode of the output JPEG is needed.
+///
+/// Feed every source row exactly once, top to bottom, with either
+/// AddRowsRgbaHalf (linear, rescaled so 1.0 = SDR white) or AddRowsBgr8
+/// (already sRGB-encoded), then call Encode().
+class PreviewBuilder {
+public:
+  /// longEdge: size of the preview's longer side in pixels. Previews are
+  /// never upscaled.
+  PreviewBuilder(uint32_t srcWidth, uint32_t srcHeight, uint32_t longEdge);
+
+  uint32_t longEdge() const { return longEdge_; }
+  uint32_t width() const { return dstW_; }
+  uint32_t height() const { return dstH_; }
+
+  /// `stride` is in uint16_t elements (4 per pixel for packed RGBA).
+  void AddRowsRgbaHalf(const uint16_t *rows, size_t stride, uint32_t count);
+
+  /// `stride` is in bytes (3 per pixel for packed BGR).
+  void AddRowsBgr8(const uint8_t *rows, size_t stride, uint32_t count);
+
+  /// True once every source row has been consumed.
+  bool complete() const { return srcY_ == srcH_; }
+
+  /// Encodes the finished preview as a baseline JPEG.
+  bool Encode(int quality, std::vector<uint8_t> &out) const;
+
+private:
+  void BeginRow();
+  void EndRow();
+  void FlushRow();
+
+  uint32_t srcW_, srcH_, dstW_, dstH_, longEdge_;
+  bool linear_ = false;
+  uint32_t srcY_ = 0;
+  uint32_t dstY_ = 0;
+  uint32_t rowsInBand_ = 0;
+  std::vector<uint32_t> xmap_;     // source column → preview column
+  std::vector<uint32_t> colCount_; // source columns per preview column
+  std::vector<float> acc_;         // B,G,R,_ sums per preview column
+  std::vector<uint8_t> pixels_;    // finished BGR24 preview
+};
+
+} // namespace jxr
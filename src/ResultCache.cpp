@@ -0,0 +1,340 @@
+#include "ResultCache.h"
+#include "Utils.h"
+
+#include <cwchar>
+#include <windows.h>
+
+namespace jxr {
+
+static uint64_t FileTimeTicks(const FILETIME &ft) {
+  return (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+static uint64_t NowTicks() {
+  FILETIME ft;
+  ::GetSystemTimeAsFileTime(&ft);
+  return FileTimeTicks(ft);
+}
+
+// "<hash>-<bytes>-<profile>.ref", each field 16 hex digits
+static constexpr size_t kEntryNameLength = 3 * 16 + 2 + 4;
+static constexpr wchar_t kEntryExtension[] = L".ref";
+
+static std::wstring EntryName(uint64_t contentHash, uint64_t sourceBytes,
+                              uint64_t profileKey) {
+  wchar_t name[64];
+  swprintf_s(name, L"%016llx-%016llx-%016llx.ref",
+             static_cast<unsigned long long>(contentHash),
+             static_cast<unsigned long long>(sourceBytes),
+             static_cast<unsigned long long>(profileKey));
+  return name;
+}
+
+// Entry file: this header, then the output path (UTF-16, no terminator)
+struct EntryRecord {
+  uint32_t magic = 0;
+  uint32_t pathChars = 0;
+  uint64_t outputBytes = 0;
+  uint64_t outputWriteTime = 0; // FILETIME ticks
+};
+static constexpr uint32_t kEntryMagic = 0x3143524A; // "JRC1"
+static constexpr uint32_t kMaxPathChars = 32767;
+
+// Both markers survive any complete write; a torn or zero-filled file
+// (power loss before the data reached the disk) fails at least one
+static bool LooksLikeJpeg(const std::vector<uint8_t> &bytes) {
+  const size_t n = bytes.size();
+  return n >= 4 && bytes[0] == 0xFF && bytes[1] == 0xD8 &&
+         bytes[n - 2] == 0xFF && bytes[n - 1] == 0xD9;
+}
+
+static bool ReadExact(HANDLE file, void *data, DWORD size) {
+  DWORD read = 0;
+  return ::ReadFile(file, data, size, &read, nullptr) && read == size;
+}
+
+// Size and last-write time of an open file
+static bool FileStamp(HANDLE file, uint64_t &bytes, uint64_t &writeTime) {
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!::GetFileInformationByHandle(file, &info))
+    return false;
+  bytes = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) |
+          info.nFileSizeLow;
+  writeTime = FileTimeTicks(info.ftLastWriteTime);
+  return true;
+}
+
+// The entry's record and output path, then its write time moved to now:
+// most recently used, also on disk for the next run's index
+static bool ReadEntry(const std::wstring &path, uint64_t now,
+                      EntryRecord &record, std::wstring &outputPath) {
+  // SHARE_DELETE lets an eviction on another thread go ahead meanwhile
+  UniqueHandle file = MakeUniqueHandle(::CreateFileW(
+      path.c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL, nullptr));
+  LARGE_INTEGER size = {};
+  if (!file || !::GetFileSizeEx(file.get(), &size) ||
+      !ReadExact(file.get(), &record, sizeof(record)) ||
+      record.magic != kEntryMagic || record.pathChars == 0 ||
+      record.pathChars > kMaxPathChars ||
+      static_cast<uint64_t>(size.QuadPart) !=
+          sizeof(record) + record.pathChars * sizeof(wchar_t))
+    return false;
+  outputPath.resize(record.pathChars);
+  if (!ReadExact(file.get(), &outputPath[0],
+                 record.pathChars * static_cast<DWORD>(sizeof(wchar_t))))
+    return false;
+  FILETIME ft;
+  ft.dwLowDateTime = static_cast<DWORD>(now);
+  ft.dwHighDateTime = static_cast<DWORD>(now >> 32);
+  ::SetFileTime(file.get(), nullptr, nullptr, &ft);
+  return true;
+}
+
+// The output, if it is still the file the entry recorded. No write sharing:
+// nothing can change it between the stamp check and the read.
+static bool ReadOutput(const std::wstring &path, const EntryRecord &record,
+                       std::vector<uint8_t> &out) {
+  UniqueHandle file = MakeUniqueHandle(::CreateFileW(
+      path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+  uint64_t bytes = 0, writeTime = 0;
+  if (!file || !FileStamp(file.get(), bytes, writeTime) ||
+      bytes != record.outputBytes || writeTime != record.outputWriteTime ||
+      bytes == 0 || bytes > MAXDWORD)
+    return false;
+  out.resize(static_cast<size_t>(bytes));
+  return ReadExact(file.get(), out.data(), static_cast<DWORD>(bytes)) &&
+         LooksLikeJpeg(out);
+}
+
+// ============================================================================
+// Open: index the directory
+// ============================================================================
+bool ResultCache::Open(const std::wstring &dir, size_t maxEntries) {
+  if (!::CreateDirectoryW(dir.c_str(), nullptr) &&
+      ::GetLastError() != ERROR_ALREADY_EXISTS) {
+    LogMsg(L"Cache: cannot create %s, error %u", dir.c_str(),
+           ::GetLastError());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  dir_ = dir;
+  maxEntries_ = maxEntries;
+  entries_.clear();
+  totalBytes_ = 0;
+
+  WIN32_FIND_DATAW fd;
+  HANDLE find = ::FindFirstFileExW((dir_ + L"\\*").c_str(), FindExInfoBasic,
+                                   &fd, FindExSearchNameMatch, nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+  if (find != INVALID_HANDLE_VALUE) {
+    size_t removedTemps = 0;
+    size_t removedStale = 0;
+    do {
+      if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        continue;
+      std::wstring name = fd.cFileName;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, L".tmp") == 0) {
+        // A store that never reached its rename
+        ::DeleteFileW((dir_ + L"\\" + name).c_str());
+        ++removedTemps;
+        continue;
+      }
+      if (name.size() != kEntryNameLength ||
+          name.compare(name.size() - 4, 4, kEntryExtension) != 0) {
+        // Named without the source length, or a full copy of an output
+        // from before entries became references; no lookup would find it
+        ::DeleteFileW((dir_ + L"\\" + name).c_str());
+        ++removedStale;
+        continue;
+      }
+      Entry entry;
+      entry.size = (static_cast<uint64_t>(fd.nFileSizeHigh) << 32) |
+                   fd.nFileSizeLow;
+      entry.lastUse = FileTimeTicks(fd.ftLastWriteTime);
+      totalBytes_ += entry.size;
+      entries_[name] = entry;
+    } while (::FindNextFileW(find, &fd));
+    ::FindClose(find);
+    if (removedTemps)
+      LogMsg(L"Cache: removed %zu unfinished entries", removedTemps);
+    if (removedStale)
+      LogMsg(L"Cache: removed %zu entries from an older format", removedStale);
+  }
+
+  EvictToCap(); // the cap may have shrunk since the last run
+  LogMsg(L"Cache: %zu of %zu entries in %s", entries_.size(), maxEntries_,
+         dir_.c_str());
+  return true;
+}
+
+// ============================================================================
+// Lookup / store
+// ============================================================================
+bool ResultCache::Lookup(uint64_t contentHash, uint64_t sourceBytes,
+                         uint64_t profileKey, std::vector<uint8_t> &out) {
+  const std::wstring name = EntryName(contentHash, sourceBytes, profileKey);
+  std::wstring path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dir_.empty() || entries_.find(name) == entries_.end()) {
+      ++misses_;
+      return false;
+    }
+    path = dir_ + L"\\" + name;
+  }
+
+  // Both reads outside the lock
+  const uint64_t now = NowTicks();
+  EntryRecord record;
+  std::wstring outputPath;
+  const bool entryOk = ReadEntry(path, now, record, outputPath);
+  const bool ok = entryOk && ReadOutput(outputPath, record, out);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(name);
+  if (!ok) {
+    if (entryOk) {
+      LogMsg(L"Cache: %s was moved or changed, dropping entry %s",
+             outputPath.c_str(), name.c_str());
+    } else {
+      LogMsg(L"Cache: dropping unreadable entry %s", name.c_str());
+    }
+    out.clear();
+    if (it != entries_.end())
+      Remove(name);
+    ++misses_;
+    return false;
+  }
+  if (it != entries_.end())
+    it->second.lastUse = now;
+  ++hits_;
+  return true;
+}
+
+void ResultCache::Store(uint64_t contentHash, uint64_t sourceBytes,
+                        uint64_t profileKey, const std::wstring &outputPath) {
+  std::wstring dir;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dir = dir_;
+    if (dir.empty() || maxEntries_ == 0 || outputPath.empty() ||
+        outputPath.size() > kMaxPathChars)
+      return;
+  }
+
+  // Stamp the output as committed; any later change to it makes a miss
+  EntryRecord record;
+  record.magic = kEntryMagic;
+  record.pathChars = static_cast<uint32_t>(outputPath.size());
+  {
+    UniqueHandle output = MakeUniqueHandle(::CreateFileW(
+        outputPath.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!output || !FileStamp(output.get(), record.outputBytes,
+                              record.outputWriteTime)) {
+      LogMsg(L"Cache: cannot stat %s, error %u", outputPath.c_str(),
+             ::GetLastError());
+      return;
+    }
+  }
+
+  // Write under a temp name, then rename: the index only ever sees whole
+  // entries. No flush; a file torn by power loss fails ReadEntry().
+  const std::wstring name = EntryName(contentHash, sourceBytes, profileKey);
+  const std::wstring path = dir + L"\\" + name;
+  const std::wstring tempPath = path + L".tmp";
+  const DWORD pathBytes =
+      record.pathChars * static_cast<DWORD>(sizeof(wchar_t));
+  bool ok = false;
+  {
+    UniqueHandle file = MakeUniqueHandle(
+        ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    DWORD written = 0;
+    ok = file &&
+         ::WriteFile(file.get(), &record, sizeof(record), &written,
+                     nullptr) &&
+         written == sizeof(record) &&
+         ::WriteFile(file.get(), outputPath.data(), pathBytes, &written,
+                     nullptr) &&
+         written == pathBytes;
+  }
+  if (ok)
+    ok = ::MoveFileExW(tempPath.c_str(), path.c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != FALSE;
+  if (!ok) {
+    LogMsg(L"Cache: cannot store %s, error %u", name.c_str(),
+           ::GetLastError());
+    ::DeleteFileW(tempPath.c_str());
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry &entry = entries_[name];
+  const uint64_t size = sizeof(record) + pathBytes;
+  totalBytes_ = totalBytes_ - entry.size + size;
+  entry.size = size;
+  entry.lastUse = NowTicks();
+  ++stores_;
+  EvictToCap();
+}
+
+// ============================================================================
+// Eviction (mutex_ held)
+// ============================================================================
+void ResultCache::Remove(const std::wstring &name) {
+  auto it = entries_.find(name);
+  if (it == entries_.end())
+    return;
+  ::DeleteFileW((dir_ + L"\\" + name).c_str());
+  totalBytes_ -= it->second.size;
+  entries_.erase(it);
+}
+
+void ResultCache::EvictToCap() {
+  // A linear scan per eviction: a few thousand small entries at most
+  while (entries_.size() > maxEntries_ && !entries_.empty()) {
+    auto oldest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.lastUse < oldest->second.lastUse)
+        oldest = it;
+    }
+    Remove(oldest->first);
+    ++evictions_;
+  }
+}
+
+// ============================================================================
+// Counters
+// ============================================================================
+ResultCache::Stats ResultCache::GetStats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.stores = stores_;
+  stats.evictions = evictions_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats.bytes = totalBytes_;
+  stats.entries = entries_.size();
+  return stats;
+}
+
+void ResultCache::LogStats() const {
+  Stats s = GetStats();
+  const uint64_t lookups = s.hits + s.misses;
+  LogMsg(L"Cache: %llu hits, %llu misses (%.0f%% hit rate), %llu stored, "
+         L"%llu evicted; %zu entries, %.1f MB",
+         static_cast<unsigned long long>(s.hits),
+         static_cast<unsigned long long>(s.misses),
+         lookups ? 100.0 * s.hits / lookups : 0.0,
+         static_cast<unsigned long long>(s.stores),
+         static_cast<unsigned long long>(s.evictions), s.entries,
+         s.bytes / (1024.0 * 1024.0));
+}
+
+} // namespace jxr
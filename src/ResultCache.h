@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jxr {
+
+/// Bounded on-disk index of finished JPEGs, keyed by the source's content
+/// hash and byte length and a key for the options that shape the output.
+/// Byte-identical captures (restored backups, cloud re-syncs, the same file
+/// copied into several folders) are then written out from an earlier output
+/// instead of being decoded and encoded again.
+///
+/// An entry does not hold a second copy of the output. It is a small file,
+/// "<content hash>-<source bytes>-<profile key>.ref" (hex), naming the
+/// committed .jpg with its size and last-write time; a hit reads that file
+/// back, and an output that has since been moved, edited or replaced is a
+/// miss and drops the entry. A hit ends with the source deleted, so the
+/// length guards against trusting the 64-bit hash alone. Least recently
+/// used entries are deleted past the entry cap; a hit refreshes the entry's
+/// write time, so the order survives restarts. Entries are written to a
+/// temp name and renamed, and every read is checked for the record header
+/// and for JPEG start/end markers, so a crash never yields a torn hit.
+class ResultCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes = 0; // of entry files on disk now
+    size_t entries = 0;
+  };
+
+  ResultCache() = default;
+  ResultCache(const ResultCache &) = delete;
+  ResultCache &operator=(const ResultCache &) = delete;
+
+  /// Creates `dir` if needed, indexes what an earlier run left there and
+  /// removes leftover temp files and entries written by older builds.
+  bool Open(const std::wstring &dir, size_t maxEntries);
+
+  /// Reads the output the entry names into `out`. Returns false on a miss,
+  /// including an output whose size or write time no longer match.
+  bool Lookup(uint64_t contentHash, uint64_t sourceBytes, uint64_t profileKey,
+              std::vector<uint8_t> &out);
+
+  /// Records `outputPath`, a committed JPEG, as the output for this key
+  /// (replacing any entry with the same key), then evicts down to the cap.
+  /// Failures are logged and otherwise ignored.
+  void Store(uint64_t contentHash, uint64_t sourceBytes, uint64_t profileKey,
+             const std::wstring &outputPath);
+
+  Stats GetStats() const;
+  void LogStats() const;
+
+private:
+  struct Entry {
+    uint64_t size = 0;    // of the entry file
+    uint64_t lastUse = 0; // FILETIME ticks
+  };
+
+  void Remove(const std::wstring &name);
+  void EvictToCap();
+
+  mutable std::mutex mutex_; // everything below except the counters
+  std::wstring dir_;
+  size_t maxEntries_ = 0;
+  uint64_t totalBytes_ = 0;
+  std::unordered_map<std::wstring, Entry> entries_; // by file name
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> stores_{0};
+  std::atomic<uint64_t> evictions_{0};
+};
+
+} // namespace jxr
@@ -0,0 +1,319 @@
+#include "RootIndex.h"
+
+#include <unordered_set>
+#include <vector>
+
+namespace jxr {
+
+// USN records worth looking at: a name appeared in a directory
+static constexpr DWORD kUsnReasons =
+    USN_REASON_FILE_CREATE | USN_REASON_RENAME_NEW_NAME;
+
+static uint64_t ToU64(const FILETIME &ft) {
+  return (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+// The converter's output replaces the extension, whatever the filter let in
+static bool IsConverted(const std::wstring &sourcePath) {
+  const size_t slash = sourcePath.find_last_of(L'\\');
+  const size_t dot = sourcePath.find_last_of(L'.');
+  std::wstring jpg =
+      (dot != std::wstring::npos && (slash == std::wstring::npos || dot > slash)
+           ? sourcePath.substr(0, dot)
+           : sourcePath) +
+      L".jpg";
+  return ::GetFileAttributesW(jpg.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+RootIndex::RootIndex(std::wstring root, Mode mode, WatchFilter filter)
+    : root_(std::move(root)), rootKey_(ToLowerPath(root_)), mode_(mode),
+      filter_(std::move(filter)),
+      relativeStart_(root_.size() +
+                     (!root_.empty() && root_.back() == L'\\' ? 0 : 1)) {}
+
+// Filtered by the path below the root, like live events
+bool RootIndex::Wanted(const std::wstring &path) const {
+  return path.size() > relativeStart_ &&
+         filter_.Matches(path.data() + relativeStart_,
+                         path.size() - relativeStart_);
+}
+
+// ============================================================================
+// Baseline
+// ============================================================================
+void RootIndex::Snapshot() {
+  if (OpenUsn()) {
+    LogMsg(L"RootIndex: '%s' resyncs from the USN journal", root_.c_str());
+    return;
+  }
+  // No journal: directory times. Walking the tree for them now would hold
+  // up the watcher (SMB/NAS and FAT roots are the slow ones), and most
+  // sessions never overflow, so the first resync takes them instead
+  dirs_.clear();
+  timesValid_ = false;
+  LogMsg(L"RootIndex: '%s' resyncs from directory times", root_.c_str());
+}
+
+bool RootIndex::OpenUsn() {
+  if (mode_ == Mode::DirectoryTimes)
+    return false;
+  wchar_t volumePath[MAX_PATH];
+  if (!::GetVolumePathNameW(root_.c_str(), volumePath, MAX_PATH) ||
+      ::GetDriveTypeW(volumePath) == DRIVE_REMOTE)
+    return false;
+  wchar_t fsName[MAX_PATH] = {};
+  if (!::GetVolumeInformationW(volumePath, nullptr, 0, nullptr, nullptr,
+                               nullptr, fsName, MAX_PATH) ||
+      (wcscmp(fsName, L"NTFS") != 0 && wcscmp(fsName, L"ReFS") != 0))
+    return false;
+
+  // "C:\" → "\\.\C:"
+  std::wstring device = L"\\\\.\\" + std::wstring(volumePath);
+  if (device.back() == L'\\')
+    device.pop_back();
+  volume_ = MakeUniqueHandle(::CreateFileW(
+      device.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+      nullptr, OPEN_EXISTING, 0, nullptr));
+  if (!volume_) {
+    // Unprivileged journal reads need no access rights on the volume
+    volume_ = MakeUniqueHandle(::CreateFileW(device.c_str(), 0,
+                                             FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                             nullptr, OPEN_EXISTING, 0,
+                                             nullptr));
+  }
+  if (!volume_)
+    return false;
+
+  USN_JOURNAL_DATA_V0 journal = {};
+  DWORD bytes = 0;
+  if (!::DeviceIoControl(volume_.get(), FSCTL_QUERY_USN_JOURNAL, nullptr, 0,
+                         &journal, sizeof(journal), &bytes, nullptr)) {
+    volume_.reset();
+    return false;
+  }
+  journalId_ = journal.UsnJournalID;
+  nextUsn_ = checkpointUsn_ = journal.NextUsn;
+  usn_ = true;
+  return true;
+}
+
+void RootIndex::Checkpoint() {
+  if (!usn_)
+    return;
+  USN_JOURNAL_DATA_V0 journal = {};
+  DWORD bytes = 0;
+  if (::DeviceIoControl(volume_.get(), FSCTL_QUERY_USN_JOURNAL, nullptr, 0,
+                        &journal, sizeof(journal), &bytes, nullptr) &&
+      journal.UsnJournalID == journalId_) {
+    // Resume one checkpoint back: changes made between the last completed
+    // read and this query belong to the next batch, which may overflow
+    nextUsn_ = checkpointUsn_;
+    checkpointUsn_ = journal.NextUsn;
+  }
+}
+
+// ============================================================================
+// Resync
+// ============================================================================
+RootIndex::ResyncResult
+RootIndex::Resync(HANDLE rootDir,
+                  const std::function<void(const std::wstring &)> &onJxr) {
+  ResyncResult result;
+  if (usn_) {
+    result.usedUsn = true;
+    if (ResyncUsn(rootDir, onJxr, result))
+      return result;
+    LogMsg(L"RootIndex: USN journal unreadable for '%s' (error %u), using "
+           L"directory times",
+           root_.c_str(), ::GetLastError());
+    usn_ = false;
+    volume_.reset();
+    result = {};
+  }
+
+  if (!timesValid_) {
+    // No baseline to compare against: one full pass builds it
+    dirs_.clear();
+    ListTree(root_, true, onJxr, result);
+    timesValid_ = true;
+    return result;
+  }
+  ResyncTimes(onJxr, result);
+  return result;
+}
+
+// Reads every create/rename record since the cursor and keeps the names
+// that pass the filter and whose parent directory lies under the root
+bool RootIndex::ResyncUsn(
+    HANDLE rootDir, const std::function<void(const std::wstring &)> &onJxr,
+    ResyncResult &result) {
+#ifdef FSCTL_READ_UNPRIVILEGED_USN_JOURNAL
+  const DWORD readCode = FSCTL_READ_UNPRIVILEGED_USN_JOURNAL;
+#else
+  const DWORD readCode = FSCTL_READ_USN_JOURNAL;
+#endif
+
+  READ_USN_JOURNAL_DATA_V0 read = {};
+  read.StartUsn = nextUsn_;
+  read.ReasonMask = kUsnReasons;
+  read.UsnJournalID = journalId_;
+
+  std::vector<uint64_t> buffer(64 * 1024 / sizeof(uint64_t)); // 8-aligned
+  std::unordered_map<DWORDLONG, std::wstring> parents;        // FRN → path
+  std::unordered_set<std::wstring> seen;
+
+  while (true) {
+    DWORD bytes = 0;
+    if (!::DeviceIoControl(volume_.get(), readCode, &read, sizeof(read),
+                           buffer.data(),
+                           static_cast<DWORD>(buffer.size() * 8), &bytes,
+                           nullptr))
+      return false; // journal wrapped, deleted or re-created
+    if (bytes <= sizeof(USN))
+      break; // caught up
+
+    const auto *base = reinterpret_cast<const uint8_t *>(buffer.data());
+    USN next = *reinterpret_cast<const USN *>(base);
+    for (DWORD offset = sizeof(USN); offset < bytes;) {
+      const auto *rec = reinterpret_cast<const USN_RECORD_V2 *>(base + offset);
+      if (rec->RecordLength == 0)
+        break;
+      offset += rec->RecordLength;
+      if (rec->MajorVersion != 2)
+        continue;
+
+      std::wstring name(
+          reinterpret_cast<const wchar_t *>(
+              reinterpret_cast<const uint8_t *>(rec) + rec->FileNameOffset),
+          rec->FileNameLength / sizeof(wchar_t));
+      if (!filter_.MayMatchName(name.data(), name.size()))
+        continue;
+
+      // Resolve the parent directory once per resync
+      auto it = parents.find(rec->ParentFileReferenceNumber);
+      if (it == parents.end()) {
+        std::wstring parentPath;
+        FILE_ID_DESCRIPTOR id = {};
+        id.dwSize = sizeof(id);
+        id.Type = FileIdType;
+        id.FileId.QuadPart =
+            static_cast<LONGLONG>(rec->ParentFileReferenceNumber);
+        UniqueHandle parent = MakeUniqueHandle(::OpenFileById(
+            rootDir, &id, 0,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            FILE_FLAG_BACKUP_SEMANTICS));
+        wchar_t path[MAX_PATH * 2];
+        if (parent &&
+            ::GetFinalPathNameByHandleW(parent.get(), path, _countof(path),
+                                        FILE_NAME_NORMALIZED |
+                                            VOLUME_NAME_DOS) != 0) {
+          parentPath = path;
+          if (parentPath.rfind(L"\\\\?\\", 0) == 0)
+            parentPath.erase(0, 4);
+        }
+        it = parents.emplace(rec->ParentFileReferenceNumber, parentPath).first;
+      }
+      if (it->second.empty() ||
+          !IsPathWithin(ToLowerPath(it->second), rootKey_))
+        continue;
+
+      std::wstring full = it->second + L"\\" + name;
+      if (!Wanted(full) || !seen.insert(ToLowerPath(full)).second)
+        continue;
+      if (::GetFileAttributesW(full.c_str()) == INVALID_FILE_ATTRIBUTES ||
+          IsConverted(full))
+        continue; // gone again (renamed away, converted)
+      onJxr(full);
+      ++result.found;
+    }
+    read.StartUsn = next;
+  }
+
+  nextUsn_ = checkpointUsn_ = read.StartUsn;
+  return true;
+}
+
+// Stats every known directory; lists only those whose last-write time moved
+// (a name was added, removed or renamed in them), and all of any new subtree
+void RootIndex::ResyncTimes(
+    const std::function<void(const std::wstring &)> &onJxr,
+    ResyncResult &result) {
+  std::vector<std::wstring> changed;
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    ++result.dirsChecked;
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (!::GetFileAttributesExW(it->second.path.c_str(), GetFileExInfoStandard,
+                                &attrs)) {
+      it = dirs_.erase(it); // directory removed
+      continue;
+    }
+    uint64_t lastWrite = ToU64(attrs.ftLastWriteTime);
+    if (lastWrite != it->second.lastWrite) {
+      it->second.lastWrite = lastWrite;
+      changed.push_back(it->second.path);
+    }
+    ++it;
+  }
+
+  std::vector<std::wstring> newDirs;
+  for (const auto &dir : changed)
+    ListDirectory(dir, true, onJxr, result, newDirs);
+  for (const auto &dir : newDirs)
+    ListTree(dir, true, onJxr, result);
+}
+
+// ============================================================================
+// Directory listing
+// ============================================================================
+void RootIndex::ListTree(
+    const std::wstring &dir, bool report,
+    const std::function<void(const std::wstring &)> &onJxr,
+    ResyncResult &result) {
+  std::vector<std::wstring> pending{dir};
+  if (dirs_.find(ToLowerPath(dir)) == dirs_.end()) {
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (::GetFileAttributesExW(dir.c_str(), GetFileExInfoStandard, &attrs))
+      dirs_[ToLowerPath(dir)] = {dir, ToU64(attrs.ftLastWriteTime)};
+  }
+  while (!pending.empty()) {
+    std::wstring current = std::move(pending.back());
+    pending.pop_back();
+    ListDirectory(current, report, onJxr, result, pending);
+  }
+}
+
+// Lists one directory: reports unconverted .jxr files (if `report`) and
+// appends subdirectories not yet in the index to `newDirs`
+void RootIndex::ListDirectory(
+    const std::wstring &dir, bool report,
+    const std::function<void(const std::wstring &)> &onJxr,
+    ResyncResult &result, std::vector<std::wstring> &newDirs) {
+  ++result.dirsListed;
+  WIN32_FIND_DATAW data;
+  HANDLE find = ::FindFirstFileExW((dir + L"\\*").c_str(), FindExInfoBasic,
+                                   &data, FindExSearchNameMatch, nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+
+  do {
+    std::wstring path = dir + L"\\" + data.cFileName;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      if (wcscmp(data.cFileName, L".") == 0 ||
+          wcscmp(data.cFileName, L"..") == 0 ||
+          (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+        continue;
+      std::wstring key = ToLowerPath(path);
+      if (dirs_.find(key) == dirs_.end()) {
+        dirs_[key] = {path, ToU64(data.ftLastWriteTime)};
+        newDirs.push_back(std::move(path));
+      }
+    } else if (report && Wanted(path) && !IsConverted(path)) {
+      onJxr(path);
+      ++result.found;
+    }
+  } while (::FindNextFileW(find, &data));
+  ::FindClose(find);
+}
+
+} // namespace jxr
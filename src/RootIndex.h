@@ -0,0 +1,96 @@
+#pragma once
+#include "Utils.h"
+#include "WatchFilter.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <winioctl.h>
+
+namespace jxr {
+
+/// Remembers enough about a watch root to find the files that may have
+/// appeared while change notifications were lost (ReadDirectoryChangesW
+/// buffer overflow), without walking every file in the tree. Files are
+/// reported when their root-relative path passes the watcher's WatchFilter
+/// and they have no .jpg next to them yet. What is remembered:
+///  - on NTFS/ReFS volumes whose USN change journal we can read, a journal
+///    cursor: resync reads only the records written since;
+///  - otherwise, every directory's last-write time: resync stats each known
+///    directory and lists only those that changed (plus new subtrees).
+class RootIndex {
+public:
+  struct ResyncResult {
+    bool usedUsn = false;
+    size_t dirsChecked = 0; // directories stat'ed
+    size_t dirsListed = 0;  // directories enumerated
+    size_t found = 0;       // unconverted matching files reported
+  };
+
+  enum class Mode {
+    Auto,          // USN journal where readable, else directory times
+    DirectoryTimes // never the journal (tests, or a journal known to lag)
+  };
+
+  explicit RootIndex(std::wstring root, Mode mode = Mode::Auto,
+                     WatchFilter filter = WatchFilter());
+
+  /// Takes the baseline: the USN cursor, which is cheap. In directory-time
+  /// mode nothing is walked here; the first Resync() lists the whole tree,
+  /// reports every unconverted match and builds the baseline then.
+  void Snapshot();
+
+  /// Moves the USN cursor to "now" after notifications were delivered
+  /// normally, so the next resync doesn't replay them. Cheap; no-op in
+  /// directory-time mode.
+  void Checkpoint();
+
+  /// Reports unconverted matching files that may have appeared since the last
+  /// snapshot/resync, and advances the baseline. `rootDir` is an open handle
+  /// on the root (used to resolve USN file IDs).
+  ResyncResult Resync(HANDLE rootDir,
+                      const std::function<void(const std::wstring &)> &onJxr);
+
+private:
+  struct DirEntry {
+    std::wstring path;
+    uint64_t lastWrite = 0;
+  };
+
+  bool Wanted(const std::wstring &path) const;
+  bool OpenUsn();
+  bool ResyncUsn(HANDLE rootDir,
+                 const std::function<void(const std::wstring &)> &onJxr,
+                 ResyncResult &result);
+  void ResyncTimes(const std::function<void(const std::wstring &)> &onJxr,
+                   ResyncResult &result);
+  void ListTree(const std::wstring &dir, bool report,
+                const std::function<void(const std::wstring &)> &onJxr,
+                ResyncResult &result);
+  void ListDirectory(const std::wstring &dir, bool report,
+                     const std::function<void(const std::wstring &)> &onJxr,
+                     ResyncResult &result, std::vector<std::wstring> &newDirs);
+
+  std::wstring root_;
+  std::wstring rootKey_; // lowercase
+  Mode mode_;
+  WatchFilter filter_;
+  size_t relativeStart_; // where the root-relative part of a path begins
+
+  // USN mode
+  UniqueHandle volume_;
+  DWORDLONG journalId_ = 0;
+  USN nextUsn_ = 0;       // resync reads from here
+  USN checkpointUsn_ = 0; // becomes nextUsn_ at the next Checkpoint()
+  bool usn_ = false;
+
+  // Directory-time mode, keyed by lowercase path
+  std::unordered_map<std::wstring, DirEntry> dirs_;
+  bool timesValid_ = false;
+};
+
+} // namespace jxr
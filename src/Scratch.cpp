@@ -0,0 +1,133 @@
+#include "Scratch.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <cwchar>
+#include <windows.h>
+
+namespace jxr {
+
+// ============================================================================
+// StagedFile
+// ============================================================================
+StagedFile &StagedFile::operator=(StagedFile &&other) noexcept {
+  if (this != &other) {
+    Reset();
+    owner_ = other.owner_;
+    path_ = std::move(other.path_);
+    bytes_ = other.bytes_;
+    other.owner_ = nullptr;
+    other.bytes_ = 0;
+  }
+  return *this;
+}
+
+void StagedFile::Reset() {
+  if (!owner_)
+    return;
+  if (!::DeleteFileW(path_.c_str()) &&
+      ::GetLastError() != ERROR_FILE_NOT_FOUND) {
+    LogMsg(L"Scratch: cannot delete %s, error %u", path_.c_str(),
+           ::GetLastError());
+  }
+  owner_->Return(bytes_);
+  owner_ = nullptr;
+  path_.clear();
+  bytes_ = 0;
+}
+
+// ============================================================================
+// ScratchSpace
+// ============================================================================
+bool ScratchSpace::Open(const std::wstring &dir, uint64_t maxBytes) {
+  if (!::CreateDirectoryW(dir.c_str(), nullptr) &&
+      ::GetLastError() != ERROR_ALREADY_EXISTS) {
+    LogMsg(L"Scratch: cannot create %s, error %u", dir.c_str(),
+           ::GetLastError());
+    return false;
+  }
+
+  // Nothing in here outlives a run: the sources are still on their shares
+  size_t removed = 0;
+  WIN32_FIND_DATAW fd;
+  HANDLE find = ::FindFirstFileExW((dir + L"\\*").c_str(), FindExInfoBasic,
+                                   &fd, FindExSearchNameMatch, nullptr, 0);
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+          ::DeleteFileW((dir + L"\\" + fd.cFileName).c_str()))
+        ++removed;
+    } while (::FindNextFileW(find, &fd));
+    ::FindClose(find);
+  }
+  if (removed)
+    LogMsg(L"Scratch: removed %zu files left by an earlier run", removed);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  dir_ = dir;
+  maxBytes_ = maxBytes;
+  usedBytes_ = 0;
+  return true;
+}
+
+bool ScratchSpace::StageIn(const std::wstring &source, StagedFile &staged) {
+  staged.Reset();
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  if (!::GetFileAttributesExW(source.c_str(), GetFileExInfoStandard, &attrs))
+    return false;
+  const uint64_t size =
+      (static_cast<uint64_t>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+
+  std::wstring local;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dir_.empty())
+      return false;
+    if (usedBytes_ + size > maxBytes_) {
+      ++overflows_;
+      LogMsg(L"Scratch: full (%.1f of %.1f MB), reading %s in place",
+             usedBytes_ / (1024.0 * 1024.0), maxBytes_ / (1024.0 * 1024.0),
+             source.c_str());
+      return false;
+    }
+    usedBytes_ += size;
+    wchar_t name[32];
+    swprintf_s(name, L"\\%016llx.jxr",
+               static_cast<unsigned long long>(nextId_++));
+    local = dir_ + name;
+  }
+  // Owns the reservation from here on, also if the copy fails
+  StagedFile file(this, local, size);
+
+  // The copy engine reads the share in large pipelined requests
+  TraceSpan span("stage in", "bytes", static_cast<int64_t>(size));
+  BOOL cancel = FALSE;
+  if (!::CopyFileExW(source.c_str(), local.c_str(), nullptr, nullptr, &cancel,
+                     COPY_FILE_FAIL_IF_EXISTS)) {
+    LogMsg(L"Scratch: cannot copy %s, error %u", source.c_str(),
+           ::GetLastError());
+    return false;
+  }
+  // Short-lived: keep it in the cache rather than flushing it to disk
+  ::SetFileAttributesW(local.c_str(), FILE_ATTRIBUTE_TEMPORARY);
+
+  ++staged_;
+  stagedBytes_ += size;
+  staged = std::move(file);
+  return true;
+}
+
+void ScratchSpace::Return(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  usedBytes_ -= bytes < usedBytes_ ? bytes : usedBytes_;
+}
+
+ScratchSpace::Stats ScratchSpace::GetStats() const {
+  Stats stats;
+  stats.staged = staged_;
+  stats.bytes = stagedBytes_;
+  stats.overflows = overflows_;
+  return stats;
+}
+
+} // namespace jxr
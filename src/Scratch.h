@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace jxr {
+
+class ScratchSpace;
+
+/// A source file copied into scratch space. Deleting it (Reset() or the
+/// destructor) gives its room back; the InputFile reading it must have been
+/// released first, since a mapped file cannot be deleted.
+class StagedFile {
+public:
+  StagedFile() = default;
+  ~StagedFile() { Reset(); }
+  StagedFile(StagedFile &&other) noexcept { *this = std::move(other); }
+  StagedFile &operator=(StagedFile &&other) noexcept;
+  StagedFile(const StagedFile &) = delete;
+  StagedFile &operator=(const StagedFile &) = delete;
+
+  bool valid() const { return owner_ != nullptr; }
+  const std::wstring &path() const { return path_; }
+
+  void Reset();
+
+private:
+  friend class ScratchSpace;
+  StagedFile(ScratchSpace *owner, std::wstring path, uint64_t bytes)
+      : owner_(owner), path_(std::move(path)), bytes_(bytes) {}
+
+  ScratchSpace *owner_ = nullptr;
+  std::wstring path_;
+  uint64_t bytes_ = 0;
+};
+
+/// Local scratch directory that sources on network shares are copied into
+/// before they are decoded. One sequential copy replaces holding the
+/// share's file open for the whole conversion, and the bytes are then
+/// mapped from local disk: page-cache memory the OS can reclaim, rather
+/// than a private buffer per file in flight.
+///
+/// The bytes staged at once are capped; a file that does not fit is read
+/// from the share directly, as without staging. Staged files are deleted
+/// as soon as the decoder is done with them, and whatever a crashed run
+/// left behind is deleted by Open().
+class ScratchSpace {
+public:
+  struct Stats {
+    uint64_t staged = 0;    // files copied in
+    uint64_t bytes = 0;     // bytes copied in
+    uint64_t overflows = 0; // files read directly because of the cap
+  };
+
+  ScratchSpace() = default;
+  ScratchSpace(const ScratchSpace &) = delete;
+  ScratchSpace &operator=(const ScratchSpace &) = delete;
+
+  /// Creates `dir` if needed and empties it.
+  bool Open(const std::wstring &dir, uint64_t maxBytes);
+
+  /// Copies `source` into scratch space. Returns false, leaving `staged`
+  /// invalid, if scratch is not open, the file would pass the cap or the
+  /// copy fails; the caller then reads `source` itself.
+  bool StageIn(const std::wstring &source, StagedFile &staged);
+
+  Stats GetStats() const;
+
+private:
+  friend class StagedFile;
+  void Return(uint64_t bytes);
+
+  mutable std::mutex mutex_; // dir_, the cap and the byte count
+  std::wstring dir_;
+  uint64_t maxBytes_ = 0;
+  uint64_t usedBytes_ = 0;
+  uint64_t nextId_ = 0;
+
+  std::atomic<uint64_t> staged_{0};
+  std::atomic<uint64_t> stagedBytes_{0};
+  std::atomic<uint64_t> overflows_{0};
+};
+
+} // namespace jxr
@@ -0,0 +1,225 @@
+#include "ThreadPool.h"
+#include "MemoryStats.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace jxr {
+
+// Worker identity of the current thread, so Submit() can push locally
+static thread_local const ThreadPool *t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+// ============================================================================
+// Setup / teardown
+// ============================================================================
+ThreadPool::ThreadPool(unsigned threads) {
+  if (threads == 0) {
+    unsigned hw = std::thread::hardware_concurrency();
+    threads = hw > 1 ? hw - 1 : 1;
+  }
+  for (unsigned i = 0; i < threads; ++i)
+    workers_.push_back(std::make_unique<Worker>());
+  for (unsigned i = 0; i < threads; ++i)
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &t : threads_) {
+    if (t.joinable())
+      t.join();
+  }
+}
+
+ThreadPool &ThreadPool::Shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+// ============================================================================
+// Queueing and stealing
+// ============================================================================
+void ThreadPool::Submit(Task task) {
+  // The task's allocations count against the job that submitted it
+  if (MemoryCounters *owner = CurrentMemoryCounters()) {
+    task = [owner, inner = std::move(task)] {
+      MemoryScope scope(owner);
+      inner();
+    };
+  }
+  size_t target = (t_pool == this) ? t_index
+                                   : nextQueue_++ % workers_.size();
+  {
+    // Count first (so a pop can never take it below zero), and under the
+    // sleep lock so a worker about to wait sees it
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    ++queued_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+    workers_[target]->tasks.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+bool ThreadPool::TryPop(size_t self, Task &task) {
+  const size_t n = workers_.size();
+  if (self < n) {
+    Worker &own = *workers_[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  // Steal the oldest task of a sibling, starting with the next one along
+  for (size_t k = 1; k <= n; ++k) {
+    size_t victim = (self + k) % n;
+    if (victim == self)
+      continue;
+    Worker &w = *workers_[victim];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.tasks.empty()) {
+      task = std::move(w.tasks.front());
+      w.tasks.pop_front();
+      --queued_;
+      ++stolen_;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunOne() {
+  if (queued_ == 0)
+    return false;
+  Task task;
+  size_t self = (t_pool == this) ? t_index : workers_.size();
+  if (!TryPop(self, task))
+    return false;
+  task();
+  ++executed_;
+  return true;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+  t_pool = this;
+  t_index = index;
+#ifdef _WIN32
+  // Conversion kernels must not compete with whatever the user is doing
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+  TraceThreadName("pool");
+
+  while (true) {
+    Task task;
+    if (TryPop(index, task)) {
+      {
+        TraceSpan span("pool task");
+        task();
+      }
+      ++executed_;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    wake_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+    if (stopping_ && queued_ == 0)
+      break;
+  }
+}
+
+// ============================================================================
+// Data-parallel loop: chunks are claimed from a shared counter, so late
+// helpers find nothing left and return at once, and the caller never waits
+// on a chunk that no thread has started.
+// ============================================================================
+void ThreadPool::ParallelFor(size_t count, size_t grain,
+                             const std::function<void(size_t, size_t)> &body) {
+  if (count == 0)
+    return;
+  grain = std::max<size_t>(grain, 1);
+  const size_t chunks = (count + grain - 1) / grain;
+  if (chunks == 1 || workers_.empty()) {
+    body(0, count);
+    return;
+  }
+
+  struct Loop {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    size_t chunks = 0, count = 0, grain = 0;
+    const std::function<void(size_t, size_t)> *body = nullptr;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto loop = std::make_shared<Loop>();
+  loop->chunks = chunks;
+  loop->count = count;
+  loop->grain = grain;
+  loop->body = &body;
+
+  auto drain = [loop] {
+    while (true) {
+      size_t c = loop->next++;
+      if (c >= loop->chunks)
+        return;
+      size_t begin = c * loop->grain;
+      (*loop->body)(begin, std::min(begin + loop->grain, loop->count));
+      if (++loop->done == loop->chunks) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->finished.notify_all();
+      }
+    }
+  };
+
+  size_t helpers = std::min<size_t>(chunks - 1, workers_.size());
+  for (size_t i = 0; i < helpers; ++i)
+    Submit(drain);
+  drain();
+
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->finished.wait(lock, [&] { return loop->done == loop->chunks; });
+}
+
+// ============================================================================
+// TaskGroup
+// ============================================================================
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : pool_(pool), state_(std::make_shared<State>()) {}
+
+void TaskGroup::Run(ThreadPool::Task task) {
+  ++state_->pending;
+  auto state = state_;
+  pool_.Submit([state, task = std::move(task)] {
+    task();
+    if (--state->pending == 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->done.notify_all();
+    }
+  });
+}
+
+void TaskGroup::Wait() {
+  while (state_->pending > 0) {
+    if (pool_.RunOne())
+      continue;
+    // Nothing to help with: the remaining tasks are running elsewhere
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->done.wait_for(lock, std::chrono::milliseconds(1),
+                          [this] { return state_->pending == 0; });
+  }
+}
+
+} // namespace jxr
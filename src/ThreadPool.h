@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jxr {
+
+/// Work-stealing thread pool shared by file-level jobs and row-chunk
+/// kernels. Each worker owns a deque: it runs its own newest task first
+/// (still warm in cache) and, when empty, steals the oldest task from a
+/// sibling. Standard C++ only, so it builds outside Windows too.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  /// `threads` = 0 → one worker per hardware thread, minus one for the
+  /// caller (which takes part in ParallelFor / TaskGroup::Wait).
+  explicit ThreadPool(unsigned threads = 0);
+  /// Runs every queued task, then joins the workers.
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// Process-wide pool used by the conversion kernels.
+  static ThreadPool &Shared();
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+  /// Queues a task. From a worker it goes to that worker's own deque,
+  /// otherwise the deques are filled round-robin. The task runs under the
+  /// caller's MemoryScope, if any.
+  void Submit(Task task);
+
+  /// Runs one queued task on the calling thread. Returns false if every
+  /// deque was empty.
+  bool RunOne();
+
+  /// Calls body(begin, end) over [0, count) in chunks of `grain` items,
+  /// using idle workers and the calling thread. Returns when every chunk
+  /// has run. Safe to call from inside a pool task: the caller can finish
+  /// all chunks on its own if no worker is free.
+  void ParallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)> &body);
+
+  /// Tasks run so far, and how many of those were stolen.
+  uint64_t executed() const { return executed_.load(); }
+  uint64_t stolen() const { return stolen_.load(); }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool TryPop(size_t self, Task &task);
+  void WorkerLoop(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::mutex sleepMutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> nextQueue_{0};
+  std::atomic<bool> stopping_{false};
+  std::atomic<uint64_t> executed_{0};
+  std::atomic<uint64_t> stolen_{0};
+};
+
+/// A batch of tasks on a pool. Wait() runs queued work on the calling
+/// thread until every task of the batch has finished.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool &pool);
+  ~TaskGroup() { Wait(); }
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  void Run(ThreadPool::Task task);
+  void Wait();
+
+private:
+  struct State {
+    std::atomic<size_t> pending{0};
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+
+  ThreadPool &pool_;
+  std::shared_ptr<State> state_;
+};
+
+} // namespace jxr
@@ -1,6 +1,7 @@
 #pragma once
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <deque>
 #include <mutex>
 #include <optional>
@@ -22,9 +23,7 @@ public:
     std::lock_guard<std::mutex> lock(mutex_);
     if (queue_.empty())
       return std::nullopt;
-    T val = std::move(queue_.front());
-    queue_.pop_front();
-    return val;
+    return PopFront();
   }
 
   // Waits up to `timeout` for an item. Returns nullopt on timeout or shutdown.
@@ -37,9 +36,7 @@ public:
     }
     if (shutdown_ || queue_.empty())
       return std::nullopt;
-    T val = std::move(queue_.front());
-    queue_.pop_front();
-    return val;
+    return PopFront();
   }
 
   bool empty() const {
@@ -57,6 +54,19 @@ public:
     {
       std::lock_guard<std::mutex> lock(mutex_);
       queue_.push_front(std::move(value));
+      ++priority_;
+    }
+    cv_.notify_one();
+  }
+
+  // Queue ahead of every normal item but behind earlier priority items and
+  // retries, so a batch of urgent items keeps its order
+  void push_priority(T value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.insert(queue_.begin() + static_cast<std::ptrdiff_t>(priority_),
+                    std::move(value));
+      ++priority_;
     }
     cv_.notify_one();
   }
@@ -71,10 +81,69 @@ public:
   }
 
 private:
+  // Caller holds the lock; the queue is not empty
+  T PopFront() {
+    T val = std::move(queue_.front());
+    queue_.pop_front();
+    if (priority_ > 0)
+      --priority_;
+    return val;
+  }
+
   mutable std::mutex mutex_;
   std::condition_variable cv_;
   std::deque<T> queue_;
+  size_t priority_ = 0; // leading items queued by push_front / push_priority
   bool shutdown_ = false;
 };
 
+// Fixed-capacity hand-off buffer between pipeline stages. push() blocks
+// while full (back-pressure), pop() blocks while empty. After close(),
+// push() fails and pop() drains what is left, then returns nullopt.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  bool push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notFull_.wait(lock,
+                  [this] { return queue_.size() < capacity_ || closed_; });
+    if (closed_)
+      return false;
+    queue_.push_back(std::move(value));
+    lock.unlock();
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+    if (queue_.empty())
+      return std::nullopt;
+    T val = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    notFull_.notify_one();
+    return val;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    notFull_.notify_all();
+    notEmpty_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+  std::deque<T> queue_;
+  size_t capacity_;
+  bool closed_ = false;
+};
+
 } // namespace jxr
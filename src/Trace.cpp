@@ -0,0 +1,258 @@
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace jxr {
+
+struct TraceEvent {
+  const char *name;
+  const char *argName;
+  int64_t tsUs;
+  int64_t durUs;
+  int64_t arg;
+  char phase; // 'X' span, 'i' instant, 'C' counter
+};
+
+// One thread's events. Only its owner writes; the mutex is uncontended
+// except while a dump copies the ring out.
+struct TraceRing {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+  size_t next = 0;
+  bool wrapped = false;
+  uint32_t tid = 0;
+  const char *name = nullptr;
+};
+
+// Rings of exited threads stay for the dump, but only this many: each
+// short-lived thread (job server clients, one per connection) would
+// otherwise pin its ring for the life of the process
+static constexpr size_t kMaxExitedRings = 8;
+
+struct TraceState {
+  std::mutex mutex; // rings, exited, nextTid, outputPath
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  std::deque<TraceRing *> exited; // oldest first, all still in `rings`
+  uint32_t nextTid = 1;
+  std::wstring outputPath;
+  size_t capacity = 0;
+  std::chrono::steady_clock::time_point start;
+};
+
+static std::atomic<bool> g_traceEnabled{false};
+
+static TraceState &State() {
+  static TraceState state;
+  return state;
+}
+
+// Hands the thread's ring over to the exited list when the thread ends
+struct ThreadRingOwner {
+  TraceRing *ring = nullptr;
+  ~ThreadRingOwner();
+};
+static thread_local ThreadRingOwner t_ring;
+
+static int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - State().start)
+      .count();
+}
+
+static TraceRing *ThreadRing() {
+  if (t_ring.ring)
+    return t_ring.ring;
+  auto ring = std::make_shared<TraceRing>();
+  TraceState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  ring->events.resize(state.capacity);
+  ring->tid = state.nextTid++;
+  state.rings.push_back(ring);
+  t_ring.ring = ring.get();
+  return t_ring.ring;
+}
+
+ThreadRingOwner::~ThreadRingOwner() {
+  if (!ring)
+    return;
+  TraceState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.exited.push_back(ring);
+  if (state.exited.size() <= kMaxExitedRings)
+    return;
+  // Drop the oldest; a dump in progress holds its own reference
+  TraceRing *oldest = state.exited.front();
+  state.exited.pop_front();
+  state.rings.erase(std::find_if(state.rings.begin(), state.rings.end(),
+                                 [oldest](const auto &r) {
+                                   return r.get() == oldest;
+                                 }));
+}
+
+static void Record(const TraceEvent &event) {
+  TraceRing *ring = ThreadRing();
+  std::lock_guard<std::mutex> lock(ring->mutex);
+  if (ring->events.empty())
+    return;
+  ring->events[ring->next] = event;
+  if (++ring->next == ring->events.size()) {
+    ring->next = 0;
+    ring->wrapped = true;
+  }
+}
+
+// Names are our own literals, but quotes and backslashes would still break
+// the JSON
+static void AppendJsonString(std::string &out, const char *s) {
+  out += '"';
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      out += '\\';
+    out += *s;
+  }
+  out += '"';
+}
+
+// ============================================================================
+// Recording
+// ============================================================================
+void TraceEnable(const std::wstring &outputPath, size_t eventsPerThread) {
+  TraceState &state = State();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (g_traceEnabled)
+      return;
+    state.outputPath = outputPath;
+    state.capacity = eventsPerThread ? eventsPerThread : 1;
+    state.start = std::chrono::steady_clock::now();
+  }
+  g_traceEnabled.store(true, std::memory_order_release);
+  LogMsg(L"Trace: recording, %zu events per thread, dump to %s",
+         state.capacity, outputPath.c_str());
+}
+
+bool TraceEnabled() {
+  return g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+void TraceThreadName(const char *name) {
+  if (!TraceEnabled())
+    return;
+  TraceRing *ring = ThreadRing();
+  std::lock_guard<std::mutex> lock(ring->mutex);
+  ring->name = name;
+}
+
+void TraceInstant(const char *name, const char *argName, int64_t arg) {
+  if (TraceEnabled())
+    Record({name, argName, NowUs(), 0, arg, 'i'});
+}
+
+void TraceCounter(const char *name, int64_t value) {
+  if (TraceEnabled())
+    Record({name, "value", NowUs(), 0, value, 'C'});
+}
+
+TraceSpan::TraceSpan(const char *name, const char *argName, int64_t arg)
+    : name_(name), argName_(argName), arg_(arg),
+      startUs_(TraceEnabled() ? NowUs() : -1) {}
+
+TraceSpan::~TraceSpan() {
+  if (startUs_ >= 0)
+    Record({name_, argName_, startUs_, NowUs() - startUs_, arg_, 'X'});
+}
+
+// ============================================================================
+// Chrome trace event JSON
+// ============================================================================
+bool TraceDump() {
+  if (!TraceEnabled())
+    return false;
+  TraceState &state = State();
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  std::wstring path;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    rings = state.rings;
+    path = state.outputPath;
+  }
+
+  const unsigned long pid = ::GetCurrentProcessId();
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  size_t count = 0;
+  bool overwritten = false;
+  char line[128];
+  for (const auto &ring : rings) {
+    std::vector<TraceEvent> events;
+    const char *threadName = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(ring->mutex);
+      threadName = ring->name;
+      // Oldest first
+      if (ring->wrapped) {
+        events.assign(ring->events.begin() + ring->next, ring->events.end());
+        overwritten = true;
+      }
+      events.insert(events.end(), ring->events.begin(),
+                    ring->events.begin() + ring->next);
+    }
+
+    if (threadName) {
+      snprintf(line, sizeof(line),
+               "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%lu,"
+               "\"tid\":%u,\"args\":{\"name\":",
+               pid, ring->tid);
+      json += line;
+      AppendJsonString(json, threadName);
+      json += "}},\n";
+    }
+    for (const TraceEvent &e : events) {
+      json += "{\"name\":";
+      AppendJsonString(json, e.name);
+      snprintf(line, sizeof(line),
+               ",\"ph\":\"%c\",\"pid\":%lu,\"tid\":%u,\"ts\":%lld", e.phase,
+               pid, ring->tid, static_cast<long long>(e.tsUs));
+      json += line;
+      if (e.phase == 'X') {
+        snprintf(line, sizeof(line), ",\"dur\":%lld",
+                 static_cast<long long>(e.durUs));
+        json += line;
+      } else if (e.phase == 'i') {
+        json += ",\"s\":\"t\"";
+      }
+      if (e.argName) {
+        json += ",\"args\":{";
+        AppendJsonString(json, e.argName);
+        snprintf(line, sizeof(line), ":%lld}", static_cast<long long>(e.arg));
+        json += line;
+      }
+      json += "},\n";
+      ++count;
+    }
+  }
+  if (json.back() == '\n' && json[json.size() - 2] == ',')
+    json.erase(json.size() - 2, 1); // no trailing comma in JSON
+  json += "]}\n";
+
+  FILE *f = nullptr;
+  if (_wfopen_s(&f, path.c_str(), L"wb") != 0 || !f) {
+    LogMsg(L"Trace: cannot write %s", path.c_str());
+    return false;
+  }
+  bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+  ok = fclose(f) == 0 && ok;
+  LogMsg(L"Trace: wrote %zu events from %zu threads to %s%s", count,
+         rings.size(), path.c_str(),
+         overwritten ? L" (older events were overwritten)" : L"");
+  return ok;
+}
+
+} // namespace jxr
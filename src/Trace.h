@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace jxr {
+
+// ============================================================================
+// Opt-in timeline tracer (--trace <file>). Every thread records into its own
+// fixed-size ring buffer (the newest events win when it wraps); the dump is
+// Chrome trace event JSON, loadable in Perfetto or chrome://tracing. While
+// disabled, each call is one relaxed atomic load.
+//
+// Names passed to the functions below must be string literals (or otherwise
+// live for the whole process): only the pointer is stored.
+// ============================================================================
+
+/// Starts recording. `outputPath` is where TraceDump() writes.
+void TraceEnable(const std::wstring &outputPath,
+                 size_t eventsPerThread = 16 * 1024);
+
+bool TraceEnabled();
+
+/// Labels the calling thread's track.
+void TraceThreadName(const char *name);
+
+/// A point in time, with an optional numeric argument.
+void TraceInstant(const char *name, const char *argName = nullptr,
+                  int64_t arg = 0);
+
+/// A value over time (e.g. queue depth), drawn as a counter track.
+void TraceCounter(const char *name, int64_t value);
+
+/// Writes everything recorded so far. Recording continues. Returns false if
+/// tracing is off or the file cannot be written.
+bool TraceDump();
+
+/// Records the time between construction and destruction as one span on the
+/// calling thread.
+class TraceSpan {
+public:
+  explicit TraceSpan(const char *name, const char *argName = nullptr,
+                     int64_t arg = 0);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *name_;
+  const char *argName_;
+  int64_t arg_;
+  int64_t startUs_; // -1: tracing was off at construction
+};
+
+} // namespace jxr
@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <shlobj.h>
 #include <string>
 #include <windows.h>
@@ -45,21 +46,37 @@ struct ComInit {
 // ============================================================================
 // Simple file logger
 // ============================================================================
-inline std::wstring GetLogPath() {
+// %LOCALAPPDATA%\JxrAutoCleaner (created on demand); empty on failure
+inline std::wstring GetAppDataDir() {
   wchar_t *appData = nullptr;
   if (SUCCEEDED(::SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr,
                                        &appData))) {
     std::wstring path(appData);
     ::CoTaskMemFree(appData);
     path += L"\\JxrAutoCleaner";
-    std::filesystem::create_directories(path);
-    return path + L"\\log.txt";
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+    return path;
   }
+  return L"";
+}
+
+inline std::wstring GetLogPath() {
+  std::wstring dir = GetAppDataDir();
+  if (!dir.empty())
+    return dir + L"\\log.txt";
   return L"JxrAutoCleaner.log";
 }
 
+// Serializes appends with TrimLog(), which may run on a background thread
+inline std::mutex &LogMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
 inline void LogMsg(const wchar_t *fmt, ...) {
   static std::wstring logPath = GetLogPath();
+  std::lock_guard<std::mutex> lock(LogMutex());
   FILE *f = nullptr;
   _wfopen_s(&f, logPath.c_str(), L"a");
   if (!f)
@@ -85,6 +102,7 @@ inline void LogMsg(const wchar_t *fmt, ...) {
 // ============================================================================
 inline void TrimLog(size_t maxLines = 500) {
   std::wstring logPath = GetLogPath();
+  std::lock_guard<std::mutex> lock(LogMutex());
   FILE *f = nullptr;
   _wfopen_s(&f, logPath.c_str(), L"r");
   if (!f)
@@ -110,6 +128,52 @@ inline void TrimLog(size_t maxLines = 500) {
   fclose(f);
 }
 
+// ============================================================================
+// UTF-8 ↔ UTF-16 helpers
+// ============================================================================
+inline std::string ToUtf8(const std::wstring &w) {
+  int len = ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(),
+                                  static_cast<int>(w.size()), nullptr, 0,
+                                  nullptr, nullptr);
+  std::string out(len, '\0');
+  ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(), static_cast<int>(w.size()),
+                        out.data(), len, nullptr, nullptr);
+  return out;
+}
+
+inline std::wstring FromUtf8(const char *s, int len) {
+  int wlen = ::MultiByteToWideChar(CP_UTF8, 0, s, len, nullptr, 0);
+  std::wstring out(wlen, L'\0');
+  ::MultiByteToWideChar(CP_UTF8, 0, s, len, out.data(), wlen);
+  return out;
+}
+
+// ============================================================================
+// Path helpers
+// ============================================================================
+inline std::wstring ToLowerPath(std::wstring s) {
+  for (auto &c : s)
+    c = static_cast<wchar_t>(::towlower(c));
+  return s;
+}
+
+// Case-insensitive ".jxr" extension check
+inline bool HasJxrExtension(const std::wstring &filename) {
+  if (filename.size() < 4)
+    return false;
+  return ToLowerPath(filename.substr(filename.size() - 4)) == L".jxr";
+}
+
+// True if `child` is `parent` or lies below it (both lowercase, no trailing
+// separator except on a drive root)
+inline bool IsPathWithin(const std::wstring &child,
+                         const std::wstring &parent) {
+  if (parent.empty() || child.compare(0, parent.size(), parent) != 0)
+    return false;
+  return child.size() == parent.size() || parent.back() == L'\\' ||
+         child[parent.size()] == L'\\';
+}
+
 // ============================================================================
 // Get the user's Videos folder path
 // ============================================================================
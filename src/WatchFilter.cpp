@@ -0,0 +1,139 @@
+#include "WatchFilter.h"
+
+#include <cstdint>
+#include <cwctype>
+
+namespace jxr {
+
+// Case folding without a locale lookup for the ASCII names that make up
+// nearly every capture path
+static wchar_t Fold(wchar_t c) {
+  if (c < 0x80)
+    return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c + 32) : c;
+  return static_cast<wchar_t>(::towlower(c));
+}
+
+// Iterative glob match with single-star backtracking: linear in practice,
+// no recursion and no allocation. `pattern` is already folded.
+static bool Glob(const wchar_t *pattern, size_t patternLength,
+                 const wchar_t *s, size_t length) {
+  size_t p = 0, i = 0;
+  size_t starP = SIZE_MAX, starI = 0;
+  while (i < length) {
+    if (p < patternLength &&
+        (pattern[p] == L'?' || pattern[p] == Fold(s[i]))) {
+      ++p;
+      ++i;
+    } else if (p < patternLength && pattern[p] == L'*') {
+      starP = p++;
+      starI = i;
+    } else if (starP != SIZE_MAX) {
+      p = starP + 1;
+      i = ++starI;
+    } else {
+      return false;
+    }
+  }
+  while (p < patternLength && pattern[p] == L'*')
+    ++p;
+  return p == patternLength;
+}
+
+// ============================================================================
+// Compile
+// ============================================================================
+WatchFilter::WatchFilter() : WatchFilter({L"*.jxr"}, {}) {}
+
+WatchFilter::WatchFilter(const std::vector<std::wstring> &include,
+                         const std::vector<std::wstring> &exclude) {
+  for (const auto &pattern : include) {
+    if (!pattern.empty())
+      include_.push_back(Compile(pattern));
+  }
+  for (const auto &pattern : exclude) {
+    if (!pattern.empty())
+      exclude_.push_back(Compile(pattern));
+  }
+}
+
+WatchFilter::Pattern WatchFilter::Compile(const std::wstring &pattern) {
+  Pattern p;
+  for (wchar_t c : pattern)
+    p.text.push_back(c == L'/' ? L'\\' : Fold(c));
+  p.wholePath = p.text.find(L'\\') != std::wstring::npos;
+
+  // "*.ext" and ".ext": a suffix compare, no glob
+  std::wstring ext = p.text;
+  if (ext.size() > 1 && ext[0] == L'*')
+    ext.erase(0, 1);
+  if (!p.wholePath && ext.size() > 1 && ext[0] == L'.' &&
+      ext.find_first_of(L"*?", 1) == std::wstring::npos) {
+    p.text = ext;
+    p.suffix = true;
+  }
+  return p;
+}
+
+// ============================================================================
+// Match
+// ============================================================================
+bool WatchFilter::MatchOne(const Pattern &p, const wchar_t *s, size_t length) {
+  if (!p.suffix)
+    return Glob(p.text.data(), p.text.size(), s, length);
+  const size_t n = p.text.size();
+  if (length < n)
+    return false;
+  for (size_t i = 0; i < n; ++i) {
+    if (Fold(s[length - n + i]) != p.text[i])
+      return false;
+  }
+  return true;
+}
+
+bool WatchFilter::Matches(const wchar_t *path, size_t length) const {
+  // File name: after the last separator
+  size_t nameStart = length;
+  while (nameStart > 0 && path[nameStart - 1] != L'\\')
+    --nameStart;
+  const wchar_t *name = path + nameStart;
+  const size_t nameLength = length - nameStart;
+
+  bool included = false;
+  for (const auto &p : include_) {
+    included = p.wholePath ? MatchOne(p, path, length)
+                           : MatchOne(p, name, nameLength);
+    if (included)
+      break;
+  }
+  if (!included)
+    return false;
+
+  for (const auto &p : exclude_) {
+    if (p.wholePath) {
+      if (MatchOne(p, path, length))
+        return false;
+      continue;
+    }
+    // Every component, folders first
+    size_t begin = 0;
+    while (begin <= length) {
+      size_t end = begin;
+      while (end < length && path[end] != L'\\')
+        ++end;
+      if (end > begin && MatchOne(p, path + begin, end - begin))
+        return false;
+      begin = end + 1;
+    }
+  }
+  return true;
+}
+
+bool WatchFilter::MayMatchName(const wchar_t *name, size_t length) const {
+  for (const auto &p : include_) {
+    if (p.wholePath || MatchOne(p, name, length))
+      return true;
+  }
+  return false;
+}
+
+} // namespace jxr
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace jxr {
+
+/// Include / exclude patterns for watcher events, compiled once and then
+/// matched against root-relative paths straight from the notification
+/// buffer: no allocation and no lowercase copy per event. Matching is case-
+/// insensitive. Standard C++ only.
+///
+/// Patterns are globs (`*` any run of characters, `?` one character; `/`
+/// reads as `\`):
+///  - include: without a `\` the pattern matches the file name ("*.jxr"),
+///    with one the whole relative path ("NVIDIA\*.jxr")
+///  - exclude: without a `\` the pattern matches any one component, so
+///    "Temp" or "*.partial" also excludes everything below such a folder;
+///    with one the whole relative path
+/// A path passes if it matches an include and no exclude. Extension
+/// patterns ("*.jxr", ".jxr") compile to a suffix compare.
+class WatchFilter {
+public:
+  /// Includes "*.jxr", excludes nothing.
+  WatchFilter();
+  WatchFilter(const std::vector<std::wstring> &include,
+              const std::vector<std::wstring> &exclude);
+
+  bool Matches(const wchar_t *path, size_t length) const;
+  bool Matches(const std::wstring &path) const {
+    return Matches(path.data(), path.size());
+  }
+
+  /// Cheap prefilter when only the file name is known yet (a USN record):
+  /// false if no path ending in `name` can match. True whenever a whole-path
+  /// include might, so Matches() still decides.
+  bool MayMatchName(const wchar_t *name, size_t length) const;
+
+  size_t includeCount() const { return include_.size(); }
+  size_t excludeCount() const { return exclude_.size(); }
+
+private:
+  struct Pattern {
+    std::wstring text; // folded; for suffix patterns just ".ext"
+    bool suffix = false;
+    bool wholePath = false;
+  };
+
+  static Pattern Compile(const std::wstring &pattern);
+  static bool MatchOne(const Pattern &p, const wchar_t *s, size_t length);
+
+  std::vector<Pattern> include_;
+  std::vector<Pattern> exclude_;
+};
+
+} // namespace jxr
@@ -1,15 +1,31 @@
 #include "Converter.h"
 #include "FileWatcher.h"
+#include "JobServer.h"
+#include "Journal.h"
+#include "JxrHeader.h"
+#include "LatencyHarness.h"
+#include "MemoryStats.h"
+#include "ParamSweep.h"
+#include "PathArena.h"
+#include "Pipeline.h"
+#include "ResultCache.h"
+#include "Scratch.h"
 #include "SystemCheck.h"
+#include "ThreadPool.h"
 #include "ThreadSafeQueue.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "resource.h"
 
+#include <atomic>
 #include <chrono>
 #include <filesystem>
+#include <mutex>
 #include <shellapi.h>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 #include <windows.h>
 
 namespace fs = std::filesystem;
@@ -19,10 +35,23 @@ using namespace jxr;
 // Globals
 // ============================================================================
 static HANDLE g_shutdownEvent = nullptr;
-static ThreadSafeQueue<std::wstring> g_queue;
+static HANDLE g_startupDone = nullptr; // set when deferred startup finishes
+static std::chrono::steady_clock::time_point g_startTime;
+static PathQueue g_queue;
 static NOTIFYICONDATAW g_nid = {};
-static std::wstring g_videosDir;
+static FileWatcher g_watcher;
+static std::vector<std::wstring> g_watchRoots;
+static std::vector<std::wstring> g_extraRoots; // --watch <dir>
 static HINSTANCE g_hInstance = nullptr;
+static ConvertOptions g_convertOptions;
+static ConversionJournal g_journal;
+static ResultCache g_resultCache;
+static ScratchSpace g_scratch;
+static JobServer g_jobServer;
+static CancelSource g_preempt; // tripped when a game takes the foreground
+static std::atomic<bool> g_foregroundBusy{false};
+static bool g_idleGate = true;                // off under --latency
+static CaptureSimulator *g_harness = nullptr; // --latency
 
 // ============================================================================
 // Registry helpers for startup toggle
@@ -71,33 +100,224 @@ static void RemoveFromStartup() {
 }
 
 // ============================================================================
-// Force scan: queue all existing JXR files in the watched folder
+// Watch roots: the Videos folder (ShadowPlay, and Game Bar's Captures below
+// it), Steam's screenshot tree, plus folders from --watch and from the
+// WatchRoots value (REG_MULTI_SZ) under HKCU\Software\JxrAutoCleaner.
+// WatchInclude / WatchExclude (REG_MULTI_SZ, globs) filter what is queued.
+// ============================================================================
+static const wchar_t *kSettingsKeyPath = L"Software\\JxrAutoCleaner";
+
+static std::vector<std::wstring> ReadRegistryMultiString(const wchar_t *name) {
+  std::vector<std::wstring> values;
+  DWORD size = 0;
+  if (::RegGetValueW(HKEY_CURRENT_USER, kSettingsKeyPath, name,
+                     RRF_RT_REG_MULTI_SZ, nullptr, nullptr,
+                     &size) != ERROR_SUCCESS)
+    return values;
+  std::vector<wchar_t> data(size / sizeof(wchar_t) + 1, L'\0');
+  if (::RegGetValueW(HKEY_CURRENT_USER, kSettingsKeyPath, name,
+                     RRF_RT_REG_MULTI_SZ, nullptr, data.data(),
+                     &size) != ERROR_SUCCESS)
+    return values;
+  for (const wchar_t *p = data.data(); *p; p += wcslen(p) + 1)
+    values.emplace_back(p);
+  return values;
+}
+
+static std::wstring GetSteamUserDataDir() {
+  wchar_t steamPath[MAX_PATH];
+  DWORD size = sizeof(steamPath);
+  if (::RegGetValueW(HKEY_CURRENT_USER, L"Software\\Valve\\Steam",
+                     L"SteamPath", RRF_RT_REG_SZ, nullptr, steamPath,
+                     &size) != ERROR_SUCCESS)
+    return L"";
+  std::error_code ec;
+  fs::path userData = fs::path(steamPath) / L"userdata";
+  return fs::is_directory(userData, ec) ? userData.wstring() : L"";
+}
+
+static void ConfigureWatchRoots() {
+  g_watcher.AddRoot(GetVideosFolder());
+  std::wstring steam = GetSteamUserDataDir();
+  if (!steam.empty())
+    g_watcher.AddRoot(steam);
+  for (const auto &root : ReadRegistryMultiString(L"WatchRoots"))
+    g_watcher.AddRoot(root);
+  for (const auto &root : g_extraRoots)
+    g_watcher.AddRoot(root);
+  g_watchRoots = g_watcher.Roots();
+
+  std::vector<std::wstring> include = ReadRegistryMultiString(L"WatchInclude");
+  if (include.empty())
+    include.push_back(L"*.jxr");
+  g_watcher.SetFilter(
+      WatchFilter(include, ReadRegistryMultiString(L"WatchExclude")));
+}
+
+// ============================================================================
+// Force scan: queue all existing files in the watched folders that the
+// watcher's filter accepts
 // ============================================================================
 static void ForceScanNow() {
   LogMsg(L"Force scan requested");
+  const WatchFilter &filter = g_watcher.Filter();
   int count = 0;
-  try {
-    for (const auto &entry : fs::recursive_directory_iterator(g_videosDir)) {
-      if (!entry.is_regular_file())
-        continue;
-      auto ext = entry.path().extension().wstring();
-      std::transform(ext.begin(), ext.end(), ext.begin(), [](wchar_t c) {
-        return static_cast<wchar_t>(::towlower(c));
-      });
-      if (ext == L".jxr") {
+  for (const auto &root : g_watchRoots) {
+    // Filtered by the path below the root, like live events
+    const size_t skip = root.size() + (root.back() == L'\\' ? 0 : 1);
+    try {
+      for (const auto &entry : fs::recursive_directory_iterator(
+               root, fs::directory_options::skip_permission_denied)) {
+        if (!entry.is_regular_file())
+          continue;
+        const std::wstring &path = entry.path().native();
+        if (path.size() <= skip ||
+            !filter.Matches(path.data() + skip, path.size() - skip))
+          continue;
         // Skip if already converted
         fs::path jpgPath = entry.path();
         jpgPath.replace_extension(L".jpg");
         if (fs::exists(jpgPath))
           continue;
-        g_queue.push(entry.path().wstring());
+        g_queue.push(path);
         ++count;
       }
+    } catch (const std::exception &e) {
+      LogMsg(L"Force scan error in %s: %hs", root.c_str(), e.what());
     }
-  } catch (const std::exception &e) {
-    LogMsg(L"Force scan error: %hs", e.what());
   }
   LogMsg(L"Force scan: queued %d files", count);
+  TraceInstant("force scan", "queued", count);
+}
+
+// ============================================================================
+// IPC jobs: files queued through the job server's pipe. They share g_queue
+// with the watcher; this table remembers who asked, under which profile,
+// so the completion can be streamed back.
+// ============================================================================
+static const wchar_t *kJobPipeName = L"\\\\.\\pipe\\JxrAutoCleaner";
+
+struct IpcJob {
+  uint64_t clientId = 0;
+  uint64_t jobId = 0;
+  ConvertOptions options;
+};
+
+static std::mutex g_ipcMutex;
+static std::unordered_map<std::wstring, IpcJob> g_ipcJobs; // lowercase path
+static uint64_t g_nextIpcJobId = 1;
+
+// Named option sets a client can ask for; "default" is the service's own
+static bool ProfileOptions(const std::string &profile,
+                           ConvertOptions &options) {
+  options = g_convertOptions;
+  if (profile == "default")
+    return true;
+  if (profile == "fast") {
+    options.jpegQuality = 85;
+    options.optimizeHuffman = false;
+    options.previewSizes.clear();
+    return true;
+  }
+  if (profile == "archive") {
+    options.jpegQuality = 98;
+    options.optimizeHuffman = true;
+    return true;
+  }
+  return false;
+}
+
+static uint64_t SubmitIpcJob(const JobServer::Request &request,
+                             std::string &error) {
+  IpcJob job;
+  job.clientId = request.clientId;
+  if (!ProfileOptions(request.profile, job.options)) {
+    error = "profile";
+    return 0;
+  }
+  if (!HasJxrExtension(request.path)) {
+    error = "not-jxr";
+    return 0;
+  }
+  if (::GetFileAttributesW(request.path.c_str()) == INVALID_FILE_ATTRIBUTES) {
+    error = "not-found";
+    return 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(g_ipcMutex);
+    std::wstring key = ToLowerPath(request.path);
+    if (g_ipcJobs.count(key)) {
+      error = "duplicate";
+      return 0;
+    }
+    job.jobId = g_nextIpcJobId++;
+    g_ipcJobs[key] = job;
+  }
+  LogMsg(L"IPC: job %llu (%hs, %hs) %s",
+         static_cast<unsigned long long>(job.jobId),
+         request.highPriority ? "high" : "normal", request.profile.c_str(),
+         request.path.c_str());
+  // High-priority jobs go ahead of the backlog but stay in the order their
+  // batch listed them
+  if (request.highPriority)
+    g_queue.push_priority(request.path);
+  else
+    g_queue.push(request.path);
+  TraceInstant("ipc submit", "job", static_cast<int64_t>(job.jobId));
+  return job.jobId;
+}
+
+// STATS reply: the result cache's counters
+static std::string ServiceStats() {
+  ResultCache::Stats s = g_resultCache.GetStats();
+  ScratchSpace::Stats staging = g_scratch.GetStats();
+  FileWatcher::EventCounts watch = g_watcher.GetEventCounts();
+  char text[384];
+  snprintf(text, sizeof(text),
+           "cache-hits=%llu cache-misses=%llu cache-stores=%llu "
+           "cache-evictions=%llu cache-entries=%zu cache-bytes=%llu "
+           "staged=%llu staged-bytes=%llu staging-overflows=%llu "
+           "watch-events=%llu watch-accepted=%llu",
+           static_cast<unsigned long long>(s.hits),
+           static_cast<unsigned long long>(s.misses),
+           static_cast<unsigned long long>(s.stores),
+           static_cast<unsigned long long>(s.evictions), s.entries,
+           static_cast<unsigned long long>(s.bytes),
+           static_cast<unsigned long long>(staging.staged),
+           static_cast<unsigned long long>(staging.bytes),
+           static_cast<unsigned long long>(staging.overflows),
+           static_cast<unsigned long long>(watch.seen),
+           static_cast<unsigned long long>(watch.accepted));
+  return text;
+}
+
+// The options an IPC job asked for; other files keep the defaults
+static ConvertOptions OptionsFor(const std::wstring &path) {
+  std::lock_guard<std::mutex> lock(g_ipcMutex);
+  auto it = g_ipcJobs.find(ToLowerPath(path));
+  return it != g_ipcJobs.end() ? it->second.options : g_convertOptions;
+}
+
+// Streams the result to the submitting client, if the file came over IPC
+static void FinishIpcJob(const std::wstring &path, bool ok) {
+  IpcJob job;
+  {
+    std::lock_guard<std::mutex> lock(g_ipcMutex);
+    auto it = g_ipcJobs.find(ToLowerPath(path));
+    if (it == g_ipcJobs.end())
+      return;
+    job = std::move(it->second);
+    g_ipcJobs.erase(it);
+  }
+  g_jobServer.SendDone(job.clientId, job.jobId, ok, path);
+}
+
+// Every file the worker is done with, converted or not
+static void FinishFile(const std::wstring &path, bool ok) {
+  FinishIpcJob(path, ok);
+  if (g_harness)
+    g_harness->OnFinished(path, ok);
 }
 
 // ============================================================================
@@ -128,6 +348,8 @@ static void ShowTrayMenu(HWND hwnd) {
     return;
 
   ::AppendMenuW(hMenu, MF_STRING, ID_TRAY_FORCE_RUN, L"Force Run Now");
+  if (TraceEnabled())
+    ::AppendMenuW(hMenu, MF_STRING, ID_TRAY_SAVE_TRACE, L"Save Trace");
   ::AppendMenuW(hMenu, MF_SEPARATOR, 0, nullptr);
 
   // Dynamic label for startup toggle
@@ -152,6 +374,113 @@ static void ShowTrayMenu(HWND hwnd) {
   ::DestroyMenu(hMenu);
 }
 
+// ============================================================================
+// Deferred startup: the tray icon and the watcher come up first; log
+// maintenance, crash recovery and the job server follow on a thread at
+// background CPU and I/O priority, off the login critical path
+// ============================================================================
+// Entries kept by the result cache (%LOCALAPPDATA%\JxrAutoCleaner\cache),
+// each a small file naming an earlier output
+static constexpr size_t kResultCacheEntries = 4096;
+// Sources from network shares staged at once (...\JxrAutoCleaner\scratch)
+static constexpr uint64_t kScratchBytes = 1024ull * 1024 * 1024;
+
+static double MsSinceStart() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - g_startTime)
+      .count();
+}
+
+static void StartupThread() {
+  TraceThreadName("startup");
+  bool background = ::SetThreadPriority(::GetCurrentThread(),
+                                        THREAD_MODE_BACKGROUND_BEGIN) != FALSE;
+  {
+    TraceSpan span("trim log");
+    TrimLog();
+  }
+
+  // Crash recovery: only the files named by unfinished journal entries are
+  // touched, so its cost doesn't grow with the size of the library
+  std::wstring appDir = GetAppDataDir();
+  if (!appDir.empty() && g_journal.Open(appDir + L"\\journal.log")) {
+    TraceSpan span("recovery");
+    g_journal.Recover([](const std::wstring &path) { g_queue.push(path); });
+    g_convertOptions.journal = &g_journal;
+  }
+  // Outputs of byte-identical captures seen before are reused from here
+  if (!appDir.empty() &&
+      g_resultCache.Open(appDir + L"\\cache", kResultCacheEntries))
+    g_convertOptions.cache = &g_resultCache;
+  // Emptied first: staged copies a crashed run left behind
+  if (!appDir.empty() && g_scratch.Open(appDir + L"\\scratch", kScratchBytes))
+    g_convertOptions.scratch = &g_scratch;
+
+  if (background)
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+  g_jobServer.Start(kJobPipeName, SubmitIpcJob, ServiceStats);
+  LogMsg(L"Startup: log maintenance and recovery done after %.0f ms",
+         MsSinceStart());
+  ::SetEvent(g_startupDone);
+}
+
+// ============================================================================
+// Preemption watchdog: polls the gaming state every 100 ms. When a game (or
+// another fullscreen or presentation app) takes over, in-flight conversions
+// stop at their next preemption point and are requeued, and the process
+// drops to background CPU, I/O and memory priority until it is gone, so
+// work that cannot be interrupted (libultrahdr's encode, WIC's decode)
+// yields to the foreground too.
+// ============================================================================
+static constexpr DWORD kWatchdogIntervalMs = 100;
+
+static void WatchdogThread() {
+  ComInit com;
+  TraceThreadName("watchdog");
+  bool background = false;
+  while (::WaitForSingleObject(g_shutdownEvent, kWatchdogIntervalMs) ==
+         WAIT_TIMEOUT) {
+    const bool busy = IsGaming();
+    if (busy == g_foregroundBusy.load())
+      continue;
+    g_foregroundBusy = busy;
+    if (busy) {
+      g_preempt.Cancel();
+      background = ::SetPriorityClass(::GetCurrentProcess(),
+                                      PROCESS_MODE_BACKGROUND_BEGIN) != FALSE;
+      LogMsg(L"Watchdog: foreground busy, preempting conversions");
+      TraceInstant("foreground busy");
+    } else {
+      if (background)
+        ::SetPriorityClass(::GetCurrentProcess(), PROCESS_MODE_BACKGROUND_END);
+      background = false;
+      LogMsg(L"Watchdog: foreground idle, normal priority restored");
+      TraceInstant("foreground idle");
+    }
+  }
+  if (background)
+    ::SetPriorityClass(::GetCurrentProcess(), PROCESS_MODE_BACKGROUND_END);
+}
+
+// ============================================================================
+// Completeness probe: the container header at the start of an open file,
+// checked against the file's size. A copier or sync tool can close a file
+// it has not finished; this catches it without starting a decoder.
+// ============================================================================
+static constexpr DWORD kProbeBytes = 16 * 1024; // header, IFD, pixel format
+
+static JxrProbe ProbeOpenFile(HANDLE file, JxrHeaderInfo &header) {
+  LARGE_INTEGER size = {};
+  if (!::GetFileSizeEx(file, &size))
+    return JxrProbe::Unknown;
+  uint8_t prefix[kProbeBytes];
+  DWORD read = 0;
+  if (!::ReadFile(file, prefix, kProbeBytes, &read, nullptr))
+    return JxrProbe::Unknown;
+  return ProbeJxrHeader(prefix, read, static_cast<uint64_t>(size.QuadPart),
+                        header);
+}
+
 // ============================================================================
 // Worker Thread: processes queued JXR files when the system is idle
 // ============================================================================
@@ -163,43 +492,88 @@ static void WorkerThread() {
   }
 
   LogMsg(L"Worker: started");
+  TraceThreadName("worker");
   constexpr int MAX_RETRIES = 5;
 
+  // Files queue up from the start, but conversions wait for crash recovery
+  // (and the journal they write to)
+  HANDLE waits[2] = {g_startupDone, g_shutdownEvent};
+  if (::WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+    LogMsg(L"Worker: exited");
+    return;
+  }
+  bool firstFile = true;
+
+  // Stage threads: reading/decoding the next file overlaps with encoding and
+  // committing the previous ones
+  ConversionPipeline pipeline(
+      g_convertOptions, [](const ConversionJob &job) {
+        // Preempted: untouched on disk, back at the front of the line for
+        // when the foreground is free again
+        if (job.cancelled) {
+          g_queue.push_front(job.jxrPath);
+          return;
+        }
+        FinishFile(job.jxrPath, !job.failed);
+      });
+
+  // One string for every popped path: the queue writes into its buffer
+  std::wstring filePath;
   while (::WaitForSingleObject(g_shutdownEvent, 0) != WAIT_OBJECT_0) {
     // Wait for a file to appear in the queue (30 second timeout)
-    auto item = g_queue.wait_and_pop(std::chrono::seconds(30));
-    if (!item.has_value())
+    if (!g_queue.wait_and_pop(filePath, std::chrono::seconds(30)))
       continue;
+    TraceCounter("queue depth", static_cast<int64_t>(g_queue.size()));
+    if (firstFile) {
+      firstFile = false;
+      LogMsg(L"Startup: first file picked up after %.0f ms", MsSinceStart());
+    }
 
-    // Check if system is busy
-    if (IsSystemBusy()) {
-      LogMsg(L"Worker: system busy, re-queuing %s", item->c_str());
-      g_queue.push_front(std::move(*item));
+    // Check if system is busy (the watchdog's state first: no CPU sample)
+    if (g_idleGate && (g_foregroundBusy || IsSystemBusy())) {
+      LogMsg(L"Worker: system busy, re-queuing %s", filePath.c_str());
+      g_queue.push_front(filePath);
+      TraceSpan span("system busy");
       if (::WaitForSingleObject(g_shutdownEvent, 30000) == WAIT_OBJECT_0)
         break;
       continue;
     }
 
-    std::wstring filePath = std::move(*item);
-
-    // Check if file is ready (not locked by ShadowPlay)
+    // Check if file is ready (not locked by ShadowPlay, not left short)
     bool fileReady = false;
     for (int retry = 0; retry < MAX_RETRIES; ++retry) {
+      // Deny writers: fails while ShadowPlay still has the file open for
+      // writing, but not because of the pipeline's own read-only mapping
       HANDLE hFile =
-          ::CreateFileW(filePath.c_str(), GENERIC_READ,
-                        0, // No sharing — exclusive access test
+          ::CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
 
       if (hFile != INVALID_HANDLE_VALUE) {
+        JxrHeaderInfo header;
+        const JxrProbe probe = ProbeOpenFile(hFile, header);
         ::CloseHandle(hFile);
-        fileReady = true;
-        break;
+        if (probe == JxrProbe::Invalid) {
+          LogMsg(L"Worker: not a JPEG XR file: %s", filePath.c_str());
+          break;
+        }
+        if (probe != JxrProbe::Truncated) {
+          fileReady = true;
+          break;
+        }
+        // Closed but short: give the writer time, like a locked file
+        LogMsg(L"Worker: file incomplete (attempt %d/%d): %s", retry + 1,
+               MAX_RETRIES, filePath.c_str());
+        TraceSpan span("file incomplete", "attempt", retry + 1);
+        if (::WaitForSingleObject(g_shutdownEvent, 2000) == WAIT_OBJECT_0)
+          break;
+        continue;
       }
 
       DWORD err = ::GetLastError();
       if (err == ERROR_SHARING_VIOLATION) {
         LogMsg(L"Worker: file locked (attempt %d/%d): %s", retry + 1,
                MAX_RETRIES, filePath.c_str());
+        TraceSpan span("file locked", "attempt", retry + 1);
         if (::WaitForSingleObject(g_shutdownEvent, 2000) == WAIT_OBJECT_0)
           break;
       } else if (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) {
@@ -214,6 +588,7 @@ static void WorkerThread() {
 
     if (!fileReady) {
       LogMsg(L"Worker: skipping file (not accessible): %s", filePath.c_str());
+      FinishFile(filePath, false);
       continue;
     }
 
@@ -221,25 +596,35 @@ static void WorkerThread() {
     if (!fs::exists(filePath)) {
       LogMsg(L"Worker: file disappeared before conversion: %s",
              filePath.c_str());
+      FinishFile(filePath, false);
       continue;
     }
 
-    // Convert
-    bool success = ConvertJxrToUltraHdrJpeg(filePath);
-    if (!success) {
-      LogMsg(L"Worker: conversion failed for %s", filePath.c_str());
-    }
+    // Hand off to the pipeline; blocks while its read stage is still busy,
+    // so files stay in g_queue (and under IsSystemBusy gating) until needed
+    TraceSpan span("submit");
+    if (!pipeline.Submit(filePath, OptionsFor(filePath)))
+      break;
   }
 
+  // Finish the stage already running on each thread and drop the rest;
+  // dropped sources are untouched and get picked up by the next scan
+  pipeline.Shutdown(true);
   LogMsg(L"Worker: exited");
 }
 
 // ============================================================================
-// Watcher Thread
+// Watcher Thread: one thread and one completion port for every root
 // ============================================================================
-static void WatcherThread(const std::wstring &videosDir) {
-  FileWatcher watcher;
-  watcher.Run(videosDir, g_queue, g_shutdownEvent);
+static void WatcherThread() {
+  g_watcher.SetReadyCallback([](size_t roots) {
+    LogMsg(L"Startup: watching %zu roots after %.0f ms", roots,
+           MsSinceStart());
+  });
+  g_watcher.SetFirstEventCallback([] {
+    LogMsg(L"Startup: first watcher event after %.0f ms", MsSinceStart());
+  });
+  g_watcher.Run(g_queue, g_shutdownEvent);
 }
 
 // ============================================================================
@@ -263,6 +648,9 @@ static LRESULT CALLBACK HiddenWndProc(HWND hwnd, UINT msg, WPARAM wp,
     case ID_TRAY_FORCE_RUN:
       ForceScanNow();
       return 0;
+    case ID_TRAY_SAVE_TRACE:
+      TraceDump();
+      return 0;
     case ID_TRAY_TOGGLE_STARTUP:
       if (IsInStartup())
         RemoveFromStartup();
@@ -293,18 +681,39 @@ static LRESULT CALLBACK HiddenWndProc(HWND hwnd, UINT msg, WPARAM wp,
 }
 
 // ============================================================================
-// CLI mode: --convert <file>
+// CLI mode: --convert <file> [file ...]
+// Several files run as jobs on the shared pool; their row-chunk kernels
+// share the same workers, so cores stay busy either way.
 // ============================================================================
-static int RunCliConvert(const std::wstring &filePath) {
+static int RunCliConvert(const std::vector<std::wstring> &files) {
   ComInit com;
   if (!com) {
     fwprintf(stderr, L"COM initialization failed\n");
     return 1;
   }
 
-  fwprintf(stdout, L"Converting: %s\n", filePath.c_str());
-  bool ok = ConvertJxrToUltraHdrJpeg(filePath);
-  if (ok) {
+  std::atomic<int> failures{0};
+  if (files.size() == 1) {
+    fwprintf(stdout, L"Converting: %s\n", files[0].c_str());
+    if (!ConvertJxrToUltraHdrJpeg(files[0], g_convertOptions))
+      ++failures;
+  } else {
+    TaskGroup group(ThreadPool::Shared());
+    for (const auto &file : files) {
+      group.Run([&failures, &file] {
+        ComInit taskCom; // WIC on a pool worker
+        bool ok = taskCom && ConvertJxrToUltraHdrJpeg(file, g_convertOptions);
+        if (!ok)
+          ++failures;
+        fwprintf(ok ? stdout : stderr, L"%s: %s\n",
+                 ok ? L"Converted" : L"Failed", file.c_str());
+      });
+    }
+    group.Wait();
+  }
+  TraceDump();
+
+  if (failures == 0) {
     fwprintf(stdout, L"Success!\n");
     return 0;
   } else {
@@ -314,6 +723,246 @@ static int RunCliConvert(const std::wstring &filePath) {
   }
 }
 
+// ============================================================================
+// CLI mode: --bench-sdr <file> [iterations]
+// ============================================================================
+static int RunCliBenchSdr(const std::wstring &filePath, int iterations) {
+  ComInit com;
+  if (!com) {
+    fwprintf(stderr, L"COM initialization failed\n");
+    return 1;
+  }
+
+  SdrEncoderBenchmarkResult r;
+  if (!RunSdrEncoderBenchmark(filePath, iterations, r)) {
+    fwprintf(stderr, L"Benchmark failed. Check log at "
+                     L"%%LOCALAPPDATA%%\\JxrAutoCleaner\\log.txt\n");
+    return 1;
+  }
+
+  const double mpix = static_cast<double>(r.width) * r.height / 1e6;
+  fwprintf(stdout, L"%ux%u (%.1f MP), %d iterations, quality 95\n", r.width,
+           r.height, mpix, r.iterations);
+  fwprintf(stdout, L"  WIC encoder:                %8.1f ms  %8.1f KB\n",
+           r.wicMs, r.wicBytes / 1024.0);
+  fwprintf(stdout, L"  libjpeg-turbo:              %8.1f ms  %8.1f KB\n",
+           r.turboMs, r.turboBytes / 1024.0);
+  fwprintf(stdout, L"  libjpeg-turbo (opt. Huff.): %8.1f ms  %8.1f KB\n",
+           r.turboOptimizedMs, r.turboOptimizedBytes / 1024.0);
+  return 0;
+}
+
+// ============================================================================
+// CLI mode: --bench-decode <file> [iterations]
+// ============================================================================
+static int RunCliBenchDecode(const std::wstring &filePath, int iterations) {
+  ComInit com;
+  if (!com) {
+    fwprintf(stderr, L"COM initialization failed\n");
+    return 1;
+  }
+
+  DecodeBenchmarkResult r;
+  if (!RunDecodeBenchmark(filePath, iterations, r) || r.points.empty()) {
+    fwprintf(stderr, L"Benchmark failed. Check log at "
+                     L"%%LOCALAPPDATA%%\\JxrAutoCleaner\\log.txt\n");
+    return 1;
+  }
+
+  const double mpix = static_cast<double>(r.width) * r.height / 1e6;
+  fwprintf(stdout, L"%ux%u (%.1f MP) %s, %d iterations\n", r.width, r.height,
+           mpix, r.hdr ? L"64bppRGBAHalf" : L"24bppBGR", r.iterations);
+  const double single = r.points.front().ms;
+  for (const auto &p : r.points) {
+    fwprintf(stdout, L"  %3d stripes: %8.1f ms  %5.2fx\n", p.stripes, p.ms,
+             p.ms > 0 ? single / p.ms : 0.0);
+  }
+  return 0;
+}
+
+// ============================================================================
+// CLI mode: --bench-queue [files]
+// A ForceScanNow-sized backlog of capture paths pushed through the old
+// string queue and the interned one: push and pop cost, and the heap the
+// queued backlog holds (counted by the operator new hook).
+// ============================================================================
+struct QueueBenchResult {
+  double pushNs = 0.0; // per file
+  double popNs = 0.0;
+  uint64_t allocations = 0; // during the pushes
+  int64_t heapBytes = 0;    // live once everything is queued
+};
+
+template <typename Queue>
+static QueueBenchResult BenchQueue(const std::vector<std::wstring> &paths) {
+  using Clock = std::chrono::steady_clock;
+  QueueBenchResult r;
+  MemoryCounters heap;
+  {
+    MemoryScope scope(&heap);
+    Queue queue;
+    auto t0 = Clock::now();
+    for (const auto &path : paths)
+      queue.push(path);
+    auto t1 = Clock::now();
+    r.allocations = heap.allocations;
+    r.heapBytes = heap.liveBytes;
+    while (queue.try_pop()) {
+    }
+    auto t2 = Clock::now();
+    r.pushNs = std::chrono::duration<double, std::nano>(t1 - t0).count() /
+               paths.size();
+    r.popNs = std::chrono::duration<double, std::nano>(t2 - t1).count() /
+              paths.size();
+  }
+  return r;
+}
+
+static int RunCliBenchQueue(size_t files) {
+  if (files == 0)
+    files = 100000;
+  // ShadowPlay's layout: a folder per game, long names that repeat it
+  constexpr size_t kGames = 40;
+  std::vector<std::wstring> paths;
+  paths.reserve(files);
+  for (size_t i = 0; i < files; ++i) {
+    const size_t game = i * kGames / files; // one folder after another
+    wchar_t path[MAX_PATH];
+    swprintf_s(path,
+               L"C:\\Users\\Player\\Videos\\NVIDIA\\Some Long Game Title %zu\\"
+               L"Some Long Game Title %zu Screenshot 2024.05.%02zu - "
+               L"%02zu.%02zu.%02zu.%02zu.jxr",
+               game, game, i % 28 + 1, i / 3600 % 24, i / 60 % 60, i % 60,
+               i % 100);
+    paths.push_back(path);
+  }
+
+  const QueueBenchResult strings =
+      BenchQueue<ThreadSafeQueue<std::wstring>>(paths);
+  const QueueBenchResult interned = BenchQueue<PathQueue>(paths);
+  fwprintf(stdout, L"%zu paths in %zu folders\n", files, kGames);
+  fwprintf(stdout, L"%27spush ns  pop ns  allocations  heap MB\n", L"");
+  for (int i = 0; i < 2; ++i) {
+    const QueueBenchResult &r = i == 0 ? strings : interned;
+    fwprintf(stdout, L"  %-24s %7.0f %7.0f %12llu %8.1f\n",
+             i == 0 ? L"ThreadSafeQueue<wstring>" : L"PathQueue", r.pushNs,
+             r.popNs, static_cast<unsigned long long>(r.allocations),
+             r.heapBytes / (1024.0 * 1024.0));
+  }
+  return 0;
+}
+
+// ============================================================================
+// CLI mode: --sweep <out prefix> <file or folder>...
+// ============================================================================
+static int RunCliSweep(const std::wstring &outPrefix,
+                       const std::vector<std::wstring> &inputs) {
+  ComInit com;
+  if (!com) {
+    fwprintf(stderr, L"COM initialization failed\n");
+    return 1;
+  }
+
+  SweepGrid grid;
+  std::vector<SweepPoint> points;
+  if (!RunParameterSweep(inputs, grid, outPrefix, points)) {
+    fwprintf(stderr, L"Sweep failed. Check log at "
+                     L"%%LOCALAPPDATA%%\\JxrAutoCleaner\\log.txt\n");
+    return 1;
+  }
+
+  size_t frontier = 0;
+  for (const auto &p : points)
+    frontier += p.pareto ? 1 : 0;
+  fwprintf(stdout, L"%zu settings, %zu on the Pareto frontier\n",
+           points.size(), frontier);
+  fwprintf(stdout, L"  %s.csv\n  %s.md\n", outPrefix.c_str(),
+           outPrefix.c_str());
+  return 0;
+}
+
+// ============================================================================
+// CLI mode: --latency <sample.jxr> [bursts] [files per burst] [video MB/s]
+// Runs the service's own watcher and worker on a temp directory, writes
+// simulated captures into it and prints capture-closed → done latency as
+// JSON. The idle gate is off, so conversions start as soon as files are
+// closed; the result cache and journal are not used.
+// ============================================================================
+static constexpr uint32_t kLatencyDrainTimeoutMs = 120000;
+
+static int RunCliLatency(const CaptureSimulator::Options &load) {
+  g_startTime = std::chrono::steady_clock::now();
+  wchar_t tempDir[MAX_PATH];
+  if (!::GetTempPathW(MAX_PATH, tempDir)) {
+    fwprintf(stderr, L"No temp directory\n");
+    return 1;
+  }
+  fs::path dir = fs::path(tempDir) /
+                 (L"JxrLatency-" + std::to_wstring(::GetCurrentProcessId()));
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec || !g_watcher.AddRoot(dir.wstring())) {
+    fwprintf(stderr, L"Cannot create %s\n", dir.wstring().c_str());
+    return 1;
+  }
+
+  g_shutdownEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  g_startupDone = ::CreateEventW(nullptr, TRUE, TRUE, nullptr); // no recovery
+  UniqueHandle ready =
+      MakeUniqueHandle(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+  if (!g_shutdownEvent || !g_startupDone || !ready) {
+    fwprintf(stderr, L"Failed to create events\n");
+    return 1;
+  }
+  g_idleGate = false;
+  CaptureSimulator simulator;
+  g_harness = &simulator;
+
+  HANDLE readyEvent = ready.get();
+  g_watcher.SetReadyCallback(
+      [readyEvent](size_t) { ::SetEvent(readyEvent); });
+  std::thread watcherThread([] { g_watcher.Run(g_queue, g_shutdownEvent); });
+  std::thread workerThread(WorkerThread);
+
+  CaptureSimulator::Options options = load;
+  options.dir = g_watcher.Roots().front(); // the path the watcher reports
+  bool ok = ::WaitForSingleObject(readyEvent, 10000) == WAIT_OBJECT_0 &&
+            simulator.Run(options);
+  if (ok && !simulator.WaitForAll(kLatencyDrainTimeoutMs))
+    fwprintf(stderr, L"Some captures were not converted in time\n");
+
+  ::SetEvent(g_shutdownEvent);
+  g_queue.shutdown();
+  watcherThread.join();
+  workerThread.join();
+  g_harness = nullptr;
+  ::CloseHandle(g_shutdownEvent);
+  ::CloseHandle(g_startupDone);
+  TraceDump();
+
+  std::string json = simulator.ReportJson();
+  fputs(json.c_str(), stdout);
+  fs::remove_all(dir, ec);
+  return ok ? 0 : 1;
+}
+
+// ============================================================================
+// Parse "--preview 320,1024" into preview long-edge sizes
+// ============================================================================
+static void ParsePreviewSizes(const wchar_t *list) {
+  g_convertOptions.previewSizes.clear();
+  const wchar_t *p = list;
+  while (*p) {
+    wchar_t *end = nullptr;
+    unsigned long size = wcstoul(p, &end, 10);
+    if (end == p)
+      break;
+    if (size > 0)
+      g_convertOptions.previewSizes.push_back(static_cast<uint32_t>(size));
+    p = (*end == L',') ? end + 1 : end;
+  }
+}
+
 // ============================================================================
 // Entry point
 // ============================================================================
@@ -324,10 +973,73 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int) {
   int argc = 0;
   LPWSTR *argv = ::CommandLineToArgvW(::GetCommandLineW(), &argc);
   if (argv) {
+    // Options shared by every mode
+    for (int i = 1; i + 1 < argc; ++i) {
+      if (wcscmp(argv[i], L"--preview") == 0)
+        ParsePreviewSizes(argv[i + 1]);
+      else if (wcscmp(argv[i], L"--watch") == 0)
+        g_extraRoots.push_back(argv[i + 1]);
+      else if (wcscmp(argv[i], L"--trace") == 0)
+        TraceEnable(argv[i + 1]);
+      else if (wcscmp(argv[i], L"--decode-stripes") == 0)
+        g_convertOptions.decodeStripes = _wtoi(argv[i + 1]);
+    }
+    for (int i = 1; i < argc; ++i) {
+      if (wcscmp(argv[i], L"--sliced-base") == 0)
+        g_convertOptions.slicedBaseEncode = true;
+    }
+
     for (int i = 1; i < argc; ++i) {
       if ((wcscmp(argv[i], L"--convert") == 0 || wcscmp(argv[i], L"-c") == 0) &&
           i + 1 < argc) {
-        int result = RunCliConvert(argv[i + 1]);
+        std::vector<std::wstring> files;
+        for (int j = i + 1; j < argc && wcsncmp(argv[j], L"--", 2) != 0; ++j)
+          files.push_back(argv[j]);
+        int result = RunCliConvert(files);
+        ::LocalFree(argv);
+        return result;
+      }
+      if (wcscmp(argv[i], L"--bench-sdr") == 0 && i + 1 < argc) {
+        int iterations = (i + 2 < argc) ? _wtoi(argv[i + 2]) : 5;
+        int result = RunCliBenchSdr(argv[i + 1], iterations);
+        ::LocalFree(argv);
+        return result;
+      }
+      if (wcscmp(argv[i], L"--bench-decode") == 0 && i + 1 < argc) {
+        int iterations = (i + 2 < argc) ? _wtoi(argv[i + 2]) : 5;
+        int result = RunCliBenchDecode(argv[i + 1], iterations);
+        ::LocalFree(argv);
+        return result;
+      }
+      if (wcscmp(argv[i], L"--bench-queue") == 0) {
+        size_t files = (i + 1 < argc) ? wcstoul(argv[i + 1], nullptr, 10) : 0;
+        int result = RunCliBenchQueue(files);
+        ::LocalFree(argv);
+        return result;
+      }
+      if (wcscmp(argv[i], L"--sweep") == 0 && i + 2 < argc) {
+        std::vector<std::wstring> inputs;
+        for (int j = i + 2; j < argc && wcsncmp(argv[j], L"--", 2) != 0; ++j)
+          inputs.push_back(argv[j]);
+        int result = RunCliSweep(argv[i + 1], inputs);
+        ::LocalFree(argv);
+        return result;
+      }
+      if (wcscmp(argv[i], L"--latency") == 0 && i + 1 < argc) {
+        // Optional numbers, up to the next option
+        auto number = [&](int k, int fallback) {
+          for (int j = i + 2; j <= k; ++j) {
+            if (j >= argc || wcsncmp(argv[j], L"--", 2) == 0)
+              return fallback;
+          }
+          return _wtoi(argv[k]);
+        };
+        CaptureSimulator::Options load;
+        load.sampleJxr = argv[i + 1];
+        load.bursts = number(i + 2, load.bursts);
+        load.filesPerBurst = number(i + 3, load.filesPerBurst);
+        load.videoMBps = number(i + 4, load.videoMBps);
+        int result = RunCliLatency(load);
         ::LocalFree(argv);
         return result;
       }
@@ -336,7 +1048,8 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int) {
   }
 
   // --- Background service mode ---
-  TrimLog();
+  g_startTime = std::chrono::steady_clock::now();
+  g_convertOptions.cancel = &g_preempt;
   LogMsg(L"=== JxrAutoCleaner starting ===");
 
   // Single-instance check
@@ -348,19 +1061,21 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int) {
     return 0;
   }
 
-  // Resolve Videos folder
-  g_videosDir = GetVideosFolder();
-  if (g_videosDir.empty()) {
-    LogMsg(L"Failed to resolve Videos folder, exiting");
+  // Resolve watch roots
+  ConfigureWatchRoots();
+  if (g_watchRoots.empty()) {
+    LogMsg(L"No folders to watch, exiting");
     if (hMutex)
       ::CloseHandle(hMutex);
     return 1;
   }
-  LogMsg(L"Monitoring: %s", g_videosDir.c_str());
+  for (const auto &root : g_watchRoots)
+    LogMsg(L"Monitoring: %s", root.c_str());
 
-  // Create shutdown event
+  // Create shutdown and startup events
   g_shutdownEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
-  if (!g_shutdownEvent) {
+  g_startupDone = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  if (!g_shutdownEvent || !g_startupDone) {
     LogMsg(L"Failed to create shutdown event");
     if (hMutex)
       ::CloseHandle(hMutex);
@@ -380,32 +1095,14 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int) {
 
   // Create tray icon
   CreateTrayIcon(hwnd);
+  LogMsg(L"Startup: tray icon after %.0f ms", MsSinceStart());
 
-  // Start threads
-  std::thread watcherThread(WatcherThread, g_videosDir);
+  // Start threads: the watcher first, so no capture is missed while the
+  // rest of startup runs
+  std::thread watcherThread(WatcherThread);
   std::thread workerThread(WorkerThread);
-
-  // Clean up any orphan temp files from previous crashes
-  try {
-    for (const auto &entry : fs::recursive_directory_iterator(g_videosDir)) {
-      if (entry.is_regular_file()) {
-        // Check if the stem ends with ".tmp" (e.g. "photo.tmp.jpg")
-        auto stem = entry.path().stem().wstring();
-        auto ext = entry.path().extension().wstring();
-        std::transform(ext.begin(), ext.end(), ext.begin(), [](wchar_t c) {
-          return static_cast<wchar_t>(::towlower(c));
-        });
-        if (ext == L".jpg" && stem.size() >= 4 &&
-            stem.substr(stem.size() - 4) == L".tmp") {
-          LogMsg(L"Cleaning up orphan temp file: %s",
-                 entry.path().wstring().c_str());
-          std::error_code ec;
-          fs::remove(entry.path(), ec);
-        }
-      }
-    }
-  } catch (...) {
-  }
+  std::thread startupThread(StartupThread);
+  std::thread watchdogThread(WatchdogThread);
 
   // Message pump (keeps the process alive, handles tray messages)
   MSG msg;
@@ -419,14 +1116,22 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int) {
   ::SetEvent(g_shutdownEvent);
   g_queue.shutdown();
 
+  if (startupThread.joinable())
+    startupThread.join();
+  if (watchdogThread.joinable())
+    watchdogThread.join();
   if (watcherThread.joinable())
     watcherThread.join();
   if (workerThread.joinable())
     workerThread.join();
+  // After the worker: its last completions still report to clients
+  g_jobServer.Stop();
+  TraceDump();
 
   RemoveTrayIcon();
 
   ::CloseHandle(g_shutdownEvent);
+  ::CloseHandle(g_startupDone);
   if (hwnd)
     ::DestroyWindow(hwnd);
   if (hMutex)
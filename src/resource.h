@@ -7,6 +7,7 @@
 #define ID_TRAY_FORCE_RUN 40001
 #define ID_TRAY_TOGGLE_STARTUP 40002
 #define ID_TRAY_EXIT 40003
+#define ID_TRAY_SAVE_TRACE 40004
 
 // Tray callback message
 #define WM_TRAYICON (WM_APP + 1)
@@ -0,0 +1,370 @@
+#include "HalfFloat.h"
+#include "JpegEncoder.h"
+#include "TestMain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdint>
+#include <vector>
+
+#include <jpeglib.h>
+#include <ultrahdr_api.h>
+
+using namespace jxr;
+
+// ============================================================================
+// EncodeJpegSliced against the single-pass encoder. The stitched stream has
+// to decode, through libjpeg-turbo and through libultrahdr's uhdr_decode, to
+// the image a plain encode of the same frame gives.
+// ============================================================================
+
+static uint8_t Clamp8(int v) {
+  return static_cast<uint8_t>(std::min(std::max(v, 0), 255));
+}
+
+// RGBX test card: gradients for the DC path, a checkerboard and noise for AC
+static std::vector<uint8_t> MakeFrame(uint32_t width, uint32_t height) {
+  std::vector<uint8_t> rgbx(static_cast<size_t>(width) * height * 4);
+  uint32_t seed = 12345;
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      seed = seed * 1664525u + 1013904223u;
+      const int noise = static_cast<int>(seed >> 28) - 8;
+      uint8_t *p = &rgbx[(static_cast<size_t>(y) * width + x) * 4];
+      p[0] = Clamp8(static_cast<int>(x * 255 / width) + noise);
+      p[1] = Clamp8(static_cast<int>(y * 255 / height) + noise);
+      p[2] = Clamp8(((x / 37 + y / 23) % 2 ? 200 : 40) + noise);
+      p[3] = 255;
+    }
+  }
+  return rgbx;
+}
+
+static double Psnr(const std::vector<uint8_t> &a,
+                   const std::vector<uint8_t> &b) {
+  if (a.empty() || a.size() != b.size())
+    return 0.0;
+  double squared = 0.0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    const double d = static_cast<double>(a[i]) - b[i];
+    squared += d * d;
+  }
+  if (squared == 0.0)
+    return INFINITY;
+  return 10.0 * std::log10(255.0 * 255.0 * a.size() / squared);
+}
+
+// RSTn markers after SOS; `inOrder` is cleared unless they cycle RST0..RST7
+static size_t CountRestarts(const std::vector<uint8_t> &jpeg, bool &inOrder) {
+  size_t i = 0;
+  while (i + 1 < jpeg.size() && !(jpeg[i] == 0xFF && jpeg[i + 1] == 0xDA))
+    ++i;
+  size_t count = 0;
+  inOrder = true;
+  for (; i + 1 < jpeg.size(); ++i) {
+    if (jpeg[i] == 0xFF && jpeg[i + 1] >= 0xD0 && jpeg[i + 1] <= 0xD7) {
+      if (jpeg[i + 1] != 0xD0 + count % 8)
+        inOrder = false;
+      ++count;
+    }
+  }
+  return count;
+}
+
+// ============================================================================
+// libjpeg-turbo decode
+// ============================================================================
+struct Decoded {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  unsigned restartInterval = 0;
+  long warnings = 0; // corrupt-data warnings, e.g. a misplaced RST
+  std::vector<uint8_t> rgb;
+};
+
+struct DecodeError {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+static void OnDecodeError(j_common_ptr cinfo) {
+  std::longjmp(reinterpret_cast<DecodeError *>(cinfo->err)->jump, 1);
+}
+
+static void OnDecodeMessage(j_common_ptr) {}
+
+static bool DecodeJpeg(const std::vector<uint8_t> &jpeg, Decoded &out) {
+  jpeg_decompress_struct cinfo;
+  DecodeError err;
+  cinfo.err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = OnDecodeError;
+  err.pub.output_message = OnDecodeMessage;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char *>(jpeg.data()),
+               static_cast<unsigned long>(jpeg.size()));
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+  out.width = cinfo.output_width;
+  out.height = cinfo.output_height;
+  out.restartInterval = cinfo.restart_interval;
+  out.rgb.resize(static_cast<size_t>(out.width) * out.height * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row =
+        &out.rgb[static_cast<size_t>(cinfo.output_scanline) * out.width * 3];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  out.warnings = err.pub.num_warnings;
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+// ============================================================================
+// Sliced vs single pass, through libjpeg-turbo
+// ============================================================================
+static void SlicedDecodesLikeSinglePass() {
+  struct Case {
+    uint32_t width, height, slices;
+  };
+  // Full HD; an odd size with a partial last MCU; 4K with more slices than
+  // there are RSTn markers, so they wrap
+  for (const Case &c : {Case{1920, 1080, 4}, Case{1001, 777, 3},
+                        Case{3840, 2160, 11}}) {
+    const std::vector<uint8_t> frame = MakeFrame(c.width, c.height);
+    const size_t stride = static_cast<size_t>(c.width) * 4;
+    std::vector<uint8_t> plain, sliced;
+    CHECK(EncodeJpeg(frame.data(), c.width, c.height, stride,
+                     JpegInputFormat::RGBX32, 90, false, plain));
+    CHECK(EncodeJpegSliced(frame.data(), c.width, c.height, stride,
+                           JpegInputFormat::RGBX32, 90, sliced, CancelToken(),
+                           c.slices));
+
+    const uint32_t mcusPerRow = (c.width + 15) / 16;
+    const uint32_t mcuRows = (c.height + 15) / 16;
+    const uint32_t sliceMcuRows = (mcuRows + c.slices - 1) / c.slices;
+    const size_t sliceCount = (mcuRows + sliceMcuRows - 1) / sliceMcuRows;
+
+    Decoded a, b;
+    CHECK(DecodeJpeg(plain, a));
+    CHECK(DecodeJpeg(sliced, b));
+    CHECK(b.width == c.width && b.height == c.height);
+    CHECK(a.restartInterval == 0);
+    CHECK(b.restartInterval == sliceMcuRows * mcusPerRow);
+    CHECK(b.warnings == 0);
+    bool inOrder = false;
+    CHECK(CountRestarts(sliced, inOrder) == sliceCount - 1);
+    CHECK(inOrder);
+    // A marker, byte alignment and fresh DC predictors per slice: a few
+    // dozen bytes each, not a second copy of anything
+    CHECK(sliced.size() <= plain.size() + 64 * sliceCount);
+
+    const double psnr = Psnr(a.rgb, b.rgb);
+    std::printf("  %ux%u in %zu slices: %zu -> %zu bytes, %.1f dB against "
+                "the single-pass decode\n",
+                c.width, c.height, sliceCount, plain.size(), sliced.size(),
+                psnr);
+    CHECK(psnr >= 60.0);
+  }
+}
+
+// Too few MCU rows to split: the plain encoder's bytes, no DRI
+static void SmallFrameIsNotSliced() {
+  const std::vector<uint8_t> frame = MakeFrame(320, 96);
+  std::vector<uint8_t> plain, sliced;
+  CHECK(EncodeJpeg(frame.data(), 320, 96, 320 * 4, JpegInputFormat::RGBX32,
+                   90, false, plain));
+  CHECK(EncodeJpegSliced(frame.data(), 320, 96, 320 * 4,
+                         JpegInputFormat::RGBX32, 90, sliced, CancelToken(),
+                         4));
+  CHECK(sliced == plain);
+}
+
+// ============================================================================
+// Sliced vs single-pass base, through libultrahdr
+// ============================================================================
+
+// Ultra HDR JPEG from a linear half-float HDR frame, its SDR rendition and
+// that rendition already compressed, as the sliced base path builds it
+static bool EncodeUltraHdr(std::vector<uint16_t> &hdr,
+                           std::vector<uint8_t> &sdr,
+                           std::vector<uint8_t> &base, uint32_t width,
+                           uint32_t height, std::vector<uint8_t> &out) {
+  uhdr_codec_private_t *enc = uhdr_create_encoder();
+  if (!enc)
+    return false;
+  uhdr_raw_image_t hdrImg = {};
+  hdrImg.fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
+  hdrImg.cg = UHDR_CG_BT_709;
+  hdrImg.ct = UHDR_CT_LINEAR;
+  hdrImg.range = UHDR_CR_FULL_RANGE;
+  hdrImg.w = width;
+  hdrImg.h = height;
+  hdrImg.planes[0] = hdr.data();
+  hdrImg.stride[0] = width;
+
+  uhdr_raw_image_t sdrImg = {};
+  sdrImg.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = width;
+  sdrImg.h = height;
+  sdrImg.planes[0] = sdr.data();
+  sdrImg.stride[0] = width;
+
+  uhdr_compressed_image_t baseImg = {};
+  baseImg.data = base.data();
+  baseImg.data_sz = base.size();
+  baseImg.capacity = base.size();
+  baseImg.cg = UHDR_CG_BT_709;
+  baseImg.ct = UHDR_CT_SRGB;
+  baseImg.range = UHDR_CR_FULL_RANGE;
+
+  uhdr_error_info_t err = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_enc_set_compressed_image(enc, &baseImg, UHDR_SDR_IMG);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_enc_set_quality(enc, 90, UHDR_BASE_IMG);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_encode(enc);
+  uhdr_compressed_image_t *stream =
+      err.error_code == UHDR_CODEC_OK ? uhdr_get_encoded_stream(enc) : nullptr;
+  if (stream) {
+    const auto *data = static_cast<const uint8_t *>(stream->data);
+    out.assign(data, data + stream->data_sz);
+  } else {
+    std::fprintf(stderr, "  uhdr encode failed: %s\n",
+                 err.has_detail ? err.detail : "no stream");
+  }
+  uhdr_release_encoder(enc);
+  return stream != nullptr;
+}
+
+// uhdr_decode to packed pixels: the SDR rendition (RGBA8888, sRGB) or the
+// HDR one (RGBA half float, linear)
+static bool DecodeUltraHdr(const std::vector<uint8_t> &jpeg, bool hdr,
+                           uint32_t &width, uint32_t &height,
+                           std::vector<uint8_t> &pixels) {
+  uhdr_codec_private_t *dec = uhdr_create_decoder();
+  if (!dec)
+    return false;
+  uhdr_compressed_image_t img = {};
+  img.data = const_cast<uint8_t *>(jpeg.data());
+  img.data_sz = jpeg.size();
+  img.capacity = jpeg.size();
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+
+  uhdr_error_info_t err = uhdr_dec_set_image(dec, &img);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_dec_set_out_img_format(dec, hdr
+                                               ? UHDR_IMG_FMT_64bppRGBAHalfFloat
+                                               : UHDR_IMG_FMT_32bppRGBA8888);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_dec_set_out_color_transfer(dec, hdr ? UHDR_CT_LINEAR
+                                                   : UHDR_CT_SRGB);
+  if (err.error_code == UHDR_CODEC_OK)
+    err = uhdr_decode(dec);
+  uhdr_raw_image_t *decoded =
+      err.error_code == UHDR_CODEC_OK ? uhdr_get_decoded_image(dec) : nullptr;
+  if (decoded) {
+    const size_t bytesPerPixel = hdr ? 8 : 4;
+    const size_t row = decoded->w * bytesPerPixel;
+    width = decoded->w;
+    height = decoded->h;
+    pixels.resize(row * decoded->h);
+    const auto *src =
+        static_cast<const uint8_t *>(decoded->planes[UHDR_PLANE_PACKED]);
+    for (uint32_t y = 0; y < decoded->h; ++y) {
+      std::copy(src + y * decoded->stride[UHDR_PLANE_PACKED] * bytesPerPixel,
+                src + y * decoded->stride[UHDR_PLANE_PACKED] * bytesPerPixel +
+                    row,
+                pixels.begin() + y * row);
+    }
+  } else {
+    std::fprintf(stderr, "  uhdr_decode failed: %s\n",
+                 err.has_detail ? err.detail : "no image");
+  }
+  uhdr_release_decoder(dec);
+  return decoded != nullptr;
+}
+
+// Half-float frames compared as PSNR against their own peak
+static double PsnrHalf(const std::vector<uint8_t> &a,
+                       const std::vector<uint8_t> &b) {
+  if (a.empty() || a.size() != b.size())
+    return 0.0;
+  const auto *ha = reinterpret_cast<const uint16_t *>(a.data());
+  const auto *hb = reinterpret_cast<const uint16_t *>(b.data());
+  const size_t count = a.size() / 2;
+  double squared = 0.0, peak = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i % 4 == 3)
+      continue; // alpha
+    const double fa = HalfToFloat(ha[i]), fb = HalfToFloat(hb[i]);
+    peak = std::max(peak, fa);
+    squared += (fa - fb) * (fa - fb);
+  }
+  if (squared == 0.0)
+    return INFINITY;
+  return 10.0 * std::log10(peak * peak * (count / 4 * 3) / squared);
+}
+
+static void UltraHdrDecodesSlicedBase() {
+  const uint32_t width = 1920, height = 1080;
+  std::vector<uint8_t> sdr = MakeFrame(width, height);
+  // HDR: the SDR frame in linear light with its highlights boosted up to 4x
+  std::vector<uint16_t> hdr(static_cast<size_t>(width) * height * 4);
+  for (size_t i = 0; i < hdr.size(); ++i) {
+    if (i % 4 == 3) {
+      hdr[i] = FloatToHalf(1.0f);
+      continue;
+    }
+    const float v = sdr[i] / 255.0f;
+    const float linear = v <= 0.04045f
+                             ? v / 12.92f
+                             : std::pow((v + 0.055f) / 1.055f, 2.4f);
+    hdr[i] = FloatToHalf(linear * (1.0f + 3.0f * linear * linear));
+  }
+
+  const size_t stride = static_cast<size_t>(width) * 4;
+  std::vector<uint8_t> plainBase, slicedBase;
+  CHECK(EncodeJpeg(sdr.data(), width, height, stride, JpegInputFormat::RGBX32,
+                   90, false, plainBase));
+  CHECK(EncodeJpegSliced(sdr.data(), width, height, stride,
+                         JpegInputFormat::RGBX32, 90, slicedBase,
+                         CancelToken(), 4));
+
+  std::vector<uint8_t> plain, sliced;
+  CHECK(EncodeUltraHdr(hdr, sdr, plainBase, width, height, plain));
+  CHECK(EncodeUltraHdr(hdr, sdr, slicedBase, width, height, sliced));
+
+  for (bool hdrOut : {false, true}) {
+    uint32_t wa = 0, ha = 0, wb = 0, hb = 0;
+    std::vector<uint8_t> a, b;
+    CHECK(DecodeUltraHdr(plain, hdrOut, wa, ha, a));
+    CHECK(DecodeUltraHdr(sliced, hdrOut, wb, hb, b));
+    CHECK(wb == width && hb == height);
+    CHECK(wa == wb && ha == hb);
+    const double psnr = hdrOut ? PsnrHalf(a, b) : Psnr(a, b);
+    std::printf("  uhdr_decode %s: %.1f dB against the single-pass base\n",
+                hdrOut ? "HDR" : "SDR", psnr);
+    CHECK(psnr >= 60.0);
+  }
+}
+
+int main() {
+  RUN_TEST(SlicedDecodesLikeSinglePass);
+  RUN_TEST(SmallFrameIsNotSliced);
+  RUN_TEST(UltraHdrDecodesSlicedBase);
+  return jxr::test::Failures() == 0 ? 0 : 1;
+}
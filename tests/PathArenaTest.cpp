@@ -0,0 +1,122 @@
+#include "PathArena.h"
+#include "TestMain.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace jxr;
+
+// ============================================================================
+// Handles
+// ============================================================================
+
+// Paths come back as pushed, in either separator style and without one
+static void InternResolvesRoundTrip() {
+  PathArena arena;
+  const std::vector<std::wstring> paths = {
+      L"C:\\Videos\\Game\\Game Screenshot 2026.10.18 - 12.00.00.01.jxr",
+      L"C:\\Videos\\Game\\Game Screenshot 2026.10.18 - 12.00.01.01.jxr",
+      L"D:/captures/other.jxr", L"bare.jxr", L"C:\\Videos\\Game\\"};
+  std::vector<PathHandle> handles;
+  for (const auto &path : paths)
+    handles.push_back(arena.Intern(path));
+  CHECK(arena.live() == paths.size());
+  CHECK(arena.directories() == 3); // "Game" (twice), "captures", ""
+  for (size_t i = 0; i < paths.size(); ++i)
+    CHECK(arena.Resolve(handles[i]) == paths[i]);
+}
+
+// A second Release of the same handle leaves the live count alone
+static void DoubleReleaseIsRefused() {
+  PathArena arena;
+  PathHandle a = arena.Intern(std::wstring(L"C:\\x\\a.jxr"));
+  PathHandle b = arena.Intern(std::wstring(L"C:\\x\\b.jxr"));
+  CHECK(arena.Release(a));
+  CHECK(!arena.Release(a));
+  CHECK(arena.live() == 1);
+  CHECK(arena.Resolve(a).empty());
+  CHECK(arena.Resolve(b) == L"C:\\x\\b.jxr");
+  CHECK(!arena.Release(PathHandle{}));
+  CHECK(arena.Release(b));
+  CHECK(arena.live() == 0);
+}
+
+// After a drain the same index names a new path; the old handle must not
+// reach it
+static void StaleHandleIsRefusedAfterDrain() {
+  PathArena arena;
+  PathHandle old = arena.Intern(std::wstring(L"C:\\x\\old.jxr"));
+  CHECK(arena.Release(old));
+  PathHandle next = arena.Intern(std::wstring(L"C:\\x\\new.jxr"));
+  CHECK(next.index() == old.index());
+  CHECK(next.generation() != old.generation());
+  CHECK(arena.Resolve(old).empty());
+  CHECK(!arena.Release(old));
+  CHECK(arena.live() == 1);
+  CHECK(arena.Resolve(next) == L"C:\\x\\new.jxr");
+}
+
+// ============================================================================
+// Memory
+// ============================================================================
+
+// A drain keeps a handful of directories but not thousands
+static void DrainTrimsManyDirectories() {
+  PathArena arena;
+  std::vector<PathHandle> handles;
+  for (int i = 0; i < 10; ++i)
+    handles.push_back(
+        arena.Intern(L"C:\\few\\" + std::to_wstring(i) + L"\\a"));
+  for (PathHandle handle : handles)
+    arena.Release(handle);
+  CHECK(arena.directories() == 10);
+
+  handles.clear();
+  for (int i = 0; i < 5000; ++i)
+    handles.push_back(
+        arena.Intern(L"C:\\many\\" + std::to_wstring(i) + L"\\a"));
+  const size_t full = arena.bytes();
+  for (PathHandle handle : handles)
+    arena.Release(handle);
+  CHECK(arena.directories() == 0);
+  CHECK(arena.bytes() < full / 4);
+
+  // Lookups still work against the emptied index
+  PathHandle again = arena.Intern(std::wstring(L"C:\\many\\1\\b"));
+  CHECK(arena.Resolve(again) == L"C:\\many\\1\\b");
+  CHECK(arena.directories() == 1);
+}
+
+// Popping into one string reuses its buffer once it fits
+static void PopReusesCallerBuffer() {
+  PathQueue queue;
+  for (int i = 0; i < 100; ++i)
+    queue.push(L"C:\\Videos\\Game\\shot " + std::to_wstring(i) + L".jxr");
+  std::wstring path;
+  path.reserve(256);
+  const wchar_t *buffer = path.data();
+  int popped = 0;
+  while (queue.try_pop(path)) {
+    CHECK(path.data() == buffer);
+    CHECK(path == L"C:\\Videos\\Game\\shot " + std::to_wstring(popped) +
+                      L".jxr");
+    ++popped;
+  }
+  CHECK(popped == 100);
+  CHECK(queue.arena().live() == 0);
+
+  queue.push(std::wstring(L"C:\\a.jxr"));
+  CHECK(queue.wait_and_pop(path, std::chrono::milliseconds(0)));
+  CHECK(path == L"C:\\a.jxr");
+  CHECK(!queue.wait_and_pop(path, std::chrono::milliseconds(0)));
+}
+
+int main() {
+  RUN_TEST(InternResolvesRoundTrip);
+  RUN_TEST(DoubleReleaseIsRefused);
+  RUN_TEST(StaleHandleIsRefusedAfterDrain);
+  RUN_TEST(DrainTrimsManyDirectories);
+  RUN_TEST(PopReusesCallerBuffer);
+  return jxr::test::Failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+#include "RootIndex.h"
+#include "TestMain.h"
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace jxr;
+
+// ============================================================================
+// Overflow resync against a real directory tree. No watcher runs, so every
+// change made between Snapshot() and Resync() is one the notifications
+// lost, as after a ReadDirectoryChangesW buffer overflow.
+// ============================================================================
+
+static void Touch(const fs::path &path) {
+  fs::create_directories(path.parent_path());
+  std::ofstream(path, std::ios::binary) << "x";
+}
+
+// A fresh, empty tree under %TEMP%, with its long (not 8.3) name so USN
+// parent paths compare equal to it
+static fs::path MakeRoot(const wchar_t *name) {
+  wchar_t temp[MAX_PATH];
+  ::GetTempPathW(MAX_PATH, temp);
+  fs::path root = fs::path(temp) / name;
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  fs::create_directories(root);
+  wchar_t longPath[MAX_PATH * 2];
+  if (::GetLongPathNameW(root.c_str(), longPath, MAX_PATH * 2) != 0)
+    root = longPath;
+  return root;
+}
+
+struct Resynced {
+  RootIndex::ResyncResult result;
+  std::set<std::wstring> found; // root-relative, lowercase
+};
+
+static Resynced ResyncOnce(RootIndex &index, const fs::path &root) {
+  UniqueHandle dir = MakeUniqueHandle(::CreateFileW(
+      root.c_str(), FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+  Resynced out;
+  const std::wstring prefix = ToLowerPath(root.wstring()) + L"\\";
+  out.result = index.Resync(dir.get(), [&](const std::wstring &path) {
+    std::wstring key = ToLowerPath(path);
+    CHECK(key.rfind(prefix, 0) == 0);
+    CHECK(out.found.insert(key.substr(prefix.size())).second); // no repeats
+  });
+  CHECK(out.result.found == out.found.size());
+  return out;
+}
+
+// Files present at Snapshot() are only reported by a directory-time index,
+// whose first resync lists the whole tree. After that, new .jxr files in
+// old folders and in new subtrees are reported; converted ones and other
+// extensions are not
+static void FindsFilesMissedByNotifications(RootIndex::Mode mode,
+                                            const wchar_t *name) {
+  const fs::path root = MakeRoot(name);
+  Touch(root / L"old.jxr");
+  Touch(root / L"Game A" / L"old.jxr");
+  Touch(root / L"Game B" / L"untouched.jxr");
+
+  RootIndex index(root.wstring(), mode);
+  index.Snapshot();
+  index.Checkpoint();
+
+  Resynced first = ResyncOnce(index, root);
+  if (first.result.usedUsn) {
+    CHECK(first.found.empty());
+  } else {
+    const std::set<std::wstring> existing = {
+        L"old.jxr", L"game a\\old.jxr", L"game b\\untouched.jxr"};
+    CHECK(first.found == existing);
+  }
+  CHECK(ResyncOnce(index, root).found.empty());
+
+  Touch(root / L"new.jxr");
+  Touch(root / L"Game A" / L"shot.JXR");
+  Touch(root / L"Game A" / L"done.jxr");
+  Touch(root / L"Game A" / L"done.jpg");
+  Touch(root / L"Game A" / L"clip.mp4");
+  Touch(root / L"Game C" / L"2026" / L"deep.jxr");
+
+  Resynced r = ResyncOnce(index, root);
+  const std::set<std::wstring> expected = {
+      L"new.jxr", L"game a\\shot.jxr", L"game c\\2026\\deep.jxr"};
+  CHECK(r.found == expected);
+  if (!r.result.usedUsn) {
+    // Game B did not change, so it is stat'ed but not listed again
+    CHECK(r.result.dirsChecked >= 3);
+    CHECK(r.result.dirsListed <= 4); // root, Game A, Game C, 2026
+  }
+
+  // The baseline moved: the same files are not reported twice
+  Resynced again = ResyncOnce(index, root);
+  CHECK(again.found.empty());
+
+  // A removed directory drops out of the index
+  fs::remove_all(root / L"Game B");
+  Resynced removed = ResyncOnce(index, root);
+  CHECK(removed.found.empty());
+
+  std::error_code ec;
+  fs::remove_all(root, ec);
+}
+
+static void DirectoryTimesResync() {
+  FindsFilesMissedByNotifications(RootIndex::Mode::DirectoryTimes,
+                                  L"JxrRootIndexTest.times");
+}
+
+// The USN journal where the temp volume has a readable one; otherwise this
+// falls back to directory times and checks the same
+static void AutoResync() {
+  FindsFilesMissedByNotifications(RootIndex::Mode::Auto,
+                                  L"JxrRootIndexTest.auto");
+}
+
+// Without a Snapshot() at all the first resync does the same full listing
+static void ResyncWithoutSnapshotListsAll() {
+  const fs::path root = MakeRoot(L"JxrRootIndexTest.cold");
+  Touch(root / L"a.jxr");
+  Touch(root / L"b.jxr");
+  Touch(root / L"b.jpg");
+  Touch(root / L"Game" / L"c.jxr");
+
+  RootIndex index(root.wstring(), RootIndex::Mode::DirectoryTimes);
+  Resynced r = ResyncOnce(index, root);
+  const std::set<std::wstring> expected = {L"a.jxr", L"game\\c.jxr"};
+  CHECK(r.found == expected);
+  CHECK(ResyncOnce(index, root).found.empty());
+
+  std::error_code ec;
+  fs::remove_all(root, ec);
+}
+
+// The watcher's include / exclude patterns, not just "*.jxr": an excluded
+// folder, an excluded name pattern, and a whole-path include for another
+// extension, which the USN name prefilter has to let through
+static void FiltersWithWatchPatterns(RootIndex::Mode mode,
+                                     const wchar_t *name) {
+  const fs::path root = MakeRoot(name);
+  Touch(root / L"old.jxr");
+  Touch(root / L"Temp" / L"old.jxr");
+
+  const WatchFilter filter({L"*.jxr", L"Screens\\*.png"},
+                           {L"Temp", L"*.partial.jxr"});
+  RootIndex index(root.wstring(), mode, filter);
+  index.Snapshot();
+  index.Checkpoint();
+
+  Resynced first = ResyncOnce(index, root);
+  if (first.result.usedUsn) {
+    CHECK(first.found.empty());
+  } else {
+    const std::set<std::wstring> existing = {L"old.jxr"};
+    CHECK(first.found == existing);
+  }
+
+  Touch(root / L"new.jxr");
+  Touch(root / L"Temp" / L"new.jxr");
+  Touch(root / L"Game" / L"Temp" / L"deep.jxr");
+  Touch(root / L"Game" / L"shot.partial.jxr");
+  Touch(root / L"Game" / L"shot.jxr");
+  Touch(root / L"Screens" / L"a.png");
+  Touch(root / L"Screens" / L"b.png");
+  Touch(root / L"Screens" / L"b.jpg");
+  Touch(root / L"loose.png");
+
+  Resynced r = ResyncOnce(index, root);
+  const std::set<std::wstring> expected = {L"new.jxr", L"game\\shot.jxr",
+                                           L"screens\\a.png"};
+  CHECK(r.found == expected);
+  CHECK(ResyncOnce(index, root).found.empty());
+
+  std::error_code ec;
+  fs::remove_all(root, ec);
+}
+
+static void DirectoryTimesResyncFiltered() {
+  FiltersWithWatchPatterns(RootIndex::Mode::DirectoryTimes,
+                           L"JxrRootIndexTest.filter.times");
+}
+
+static void AutoResyncFiltered() {
+  FiltersWithWatchPatterns(RootIndex::Mode::Auto,
+                           L"JxrRootIndexTest.filter.auto");
+}
+
+int main() {
+  RUN_TEST(DirectoryTimesResync);
+  RUN_TEST(AutoResync);
+  RUN_TEST(ResyncWithoutSnapshotListsAll);
+  RUN_TEST(DirectoryTimesResyncFiltered);
+  RUN_TEST(AutoResyncFiltered);
+  return jxr::test::Failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdio>
+
+// Minimal checks for the unit tests: no framework, a failed CHECK prints
+// the expression and the test binary exits non-zero for ctest
+namespace jxr::test {
+
+inline int &Failures() {
+  static int failures = 0;
+  return failures;
+}
+
+} // namespace jxr::test
+
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__,    \
+                   #expr);                                                     \
+      ++jxr::test::Failures();                                                 \
+    }                                                                          \
+  } while (0)
+
+#define RUN_TEST(fn)                                                           \
+  do {                                                                         \
+    const int before = jxr::test::Failures();                                  \
+    fn();                                                                      \
+    std::printf("%s %s\n", jxr::test::Failures() == before ? "PASS" : "FAIL", \
+                #fn);                                                          \
+  } while (0)
@@ -0,0 +1,192 @@
+#include "MemoryStats.h"
+#include "TestMain.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+using namespace jxr;
+
+// ============================================================================
+// Correctness
+// ============================================================================
+
+// Every index runs exactly once, for counts that do and don't divide into
+// the grain
+static void ParallelForCoversEachIndexOnce() {
+  ThreadPool pool(4);
+  for (size_t count : {1u, 7u, 64u, 1000u, 4099u}) {
+    for (size_t grain : {1u, 3u, 64u, 5000u}) {
+      std::vector<std::atomic<int>> hits(count);
+      pool.ParallelFor(count, grain, [&](size_t begin, size_t end) {
+        CHECK(begin < end && end <= count);
+        CHECK(end - begin <= grain);
+        for (size_t i = begin; i < end; ++i)
+          ++hits[i];
+      });
+      for (size_t i = 0; i < count; ++i)
+        CHECK(hits[i] == 1);
+    }
+  }
+  pool.ParallelFor(0, 1, [](size_t, size_t) { CHECK(false); });
+}
+
+// A row-chunk loop inside a file job, with every worker busy on other file
+// jobs: the caller must be able to finish its own chunks
+static void NestedParallelForCompletes() {
+  ThreadPool pool(2);
+  std::atomic<size_t> rows{0};
+  TaskGroup files(pool);
+  for (int f = 0; f < 8; ++f) {
+    files.Run([&] {
+      pool.ParallelFor(256, 16, [&](size_t begin, size_t end) {
+        rows += end - begin;
+      });
+    });
+  }
+  files.Wait();
+  CHECK(rows == 8 * 256);
+}
+
+static void TaskGroupWaitsForAll() {
+  ThreadPool pool(3);
+  std::atomic<int> done{0};
+  {
+    TaskGroup group(pool);
+    for (int i = 0; i < 100; ++i) {
+      group.Run([&] {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        ++done;
+      });
+    }
+    group.Wait();
+    CHECK(done == 100);
+
+    // Reusable after Wait()
+    group.Run([&] { ++done; });
+  } // destructor waits
+  CHECK(done == 101);
+}
+
+// Allocations in pool tasks are charged to the job that submitted them, so
+// each task runs under the submitter's MemoryScope. Only the header-only
+// scope is used: the counters are never dereferenced here.
+static void TasksInheritMemoryScope() {
+  ThreadPool pool(3);
+  alignas(MemoryCounters) unsigned char storage[sizeof(MemoryCounters)];
+  auto *owner = reinterpret_cast<MemoryCounters *>(storage);
+  std::atomic<int> matched{0};
+  {
+    MemoryScope scope(owner);
+    TaskGroup group(pool);
+    for (int i = 0; i < 32; ++i) {
+      group.Run([&] {
+        if (CurrentMemoryCounters() == owner)
+          ++matched;
+      });
+    }
+    pool.ParallelFor(64, 1, [&](size_t, size_t) {
+      if (CurrentMemoryCounters() == owner)
+        ++matched;
+    });
+    group.Wait();
+  }
+  CHECK(matched == 32 + 64);
+  CHECK(CurrentMemoryCounters() == nullptr);
+
+  // Tasks submitted outside any scope run with none
+  std::atomic<bool> unowned{false};
+  {
+    TaskGroup group(pool);
+    group.Run([&] { unowned = CurrentMemoryCounters() == nullptr; });
+  }
+  CHECK(unowned);
+}
+
+// Tasks submitted from a worker land on its own deque; idle siblings steal
+static void IdleWorkersSteal() {
+  ThreadPool pool(4);
+  std::atomic<int> done{0};
+  TaskGroup outer(pool);
+  outer.Run([&] {
+    TaskGroup inner(pool);
+    for (int i = 0; i < 64; ++i) {
+      inner.Run([&] {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++done;
+      });
+    }
+    inner.Wait();
+  });
+  outer.Wait();
+  CHECK(done == 64);
+  if (std::thread::hardware_concurrency() > 1)
+    CHECK(pool.stolen() > 0);
+}
+
+// ============================================================================
+// Scaling
+// ============================================================================
+
+// CPU-bound rows, the shape of the rescale kernel
+static double Work(size_t rows) {
+  double sum = 0.0;
+  for (size_t r = 0; r < rows; ++r) {
+    for (int i = 0; i < 20000; ++i)
+      sum += std::sqrt(static_cast<double>(r * 20000 + i));
+  }
+  return sum;
+}
+
+static double SecondsFor(ThreadPool &pool, size_t rows) {
+  std::atomic<uint64_t> sink{0};
+  auto start = std::chrono::steady_clock::now();
+  pool.ParallelFor(rows, 16, [&](size_t begin, size_t end) {
+    sink += static_cast<uint64_t>(Work(end - begin));
+  });
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Speedup over one worker, reported as efficiency; only checked where
+// there are cores to scale onto
+static void ParallelForScales() {
+  const unsigned hw = std::thread::hardware_concurrency();
+  const size_t rows = 2048;
+
+  ThreadPool single(1);
+  ThreadPool full(0);
+  // Warm up both (thread start, page faults)
+  SecondsFor(single, 64);
+  SecondsFor(full, 64);
+
+  // Best of three, to ride out scheduler noise
+  double t1 = 1e9, tn = 1e9;
+  for (int i = 0; i < 3; ++i) {
+    t1 = std::min(t1, SecondsFor(single, rows));
+    tn = std::min(tn, SecondsFor(full, rows));
+  }
+  // The caller takes part, so the full pool runs size() + 1 threads and the
+  // single-worker pool two
+  const double speedup = t1 / tn;
+  const double ideal = (full.size() + 1) / 2.0;
+  std::printf("  %u hardware threads: %.3f s → %.3f s, speedup %.2fx, "
+              "efficiency %.0f%%\n",
+              hw, t1, tn, speedup, 100.0 * speedup / ideal);
+  if (hw >= 4)
+    CHECK(speedup >= 0.5 * ideal);
+}
+
+int main() {
+  RUN_TEST(ParallelForCoversEachIndexOnce);
+  RUN_TEST(NestedParallelForCompletes);
+  RUN_TEST(TaskGroupWaitsForAll);
+  RUN_TEST(TasksInheritMemoryScope);
+  RUN_TEST(IdleWorkersSteal);
+  RUN_TEST(ParallelForScales);
+  return jxr::test::Failures() == 0 ? 0 : 1;
+}
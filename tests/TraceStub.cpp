@@ -0,0 +1,18 @@
+// Tracing is off in the unit tests; these stand in for Trace.cpp, which
+// needs Windows for its dump
+#include "Trace.h"
+
+namespace jxr {
+
+void TraceEnable(const std::wstring &, size_t) {}
+bool TraceEnabled() { return false; }
+void TraceThreadName(const char *) {}
+void TraceInstant(const char *, const char *, int64_t) {}
+void TraceCounter(const char *, int64_t) {}
+bool TraceDump() { return false; }
+
+TraceSpan::TraceSpan(const char *name, const char *argName, int64_t arg)
+    : name_(name), argName_(argName), arg_(arg), startUs_(-1) {}
+TraceSpan::~TraceSpan() {}
+
+} // namespace jxr